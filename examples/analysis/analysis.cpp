@@ -0,0 +1,167 @@
+
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "VGJS.h"
+#include "VGJSAnalysis.h"
+
+
+/**
+* Critical path and scalability analysis of a binary log file.
+*
+* Usage: vgjs_analyze [--threads N,M,...] [--top N] [file]
+*
+* Reads a log file written by enable_logging() and disable_logging(), "log.vgjs" by default, and prints
+* the total work, the critical path, the parallelism, the range of speedups that can be expected at the
+* given thread counts, the job types and the jobs on the critical path, and the idle gaps of each thread.
+* The verdict says whether the run is limited by the critical path, by scheduling overhead and load
+* imbalance, or by the work itself. Job types are printed as numbers, since the names in JobSystem::types()
+* belong to the program that wrote the file.
+*/
+namespace analysis {
+
+	using namespace vgjs;
+
+	struct Options {
+		std::vector<uint32_t>	m_threads{ 1, 2, 4, 8, 16, 32 };	//thread counts to predict the speedup for
+		std::size_t				m_top = 10;							//number of jobs on the critical path to list
+		std::string				m_file = "log.vgjs";
+	};
+
+
+	//---------------------------------------------------------------------------------------------
+	//output
+
+	std::string ms(double ns) {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3) << ns / 1000000.0;
+		return ss.str();
+	}
+
+	std::string us(double ns) {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1) << ns / 1000.0;
+		return ss.str();
+	}
+
+	std::string verdict(const TraceAnalysis& a) {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1);
+		if (a.m_critical_path >= (double)a.m_work / a.m_threads) {
+			ss << "limited by the critical path: the parallelism " << a.parallelism() << " is below the " << a.m_threads
+				<< " threads, split the jobs on the critical path first";
+		}
+		else if (a.overhead() * 10 > a.m_span) {
+			ss << "limited by scheduling overhead and load imbalance: " << 100.0 * a.overhead() / a.m_span
+				<< "% of the span is not explained by the job graph, look at the idle gaps of the threads";
+		}
+		else {
+			ss << "limited by the work: the run is close to the greedy bound, make the jobs themselves faster";
+		}
+		return ss.str();
+	}
+
+	void print(std::ostream& out, const TraceAnalysis& a, const Options& opt) {
+		out << a.m_events << " events, " << a.m_dropped << " dropped, " << a.m_jobs << " jobs, " << a.m_segments.size() << " segments\n";
+		out << "span " << ms((double)a.m_span) << " ms on " << a.m_threads << " threads, work " << ms((double)a.m_work)
+			<< " ms, critical path " << ms((double)a.m_critical_path) << " ms\n";
+		out << std::fixed << std::setprecision(2) << "parallelism " << a.parallelism() << ", measured speedup " << a.measured_speedup()
+			<< ", overhead and imbalance " << ms((double)a.overhead()) << " ms\n";
+		out << "verdict: " << verdict(a) << "\n";
+
+		out << "\nthreads,slack,min_speedup,max_speedup\n";
+		for (auto threads : opt.m_threads) {
+			out << threads << "," << a.slack(threads) << "," << a.min_speedup(threads) << "," << a.max_speedup(threads) << "\n";
+		}
+
+		out << "\ncritical path by type\ntype,ms,share,segments\n";
+		for (auto& t : a.m_critical_types) {
+			out << t.m_type << "," << ms((double)t.m_time) << "," << (a.m_critical_path > 0 ? 100.0 * t.m_time / a.m_critical_path : 0.0)
+				<< "%," << t.m_segments << "\n";
+		}
+
+		std::vector<std::size_t> longest = a.m_critical;
+		std::sort(longest.begin(), longest.end(), [&](auto x, auto y) { return a.m_segments[x].duration() > a.m_segments[y].duration(); });
+		longest.resize(std::min(longest.size(), opt.m_top));
+		out << "\nlongest jobs on the critical path\njob,type,thread,us,wait_us\n";
+		for (auto i : longest) {
+			auto& seg = a.m_segments[i];
+			out << seg.m_job << "," << seg.m_type << "," << seg.m_thread << "," << us((double)seg.duration()) << "," << us((double)seg.m_wait) << "\n";
+		}
+
+		out << "\nthreads\nthread,segments,busy_ms,idle_ms,gaps,max_gap_us,wait_ms\n";
+		for (auto& w : a.m_workers) {
+			out << w.m_thread << "," << w.m_segments << "," << ms((double)w.m_busy) << "," << ms((double)w.m_idle) << "," << w.m_gaps << ","
+				<< us((double)w.m_max_gap) << "," << ms((double)w.m_wait) << "\n";
+		}
+	}
+
+
+	//---------------------------------------------------------------------------------------------
+	//command line
+
+	std::vector<std::string> split(const std::string& list) {
+		std::vector<std::string> res;
+		std::stringstream ss(list);
+		for (std::string item; std::getline(ss, item, ','); ) if (!item.empty()) res.push_back(item);
+		return res;
+	}
+
+	void usage() {
+		std::cerr << "Usage: vgjs_analyze [--threads N,M,...] [--top N] [file]\n";
+	}
+
+	bool parse(int argc, char* argv[], Options& opt) {
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			auto value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+			try {
+				if (arg == "--threads") {
+					opt.m_threads.clear();
+					for (auto& n : split(value())) opt.m_threads.push_back((uint32_t)std::max(std::stoi(n), 1));
+				}
+				else if (arg == "--top")		opt.m_top = (std::size_t)std::max(std::stoi(value()), 0);
+				else if (arg.starts_with("--")) {
+					usage();
+					return false;
+				}
+				else opt.m_file = arg;
+			}
+			catch (...) {
+				usage();
+				return false;
+			}
+		}
+		if (opt.m_threads.empty()) {
+			usage();
+			return false;
+		}
+		return true;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	analysis::Options opt;
+	if (!analysis::parse(argc, argv, opt)) return 1;
+
+	std::vector<vgjs::TraceEvent> events;
+	if (!vgjs::read_trace(opt.m_file, events)) {
+		std::cerr << "Cannot read the log file " << opt.m_file << "\n";
+		return 1;
+	}
+	auto result = vgjs::analyze_trace(std::move(events));
+	if (result.m_segments.empty()) {
+		std::cerr << "The log file " << opt.m_file << " contains no jobs\n";
+		return 1;
+	}
+	analysis::print(std::cout, result, opt);
+	return 0;
+}
@@ -0,0 +1,504 @@
+
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <thread>
+#include <cmath>
+
+#include "VGJS.h"
+#include "VGJSCoro.h"
+
+using namespace std::chrono;
+
+
+/**
+* Non-interactive benchmark suite of the job system.
+*
+* Usage: vgjs_bench [--scenario all|name,name,...] [--threads N|N,M,...|sweep] [--iterations R]
+*                   [--size N] [--format csv|json] [--out file] [--label text] [--no-header]
+*
+* Every scenario is run R times. For each scenario and thread count one result is reported, holding
+* the jobs per iteration, the jobs per second, and the mean, median and 99th percentile of the
+* iteration times (for wakeup: of the wake up latencies) in microseconds.
+* The job system can only be started once per process, so if more than one thread count is given,
+* the benchmark runs itself once per thread count and collects the results.
+*/
+namespace bench {
+
+	using namespace vgjs;
+
+	const std::string c_label_unsafe = "\"$`\\%!\r\n";	//cannot be passed in double quotes to a child process
+
+	const std::vector<std::string> c_scenarios = { "spawn", "fanout", "coro_chain", "tagged", "continuation", "imbalance", "wakeup", "layout" };
+
+	struct Options {
+		std::vector<int>			m_threads{ 0 };			//0 means one thread per logical CPU
+		std::vector<std::string>	m_scenarios = c_scenarios;
+		int							m_iterations = 30;		//runs per scenario
+		int							m_size = 10000;			//number of jobs per run, each scenario derives its size from it
+		std::string					m_format = "csv";
+		std::string					m_out;					//empty means stdout
+		std::string					m_label = "vgjs";		//e.g. the library version, must not contain commas or c_label_unsafe
+		bool						m_header = true;
+	};
+
+	struct Result {
+		std::string m_label;
+		std::string m_scenario;
+		int			m_threads = 0;
+		int			m_iterations = 0;
+		uint64_t	m_jobs = 0;				//jobs per iteration
+		double		m_jobs_per_s = 0.0;
+		double		m_mean_us = 0.0;
+		double		m_p50_us = 0.0;
+		double		m_p99_us = 0.0;
+	};
+
+
+	//---------------------------------------------------------------------------------------------
+	//output
+
+	const char* c_csv_header = "label,scenario,threads,iterations,jobs,jobs_per_s,mean_us,p50_us,p99_us";
+
+	std::string to_csv(const Result& r) {
+		std::stringstream ss;
+		ss << r.m_label << ',' << r.m_scenario << ',' << r.m_threads << ',' << r.m_iterations << ',' << r.m_jobs << ','
+			<< std::fixed << std::setprecision(1) << r.m_jobs_per_s << ',' << std::setprecision(3) << r.m_mean_us << ','
+			<< r.m_p50_us << ',' << r.m_p99_us;
+		return ss.str();
+	}
+
+	bool from_csv(const std::string& line, Result& r) {
+		std::stringstream ss(line);
+		std::vector<std::string> f;
+		for (std::string field; std::getline(ss, field, ','); ) f.push_back(field);
+		if (f.size() != 9 || f[0] == "label") return false;
+		try {
+			r = Result{ f[0], f[1], std::stoi(f[2]), std::stoi(f[3]), std::stoull(f[4]), std::stod(f[5]), std::stod(f[6]), std::stod(f[7]), std::stod(f[8]) };
+		}
+		catch (...) {
+			return false;
+		}
+		return true;
+	}
+
+	std::string to_json(const Result& r) {
+		std::stringstream ss;
+		ss << "{\"label\": \"" << r.m_label << "\", \"scenario\": \"" << r.m_scenario << "\", \"threads\": " << r.m_threads
+			<< ", \"iterations\": " << r.m_iterations << ", \"jobs\": " << r.m_jobs
+			<< std::fixed << std::setprecision(1) << ", \"jobs_per_s\": " << r.m_jobs_per_s << std::setprecision(3)
+			<< ", \"mean_us\": " << r.m_mean_us << ", \"p50_us\": " << r.m_p50_us << ", \"p99_us\": " << r.m_p99_us << "}";
+		return ss.str();
+	}
+
+	void print(std::ostream& out, const std::vector<Result>& results, const Options& opt) {
+		if (opt.m_format == "json") {
+			out << "[\n";
+			for (std::size_t i = 0; i < results.size(); ++i) {
+				out << "  " << to_json(results[i]) << (i + 1 < results.size() ? ",\n" : "\n");
+			}
+			out << "]\n";
+			return;
+		}
+		if (opt.m_header) out << c_csv_header << "\n";
+		for (auto& r : results) out << to_csv(r) << "\n";
+	}
+
+
+	//---------------------------------------------------------------------------------------------
+	//measuring
+
+	double percentile(std::vector<double> samples, double p) {
+		if (samples.empty()) return 0.0;
+		std::sort(samples.begin(), samples.end());
+		std::size_t idx = std::min(samples.size() - 1, (std::size_t)(p * (samples.size() - 1) + 0.5));
+		return samples[idx];
+	}
+
+	double elapsed_us(high_resolution_clock::time_point t0) {
+		return duration_cast<nanoseconds>(high_resolution_clock::now() - t0).count() / 1000.0;
+	}
+
+	Result make_result(const Options& opt, std::string scenario, uint64_t jobs, const std::vector<double>& samples) {
+		JobSystem js;
+		double sum = std::accumulate(samples.begin(), samples.end(), 0.0);
+		Result r;
+		r.m_label = opt.m_label;
+		r.m_scenario = scenario;
+		r.m_threads = js.get_thread_count().value;
+		r.m_iterations = (int)samples.size();
+		r.m_jobs = jobs;
+		r.m_jobs_per_s = sum > 0.0 ? jobs * samples.size() / (sum / 1000000.0) : 0.0;
+		r.m_mean_us = samples.empty() ? 0.0 : sum / samples.size();
+		r.m_p50_us = percentile(samples, 0.5);
+		r.m_p99_us = percentile(samples, 0.99);
+		return r;
+	}
+
+	//spin for some microseconds
+	void busy(int micro) {
+		auto start = high_resolution_clock::now();
+		volatile double root = 1.0;
+		while (duration_cast<microseconds>(high_resolution_clock::now() - start).count() < micro) {
+			root = std::sqrt(root + 1.0);
+		}
+	}
+
+
+	//---------------------------------------------------------------------------------------------
+	//scenarios
+
+	//spawn throughput: a vector of empty functions is scheduled in one batch
+	Coro<Result> spawn(const Options& opt) {
+		std::atomic<uint64_t> counter = 0;
+		std::pmr::vector<std::function<void(void)>> jobs(opt.m_size, [&]() { counter.fetch_add(1, std::memory_order_relaxed); });
+		std::vector<double> samples;
+		for (int i = 0; i < opt.m_iterations; ++i) {
+			auto t0 = high_resolution_clock::now();
+			co_await jobs;
+			samples.push_back(elapsed_us(t0));
+		}
+		co_return make_result(opt, "spawn", opt.m_size, samples);
+	}
+
+	//fan-out/fan-in: every job schedules 4 children, the parent finishes when all children have finished
+	void tree(std::atomic<uint64_t>* counter, int depth) {
+		counter->fetch_add(1, std::memory_order_relaxed);
+		if (depth == 0) return;
+		for (int i = 0; i < 4; ++i) schedule([=]() { tree(counter, depth - 1); });
+	}
+
+	Coro<Result> fanout(const Options& opt) {
+		int depth = 0;
+		uint64_t jobs = 1;
+		while (jobs * 4 + 1 <= (uint64_t)opt.m_size) { jobs = jobs * 4 + 1; ++depth; }
+		std::atomic<uint64_t> counter = 0;
+		std::vector<double> samples;
+		for (int i = 0; i < opt.m_iterations; ++i) {
+			auto t0 = high_resolution_clock::now();
+			co_await [&]() { tree(&counter, depth); };
+			samples.push_back(elapsed_us(t0));
+		}
+		co_return make_result(opt, "fanout", jobs, samples);
+	}
+
+	//deep co_await chain: each coro awaits the next one
+	Coro<int> chain(int depth) {
+		if (depth == 0) co_return 0;
+		int ret = co_await chain(depth - 1);
+		co_return ret + 1;
+	}
+
+	Coro<Result> coro_chain(const Options& opt) {
+		int depth = std::max(opt.m_size / 10, 1);
+		std::vector<double> samples;
+		for (int i = 0; i < opt.m_iterations; ++i) {
+			auto t0 = high_resolution_clock::now();
+			co_await chain(depth);
+			samples.push_back(elapsed_us(t0));
+		}
+		co_return make_result(opt, "coro_chain", depth + 1, samples);
+	}
+
+	//tagged scheduling: jobs are scheduled one by one for a tag, then the tag is run
+	Coro<Result> tagged(const Options& opt) {
+		std::atomic<uint64_t> counter = 0;
+		std::vector<double> samples;
+		for (int i = 0; i < opt.m_iterations; ++i) {
+			auto t0 = high_resolution_clock::now();
+			for (int j = 0; j < opt.m_size; ++j) {
+				schedule([&]() { counter.fetch_add(1, std::memory_order_relaxed); }, tag_t{ 1 });
+			}
+			co_await tag_t{ 1 };
+			samples.push_back(elapsed_us(t0));
+		}
+		co_return make_result(opt, "tagged", opt.m_size, samples);
+	}
+
+	//continuation chains: each job sets the next job as its continuation
+	void cont(std::atomic<uint64_t>* counter, int n) {
+		counter->fetch_add(1, std::memory_order_relaxed);
+		if (n > 0) continuation([=]() { cont(counter, n - 1); });
+	}
+
+	Coro<Result> continuation_chain(const Options& opt) {
+		int length = std::max(opt.m_size / 10, 1);
+		std::atomic<uint64_t> counter = 0;
+		std::vector<double> samples;
+		for (int i = 0; i < opt.m_iterations; ++i) {
+			auto t0 = high_resolution_clock::now();
+			co_await [&]() { cont(&counter, length - 1); };
+			samples.push_back(elapsed_us(t0));
+		}
+		co_return make_result(opt, "continuation", length, samples);
+	}
+
+	//steal-heavy imbalance: one job creates all the work in its own queue, the other threads must steal it
+	Coro<Result> imbalance(const Options& opt) {
+		int num = std::max(opt.m_size / 10, 1);
+		std::vector<double> samples;
+		for (int i = 0; i < opt.m_iterations; ++i) {
+			auto t0 = high_resolution_clock::now();
+			co_await [=]() { for (int j = 0; j < num; ++j) schedule([]() { busy(5); }); };
+			samples.push_back(elapsed_us(t0));
+		}
+		co_return make_result(opt, "imbalance", num, samples);
+	}
+
+	//idle wake-up latency: a job is pinned to another thread that has parked
+	Coro<Result> wakeup(const Options& opt) {
+		JobSystem js;
+		std::vector<double> samples;
+		if (js.get_thread_count().value < 2) co_return make_result(opt, "wakeup", 1, samples);
+		for (int i = 0; i < opt.m_iterations; ++i) {
+			std::this_thread::sleep_for(milliseconds(2));	//let all other threads park
+			thread_index_t other{ (js.get_thread_index().value + 1) % js.get_thread_count().value };
+			high_resolution_clock::time_point t1;
+			auto t0 = high_resolution_clock::now();
+			co_await Function{ [&]() { t1 = high_resolution_clock::now(); }, other };
+			samples.push_back(duration_cast<nanoseconds>(t1 - t0).count() / 1000.0);
+		}
+		co_return make_result(opt, "wakeup", 1, samples);
+	}
+
+	//worker state layout: every worker pushes jobs into its own queue and into the inbox of its neighbour, pops
+	//its own queue, steals from its neighbour and counts the jobs it got, with the WorkerQueue and WorkerCounters
+	//of the job system. Once with the state of all workers in parallel vectors, and once in one WorkerContext per
+	//worker on the NUMA node of its CPU. The jobs themselves are empty tokens that are never run.
+	struct Token : Job_base {
+		bool resume() noexcept { return true; }
+	};
+
+	struct PackedLayout {
+		std::vector<WorkerQueue<Job_base>>	m_queues;
+		std::vector<WorkerCounters>			m_counters;
+
+		PackedLayout(JobSystem&, uint32_t threads) : m_queues(threads), m_counters(threads) {}
+		WorkerQueue<Job_base>& queue(uint32_t t) { return m_queues[t]; }
+		WorkerCounters& counters(uint32_t t) { return m_counters[t]; }
+	};
+
+	struct ContextLayout {
+		std::vector<std::unique_ptr<WorkerContext, WorkerContext::deleter>> m_contexts;
+
+		ContextLayout(JobSystem& js, uint32_t threads) {
+			for (uint32_t t = 0; t < threads; ++t) m_contexts.push_back(WorkerContext::create(js.get_cpu(thread_index_t{ (int)t })));
+		}
+		WorkerQueue<Job_base>& queue(uint32_t t) { return m_contexts[t]->m_global; }
+		WorkerCounters& counters(uint32_t t) { return m_contexts[t]->m_counters; }
+	};
+
+	template<typename L>
+	Coro<Result> layout(const Options& opt, std::string name) {
+		const uint32_t c_tokens = 8;				//tokens per worker, 2 of them go to the neighbour in each round
+		JobSystem js;
+		uint32_t threads = std::max(js.get_thread_count().value, 1);
+		uint64_t rounds = std::max((uint64_t)opt.m_size, (uint64_t)1);
+		L workers(js, threads);
+		std::vector<Token> tokens(threads * c_tokens);
+		std::vector<double> samples;
+		for (int i = 0; i < opt.m_iterations; ++i) {
+			std::pmr::vector<Function> jobs;
+			for (uint32_t t = 0; t < threads; ++t) {
+				jobs.emplace_back(Function{ [&, t]() {
+					auto& own = workers.queue(t);
+					auto& next = workers.queue((t + 1) % threads);
+					auto& counters = workers.counters(t);
+					std::vector<Job_base*> free;			//tokens this worker holds, they move between the workers
+					for (uint32_t k = 0; k < c_tokens; ++k) free.push_back(&tokens[t * c_tokens + k]);
+					for (uint64_t r = 0; r < rounds; ++r) {
+						for (uint32_t k = 0; !free.empty(); ++k) {
+							if (k < 2) next.push(free.back());		//handed to the neighbour
+							else own.push_owner(free.back());
+							free.pop_back();
+						}
+						while (Job_base* job = own.pop()) free.push_back(job);
+						if (Job_base* job = next.steal(own, c_tokens)) free.push_back(job);		//the rest is popped next round
+						counters.m_jobs.store(counters.m_jobs.load(std::memory_order_relaxed) + free.size(), std::memory_order_relaxed);
+					}
+				}, thread_index_t{ (int)t } });	//one job per worker, all run at the same time
+			}
+			auto t0 = high_resolution_clock::now();
+			co_await jobs;
+			samples.push_back(elapsed_us(t0));
+			for (uint32_t t = 0; t < threads; ++t) {	//tokens that are left in the queues, all workers are done
+				while (workers.queue(t).pop() != nullptr);
+			}
+		}
+		co_return make_result(opt, name, rounds * threads * c_tokens, samples);
+	}
+
+	//run all selected scenarios, then terminate the job system
+	Coro<> run(const Options& opt, std::vector<Result>& results) {
+		for (auto& name : opt.m_scenarios) {
+			Result r;
+			if (name == "spawn")				r = co_await spawn(opt);
+			else if (name == "fanout")			r = co_await fanout(opt);
+			else if (name == "coro_chain")		r = co_await coro_chain(opt);
+			else if (name == "tagged")			r = co_await tagged(opt);
+			else if (name == "continuation")	r = co_await continuation_chain(opt);
+			else if (name == "imbalance")		r = co_await imbalance(opt);
+			else if (name == "wakeup")			r = co_await wakeup(opt);
+			else if (name == "layout") {		//the scattered layout first, then the per-worker blocks
+				results.push_back(co_await layout<PackedLayout>(opt, "layout_packed"));
+				r = co_await layout<ContextLayout>(opt, "layout_context");
+			}
+			if (r.m_iterations > 0) results.push_back(r);	//e.g. wakeup needs at least 2 threads
+		}
+		vgjs::terminate();
+		co_return;
+	}
+
+
+	//---------------------------------------------------------------------------------------------
+	//command line
+
+	std::vector<std::string> split(const std::string& list) {
+		std::vector<std::string> res;
+		std::stringstream ss(list);
+		for (std::string item; std::getline(ss, item, ','); ) if (!item.empty()) res.push_back(item);
+		return res;
+	}
+
+	void usage() {
+		std::cerr << "Usage: vgjs_bench [--scenario all|name,...] [--threads N|N,M,...|sweep] [--iterations R]\n"
+			<< "                  [--size N] [--format csv|json] [--out file] [--label text] [--no-header]\n"
+			<< "Scenarios:";
+		for (auto& s : c_scenarios) std::cerr << " " << s;
+		std::cerr << "\n";
+	}
+
+	bool parse(int argc, char* argv[], Options& opt) {
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			auto value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : ""; };
+			try {
+				if (arg == "--scenario") {
+					std::string v = value();
+					opt.m_scenarios = v == "all" ? c_scenarios : split(v);
+					for (auto& s : opt.m_scenarios) {
+						if (std::find(c_scenarios.begin(), c_scenarios.end(), s) == c_scenarios.end()) {
+							std::cerr << "Unknown scenario " << s << "\n";
+							return false;
+						}
+					}
+				}
+				else if (arg == "--threads") {
+					std::string v = value();
+					opt.m_threads.clear();
+					if (v == "sweep") {
+						int hw = std::max((int)topology().m_cpus.size(), 2);
+						for (int n = 1; n < hw; n *= 2) opt.m_threads.push_back(n);
+						opt.m_threads.push_back(hw);
+					}
+					else {
+						for (auto& n : split(v)) opt.m_threads.push_back(std::stoi(n));
+					}
+				}
+				else if (arg == "--iterations")	opt.m_iterations = std::max(std::stoi(value()), 1);
+				else if (arg == "--size")		opt.m_size = std::max(std::stoi(value()), 1);
+				else if (arg == "--format")		opt.m_format = value();
+				else if (arg == "--out")		opt.m_out = value();
+				else if (arg == "--label")		opt.m_label = value();
+				else if (arg == "--no-header")	opt.m_header = false;
+				else {
+					usage();
+					return false;
+				}
+			}
+			catch (...) {
+				usage();
+				return false;
+			}
+		}
+		if (opt.m_threads.empty() || (opt.m_format != "csv" && opt.m_format != "json") || opt.m_label.find(',') != std::string::npos
+			|| opt.m_label.find_first_of(c_label_unsafe) != std::string::npos) {
+			usage();
+			return false;
+		}
+		return true;
+	}
+
+	//run the scenarios in this process
+	std::vector<Result> run_here(int threads, const Options& opt) {
+		std::vector<Result> results;
+		JobSystem js(thread_count_t{ threads });
+		schedule(run(opt, results));
+		wait_for_termination();
+		return results;
+	}
+
+	//run the scenarios in a child process, since the job system can be started only once per process
+	std::vector<Result> run_child(const char* self, int threads, const Options& opt) {
+		std::stringstream cmd;
+		cmd << "\"" << self << "\" --threads " << threads << " --iterations " << opt.m_iterations << " --size " << opt.m_size
+			<< " --format csv --no-header --label \"" << opt.m_label << "\" --scenario ";
+		for (std::size_t i = 0; i < opt.m_scenarios.size(); ++i) cmd << (i > 0 ? "," : "") << opt.m_scenarios[i];
+
+		std::vector<Result> results;
+#ifdef _WIN32
+		FILE* pipe = _popen(("\"" + cmd.str() + "\"").c_str(), "r");
+#else
+		FILE* pipe = popen(cmd.str().c_str(), "r");
+#endif
+		if (pipe == nullptr) {
+			std::cerr << "Cannot run " << self << "\n";
+			return results;
+		}
+		std::string line;
+		char buffer[512];
+		while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+			line += buffer;
+			if (line.empty() || line.back() != '\n') continue;
+			line.pop_back();
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			Result r;
+			if (from_csv(line, r)) results.push_back(r);
+			line.clear();
+		}
+#ifdef _WIN32
+		_pclose(pipe);
+#else
+		pclose(pipe);
+#endif
+		return results;
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	bench::Options opt;
+	if (!bench::parse(argc, argv, opt)) return 1;
+
+	std::vector<bench::Result> results;
+	if (opt.m_threads.size() == 1) {
+		results = bench::run_here(opt.m_threads[0], opt);
+	}
+	else {
+		for (int threads : opt.m_threads) {
+			auto res = bench::run_child(argv[0], threads, opt);
+			results.insert(results.end(), res.begin(), res.end());
+		}
+	}
+
+	if (opt.m_out.empty()) {
+		bench::print(std::cout, results, opt);
+	}
+	else {
+		std::ofstream file(opt.m_out);
+		bench::print(file, results, opt);
+	}
+	return 0;
+}
+
@@ -126,8 +126,8 @@ namespace docu {
             int value = 0;          //initialize the fiber here
             while (true) {          //a fiber never returns
                 int res = value * input_parameter; //use internal and input parameters
-                co_yield res;       //set std::pair<bool,T> value to indicate that this fiber is ready, and suspend
-                //here its std::pair<bool,T> value is set to (false, T{}) to indicate thet the fiber is working
+                co_yield res;       //store the value to indicate that this fiber is ready, and suspend
+                //here the value is invalidated to indicate that the fiber is working
                 //co_await other(value, input_parameter);  //call any child
                 ++value;            //do something useful
             }
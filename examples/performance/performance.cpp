@@ -6,6 +6,8 @@
 #include <algorithm>
 #include <chrono>
 #include <numeric>
+#include <thread>
+#include <ctime>
 
 #include "VGJS.h"
 #include "VGJSCoro.h"
@@ -145,6 +147,45 @@ namespace test {
 	}
 
 
+	//CPU time used by the whole process so far
+	double process_cpu_time_ms() {
+#ifdef _WIN32
+		FILETIME creation, exit, kernel, user;
+		GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+		auto to_ms = [](FILETIME& ft) { return (((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime) / 10000.0; };
+		return to_ms(kernel) + to_ms(user);
+#else
+		return 1000.0 * std::clock() / CLOCKS_PER_SEC;
+#endif
+	}
+
+
+	//measure how long a parked thread needs to start a job that is pinned to it, and how much CPU idle threads burn
+	Coro<> test_wakeup(int rounds = 100, int idle_ms = 500) {
+		JobSystem js;
+		if (js.get_thread_count().value < 2) co_return;
+
+		double sum = 0.0, max = 0.0;
+		for (int i = 0; i < rounds; ++i) {
+			std::this_thread::sleep_for(milliseconds(2));	//let all other threads park
+			thread_index_t other{ (js.get_thread_index().value + 1) % js.get_thread_count().value };
+			high_resolution_clock::time_point t1;
+			auto t0 = high_resolution_clock::now();
+			co_await Function{ [&]() { t1 = high_resolution_clock::now(); }, other };
+			double latency = duration_cast<nanoseconds>(t1 - t0).count() / 1000.0;
+			sum += latency;
+			max = std::max(max, latency);
+		}
+		std::cout << "Wake up latency: avg " << std::setw(8) << sum / rounds << " us max " << std::setw(8) << max << " us\n";
+
+		auto cpu0 = process_cpu_time_ms();
+		std::this_thread::sleep_for(milliseconds(idle_ms));	//all other threads are idle
+		auto cpu1 = process_cpu_time_ms();
+		std::cout << "Idle CPU time: " << std::setw(8) << (cpu1 - cpu0) << " ms in " << idle_ms << " ms with " << js.get_thread_count().value - 1 << " idle threads\n";
+		co_return;
+	}
+
+
 	template<bool WITHALLOCATE = false, typename FT1 = Function, typename FT2 = std::function<void(void)>>
 	Coro<std::tuple<double,double>> performance_function(bool print = true, bool wrtfunc = true, int num = 1000, int micro = 1, std::pmr::memory_resource* mr = std::pmr::new_delete_resource()) {
 		JobSystem js;
@@ -202,7 +243,7 @@ namespace test {
 
 
 	template<bool WITHALLOCATE = false, typename FT1, typename FT2>
-	Coro<> performance_driver(std::string text, std::pmr::memory_resource* mr = std::pmr::new_delete_resource(), int runtime = 400000) {
+	Coro<> performance_driver(std::string text, std::pmr::memory_resource* mr = std::pmr::new_delete_resource(), int runtime = 400000, bool epoch = false) {
 		int num = runtime;
 		const int st = 0;
 		const int mt = 100;
@@ -220,12 +261,14 @@ namespace test {
 		co_await performance_function<WITHALLOCATE, FT1, FT2>(false, wrt_function, (int)(num), 0); //heat up, allocate enough jobs
 		for (int us = st; us <= mt; us += mdt) {
 			int loops = (us == 0 ? num : (runtime / us));
-			auto [speedup, eff] = co_await performance_function<WITHALLOCATE,FT1,FT2>(true, wrt_function, loops, us, mr);
-			if (eff > 0.95) co_return;
+			if (epoch) begin_epoch();		//each run allocates from the arenas of a new epoch
+			auto [speedup, eff] = co_await performance_function<WITHALLOCATE,FT1,FT2>(true, wrt_function, loops, us, epoch ? epoch_resource() : mr);
+			if (eff > 0.95) break;
 			if (us >= 15) mdt = dt2;
 			if (us >= 20) mdt = dt3;
 			if (us >= 50) mdt = dt4;
 		}
+		if (epoch) end_epoch();
 		co_return;
 	}
 
@@ -235,6 +278,9 @@ namespace test {
 		std::atomic<int> counter = 0;
 		JobSystem js;
 
+		std::cout << "\n\nTest wake up latency and idle CPU time\n";
+		co_await test_wakeup();
+
 		std::cout << "\n\nTest utilization drop\n";
 		co_await test_utilization_drop(4);		
 
@@ -260,10 +306,15 @@ namespace test {
 		//co_await performance_driver<true, Coro<>, Coro<>>("Coro<> calls (with allocate unsynchronized)", &g_local_mem_c);
 		//co_await performance_driver<true, Coro<>, Coro<>>("Coro<> calls (with allocate monotonic)", &g_local_mem_m);
 		//g_local_mem_m.release();
+		co_await performance_driver<true, Coro<>, Coro<>>("Coro<> calls (with allocate epoch)", nullptr, 400000, true);
 
 		std::cout << "\n\nTest utilization drop\n";
 		co_await test_utilization_drop(4);
 
+		auto slab = slab_stats();
+		std::cout << "\n\nSlab resource: " << slab.m_allocations << " allocations, hit rate " << slab.hit_rate()
+			<< ", remote frees " << slab.m_remote_frees << ", slabs " << slab.m_slabs << ", large " << slab.m_large << "\n";
+
 		vgjs::terminate();
 
 		co_return;
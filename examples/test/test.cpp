@@ -6,9 +6,16 @@
 #include <algorithm>
 #include <chrono>
 #include <numeric>
+#include <memory>
+#include <array>
+#include <stdexcept>
+#include <filesystem>
 
 #include "VGJS.h"
 #include "VGJSCoro.h"
+#include "VGJSIO.h"
+#include "VGJSChannel.h"
+#include "VGJSAnalysis.h"
 
 using namespace std::chrono;
 
@@ -52,6 +59,17 @@ namespace test {
 		co_return ret;
 	}
 
+	Coro<int> coro_throw(int i) {
+		if (i > 0) throw std::runtime_error("coro_throw");
+		co_return i;
+	}
+
+	Coro<int> coro_sleep(std::atomic<int>* atomic_int) {
+		co_await after(std::chrono::milliseconds(200));
+		(*atomic_int)++;
+		co_return 1;
+	}
+
 	Coro<float> coro_float(std::atomic<int>* atomic_int, float f = 1.0f) {
 		while (true) {
 			(*atomic_int)++;
@@ -190,6 +208,7 @@ namespace test {
 
 		TESTRESULT(++number, "Single Coro<int>", auto ret1 = co_await coro_int(std::allocator_arg, &g_global_mem, &counter), ret1 == 1 && counter.load() == 1, counter = 0);
 		TESTRESULT(++number, "10 Coro<int>", auto ret2 = co_await coro_int(std::allocator_arg, &g_global_mem, &counter, 10), ret2 == 10 && counter.load() == 10, counter = 0);
+		TESTRESULT(++number, "Eager Coro<int>", auto ret_eager = co_await eager(coro_int(std::allocator_arg, &g_global_mem, &counter, 10)), ret_eager == 10 && counter.load() == 10, counter = 0);
 		auto [ret3, ret4] = co_await parallel(coro_int(std::allocator_arg, &g_global_mem, &counter), coro_int(std::allocator_arg, &g_global_mem, &counter));
 		TESTRESULT(++number, "Parallel Coro<int>", , ret3 == 1 && ret4 == 1 && counter.load() == 2, counter = 0);
 		auto [ret5, ret6] = co_await parallel(coro_int(std::allocator_arg, &g_global_mem, &counter, 10), coro_int(std::allocator_arg, &g_global_mem, &counter, 10));
@@ -296,6 +315,134 @@ namespace test {
 		TESTRESULT(++number, "Tagged jobs 1", co_await tag_t{ 1 }, counter.load() == 2, );
 		TESTRESULT(++number, "Tagged jobs 2", co_await tag_t{ 2 }, counter.load() == 4, );
 		TESTRESULT(++number, "Tagged jobs 3", co_await tag_t{ 3 }, counter.load() == 10, counter = 0);
+
+		std::pmr::vector<std::function<void(void)>> taggers(100, std::function<void(void)>{ [&]() { schedule([&]() { counter++; }, tag_t{ 4 }); } });
+		co_await taggers;       //many threads push into the same tag
+		TESTRESULT(++number, "Tagged jobs from many jobs", co_await tag_t{ 4 }, counter.load() == 100, counter = 0);
+		co_await parallel(tag_t{ 1 << 20 }, tagvf);
+		TESTRESULT(++number, "Tagged jobs large tag", co_await tag_t{ 1 << 20 }, counter.load() == 2, counter = 0);
+
+		//waiting for a job handle
+		auto handle = js.schedule([&]() { func(&counter, 10); }, JobPriority::HIGH, thread_index_t{}, true);
+		TESTRESULT(++number, "Wait for job handle", handle.wait(), handle.is_done() && counter.load() == 10, counter = 0);
+		TESTRESULT(++number, "Wait on other thread", std::thread([&]() { auto h = js.schedule([&]() { func(&counter, 10); }, JobPriority::HIGH, thread_index_t{}, true); js.wait(h); }).join(), counter.load() == 10, counter = 0);
+
+		//parallel loops
+		TESTRESULT(++number, "parallel_for", co_await parallel_for(0, 10000, 16, [&](int) { counter++; }), counter.load() == 10000, counter = 0);
+		auto sum = co_await parallel_reduce(0, 10000, 16, 0, [](int i) { return i; }, [](int a, int b) { return a + b; });
+		TESTRESULT(++number, "parallel_reduce", , sum == 49995000, );
+		TESTRESULT(++number, "parallel_for in function", co_await [&]() { parallel_for(0, 1000, 1, [&](int) { counter++; }).wait(); }, counter.load() == 1000, counter = 0);
+
+		TESTRESULT(++number, "Slab resource", auto slab = slab_stats(), slab.m_allocations > 0 && slab.hit_rate() > 0.5, );
+		TESTRESULT(++number, "Topology", auto& cpu = js.get_cpu(thread_index_t{ 0 }), cpu.m_l3 < topology().m_num_l3 && cpu.m_numa < topology().m_num_numa && cpu.m_core < topology().m_num_cores, );
+		TESTRESULT(++number, "Steal counters", auto steals = steal_stats(), steals.m_successes <= steals.m_attempts && steals.m_jobs >= steals.m_successes, );
+		TESTRESULT(++number, "Scheduler metrics", auto metrics = snapshot_metrics(), metrics.m_workers.size() == (std::size_t)js.get_thread_count().value + 1 && metrics.m_total.m_jobs > 0 && metrics.m_total.m_allocated >= metrics.m_total.m_freed, );
+		auto deadlines = snapshot_metrics().m_total;
+		co_await parallel(Function{ [&]() { counter++; }, thread_index_t{}, thread_type_t{}, thread_id_t{}, std::chrono::seconds(10) }
+			, coro_void(std::allocator_arg, &g_global_mem, &counter, 1)(thread_index_t{}, thread_type_t{}, thread_id_t{}, std::chrono::seconds(10)));
+		TESTRESULT(++number, "Deadline jobs", auto late = snapshot_metrics().m_total, counter.load() == 2 && late.m_deadline_jobs == deadlines.m_deadline_jobs + 2 && late.m_deadline_misses == deadlines.m_deadline_misses, counter = 0);
+		TESTRESULT(++number, "Deadline miss", co_await Function([&]() { counter++; }, thread_index_t{}, thread_type_t{}, thread_id_t{}, std::chrono::nanoseconds(1)), snapshot_metrics().m_total.m_deadline_misses == deadlines.m_deadline_misses + 1, counter = 0);
+		auto batched = snapshot_metrics().m_total.m_batched;
+		TESTRESULT(++number, "Batched jobs", co_await [&]() { func(&counter, 1000); }, counter.load() == 1000 && snapshot_metrics().m_total.m_batched > batched, counter = 0);
+		std::vector<TraceEvent> trace{		//A spawns B and C, D continues C
+			{ 0, 1, 0, 0, 0, -1, TraceEventType::job_started }, { 2, 2, 1, 0, 0, -1, TraceEventType::job_scheduled }, { 3, 3, 1, 0, 1, -1, TraceEventType::job_scheduled },
+			{ 10, 1, 0, 0, 0, -1, TraceEventType::job_finished }, { 10, 2, 8, 0, 0, -1, TraceEventType::job_started }, { 30, 2, 0, 0, 0, -1, TraceEventType::job_finished },
+			{ 11, 3, 8, 1, 0, -1, TraceEventType::job_started }, { 21, 3, 0, 1, 0, -1, TraceEventType::job_finished },
+			{ 21, 4, 3, 1, 0, -1, TraceEventType::job_continued }, { 21, 4, 0, 1, 1, -1, TraceEventType::job_scheduled }, { 21, 4, 0, 1, 0, -1, TraceEventType::job_started }, { 25, 4, 0, 1, 0, -1, TraceEventType::job_finished } };
+		TESTRESULT(++number, "Trace analysis", auto analysis = analyze_trace(trace), analysis.m_work == 44 && analysis.m_critical_path == 22 && analysis.m_critical.size() == 2 && analysis.m_span == 30 && analysis.m_workers.size() == 2 && analysis.m_workers[1].m_idle == 16, );
+		std::vector<TraceEvent> nested{		//A runs B on its own thread, e.g. in run_until()
+			{ 0, 1, 0, 0, 0, -1, TraceEventType::job_started }, { 2, 2, 1, 0, 0, -1, TraceEventType::job_scheduled }, { 5, 2, 3, 0, 0, -1, TraceEventType::job_started },
+			{ 15, 2, 0, 0, 0, -1, TraceEventType::job_finished }, { 20, 1, 0, 0, 0, -1, TraceEventType::job_finished } };
+		TESTRESULT(++number, "Nested trace analysis", auto inner = analyze_trace(nested), inner.m_work == 20 && inner.m_segments.size() == 3 && inner.m_critical_path == 17 && inner.m_critical.size() == 3 && inner.m_workers[0].m_idle == 0, );
+
+		//asynchronous I/O
+		auto io_path = (std::filesystem::temp_directory_path() / "vgjs_io_test.bin").string();
+		auto io_file = open_file(io_path, true);
+		std::array<std::byte, 256> io_out, io_in{};
+		for (int i = 0; i < 256; ++i) io_out[i] = std::byte(i);
+		auto io_written = co_await async_write(io_file, 0, io_out);
+		TESTRESULT(++number, "Async I/O", auto io_read = co_await async_read(io_file, 0, io_in), io_written == 256 && io_read == 256 && io_in == io_out, close_file(io_file); std::filesystem::remove(io_path));
+
+		//timers
+		auto sleep_start = high_resolution_clock::now();
+		TESTRESULT(++number, "co_await after", co_await after(2ms), high_resolution_clock::now() - sleep_start >= 2ms, );
+		TESTRESULT(++number, "schedule_after", co_await [&]() { schedule_after(2ms, [&]() { counter++; }); schedule_at(steady_clock::now() + 1ms, [&]() { counter++; }); }, counter.load() == 2, counter = 0);
+		TimerWheel<Job_base> wheel;		//a level 1 timer that expires before the level 0 timer added later
+		std::vector<Job_base*> expired;
+		auto tick = [](uint64_t t) { return t << TimerWheel<Job_base>::c_timer_tick; };
+		wheel.add(nullptr, tick(10)); wheel.add(nullptr, tick(70)); wheel.harvest(tick(10), expired);
+		wheel.add(nullptr, tick(72)); wheel.add(nullptr, tick(12)); wheel.harvest(tick(12), expired);
+		TESTRESULT(++number, "Timer levels", , expired.size() == 2 && wheel.earliest() == tick(70), );
+
+		//cancellation
+		auto skipped = snapshot_metrics().m_total.m_cancelled;
+		auto cancel_handle = js.schedule([&]() { for (int i = 0; i < 10; ++i) schedule_after(5ms, [&]() { counter++; }); }, JobPriority::HIGH, thread_index_t{}, true);
+		TESTRESULT(++number, "Cancel job handle", cancel_handle.cancel(); cancel_handle.wait(), cancel_handle.is_cancelled() && counter.load() == 0 && snapshot_metrics().m_total.m_cancelled > skipped, counter = 0);
+		JobHandle loop_handle;
+		std::atomic<bool> loop_ready = false;
+		loop_handle = js.schedule([&]() { run_until([&]() { return loop_ready.load(); }); parallel_for(0, 100000, 1, [&](int i) { if (i == 0) loop_handle.cancel(); counter++; }).wait(); }, JobPriority::HIGH, thread_index_t{}, true);
+		TESTRESULT(++number, "Cancel blocking loop", loop_ready = true; loop_handle.wait(), loop_handle.is_cancelled() && counter.load() < 100000, counter = 0);
+		auto sleeper = coro_sleep(&counter);
+		auto cancel_start = high_resolution_clock::now();
+		TESTRESULT(++number, "Cancel coro", auto slept = co_await parallel(sleeper, [&]() { schedule_after(2ms, [&]() { sleeper.cancel(); }); }), slept == 0 && sleeper.cancelled() && counter.load() == 0 && high_resolution_clock::now() - cancel_start < 100ms, counter = 0);
+
+		//channels and pipelines
+		Channel<int, 4> channel;
+		int pushed = 0;
+		TESTRESULT(++number, "Channel", while (channel.try_push(pushed)) ++pushed, pushed == 4 && channel.try_pop() == 0 && co_await channel.pop() == 1, );
+		Channel<int, 8> numbers;
+		Channel<int, 2> doubled;
+		Pipeline pipeline;
+		pipeline.source(numbers, [&, i = 0]() mutable -> std::optional<int> { if (i < 1000) return i++; return std::nullopt; })
+			.stage(numbers, doubled, [](int&& i) { return 2 * i; }, 3)
+			.sink(doubled, [&](int&& i) { counter += i; }, 2);
+		TESTRESULT(++number, "Pipeline", co_await pipeline, counter.load() == 999000 && doubled.is_closed(), counter = 0);
+
+		//worker pools
+		TESTRESULT(++number, "Resume on pool", co_await resume_on(pool_t{ 1 }); counter = current_pool().value; co_await [&]() { if (current_pool() == pool_t{ 1 }) counter++; }; co_await resume_on(pool_t{ 0 }), counter.load() == 2 && current_pool() == pool_t{ 0 }, counter = 0);
+		TESTRESULT(++number, "Schedule on pool", co_await [&]() { schedule_on(pool_t{ 1 }, [&]() { if (current_pool() == pool_t{ 1 }) schedule([&]() { if (current_pool() == pool_t{ 1 }) counter++; }); }); }, counter.load() == 1 && snapshot_metrics(pool_t{ 1 }).m_workers.size() == 1, counter = 0);
+
+		//epochs
+		auto epoch = begin_epoch();
+		TESTRESULT(++number, "Epoch allocation", co_await [&]() { std::pmr::vector<int> ev(epoch_resource()); ev.resize(100, 1); if (EpochResource::find(ev.get_allocator().resource()) != nullptr && current_job()->m_epoch == epoch) counter = (int)ev.size(); }, counter.load() == 100, counter = 0);
+		TESTRESULT(++number, "Epoch reuse", for (int i = 0; i < 4; ++i) { begin_epoch(); co_await [&]() { func(&counter, 10); }; }, counter.load() == 40, counter = 0; end_epoch());
+		TESTRESULT(++number, "Epoch of the caller", begin_epoch(); co_await [&]() { begin_epoch(); try { begin_epoch(); } catch (RTE::JobException&) { counter++; } }, counter.load() == 1, counter = 0; end_epoch());
+		std::optional<std::pmr::vector<int>> kept;		//outlives its epoch
+		TESTRESULT(++number, "Epoch escape", begin_epoch(); kept.emplace(100, 1, epoch_resource()); begin_epoch(); try { begin_epoch(); } catch (RTE::JobException&) { counter++; }, counter.load() == 1, counter = 0; kept.reset(); end_epoch());
+
+		//task graphs
+		TaskGraph graph;
+		std::atomic<int> misses = 0;
+		auto ga = graph.node([&]() { counter++; });
+		auto gb = graph.node([&]() { if (counter.load() < 1) misses++; schedule([&]() { counter++; }); });
+		auto gc = graph.node([&]() { return coro_void(std::allocator_arg, &g_global_mem, &counter, 3); });
+		auto gd = graph.node([&]() { if (counter.load() < 5) misses++; counter++; });
+		graph.edge(ga, gb); graph.edge(ga, gc); graph.edge(gb, gd); graph.edge(gc, gd);
+		TESTRESULT(++number, "Task graph", co_await graph, counter.load() == 6 && misses.load() == 0, counter = 0);
+		TESTRESULT(++number, "Task graph replay", for (int i = 0; i < 10; ++i) co_await graph, counter.load() == 60 && misses.load() == 0, counter = 0);
+		graph.edge(gd, ga);
+		bool cycle = false;
+		try { graph.compile(); } catch (RTE::JobException&) { cycle = true; }
+		TESTRESULT(++number, "Task graph cycle", , cycle, );
+
+		//continuation chains
+		auto stages = chain([&]() { counter++; schedule([&]() { counter++; }); })
+			.then([&]() { if (counter.load() != 2) misses++; counter++; })
+			.then([&]() { if (counter.load() != 3) misses++; counter++; });
+		TESTRESULT(++number, "Continuation chain", co_await std::move(stages), counter.load() == 4 && misses.load() == 0, counter = 0);
+		TESTRESULT(++number, "Multiple continuations", co_await [&]() { continuation([&]() { counter++; }); continuation([&]() { if (counter.load() == 1) counter++; }); }, counter.load() == 2, counter = 0);
+
+		//move-only and large captures
+		auto move_only = [&, p = std::make_unique<int>(10)]() { func(&counter, *p); };
+		TESTRESULT(++number, "Move-only lambda", co_await std::move(move_only), counter.load() == 10, counter = 0);
+		std::array<int, 64> large{};
+		large.back() = 10;
+		auto big = [&, large]() { func(&counter, large.back()); };
+		TESTRESULT(++number, "Lambda larger than buffer", co_await std::move(big), counter.load() == 10, counter = 0);
+
+		bool caught = false;
+		try { co_await coro_throw(1); } catch (const std::runtime_error&) { caught = true; }
+		TESTRESULT(++number, "Coro exception", , caught, );
 		
 		vgjs::terminate();
 
@@ -310,7 +457,7 @@ using namespace vgjs;
 int main(int argc, char* argv[])
 {
 	int num = argc > 1 ? std::stoi(argv[1]) : 0;
-	JobSystem js(thread_count_t{ num });
+	JobSystem js(thread_count_t{ num }, thread_index_t{ 0 }, slab_resource(), placement_t::compact, { PoolConfig{ thread_count_t{ 1 } } });
 
 	schedule(test::start_test());
 
@@ -35,11 +35,22 @@
 #include <sstream>
 #include <compare>
 #include <unordered_map>
+#include <array>
+#include <bit>
+#include <utility>
+#include <tuple>
+#include <limits>
+#include <new>
+#include <cstddef>
+#include <cstring>
 #include <format>
-#include <Windows.h>
-#include <combaseapi.h>
+#if defined(_WIN32)
+    #include <Windows.h>
+    #include <combaseapi.h>
+#endif
 
 #include "IntType.h"
+#include "VGJSTopology.h"
 
 #include "RobinTheEngine/Exceptions/JobException.h"
 #include "RobinTheEngine/JobSystem/JobPriority.h"
@@ -70,6 +81,9 @@ namespace vgjs {
     class Job;
     class Job_base;
     class JobSystem;
+    class JobCompletion;
+    class TaskGraph;
+    template<typename I, typename D> class parallel_range_t;
 
     using thread_index_t = int_type<int, struct P0, -1>;
     using thread_id_t = int_type<int, struct P1, -1>;
@@ -77,14 +91,13 @@ namespace vgjs {
     using thread_count_t = int_type<int, struct P3, -1>;
     using tag_t = int_type<int, struct P4, -1>;
     using parent_t = int_type<int, struct P5, -1>;
+    using pool_t = int_type<int, struct P6, -1>;
     using RTE::JobPriority;
     using RTE::Log;
 
     bool is_logging();
-    void log_data(  std::chrono::high_resolution_clock::time_point& t1
-                    , std::chrono::high_resolution_clock::time_point& t2
-                    , thread_index_t exec_thread, bool finished, thread_type_t type, thread_id_t id);
     void save_log_file();
+    void graph_node_finished(Job* job) noexcept;
 
     //---------------------------------------------------------------------------------------------------
 
@@ -102,21 +115,22 @@ namespace vgjs {
     *
     * It can hold a function, and additionally a thread index where the function should
     * be executed, a type and an id for dumping a trace file to be shown by
-    * Google Chrome about::tracing.
+    * Google Chrome about::tracing, and a deadline.
     */
     struct Function {
         std::function<void(void)>   m_function = []() {};  //empty function
         thread_index_t              m_thread_index;        //thread that the f should run on
         thread_type_t               m_type;                //type of the call
         thread_id_t                 m_id;                  //unique identifier of the call
+        std::chrono::nanoseconds    m_deadline{ 0 };       //finish within this time after being scheduled, 0 for no deadline
 
         Function(std::function<void(void)>& f, thread_index_t index = thread_index_t{},
-            thread_type_t type = thread_type_t{}, thread_id_t id = thread_id_t{})
-            : m_function(f), m_thread_index(index), m_type(type), m_id(id) {};
+            thread_type_t type = thread_type_t{}, thread_id_t id = thread_id_t{}, std::chrono::nanoseconds deadline = std::chrono::nanoseconds{ 0 })
+            : m_function(f), m_thread_index(index), m_type(type), m_id(id), m_deadline(deadline) {};
 
         Function(std::function<void(void)>&& f, thread_index_t index = thread_index_t{},
-            thread_type_t type = thread_type_t{}, thread_id_t id = thread_id_t{})
-            : m_function(std::move(f)), m_thread_index(index), m_type(type), m_id(id) {};
+            thread_type_t type = thread_type_t{}, thread_id_t id = thread_id_t{}, std::chrono::nanoseconds deadline = std::chrono::nanoseconds{ 0 })
+            : m_function(std::move(f)), m_thread_index(index), m_type(type), m_id(id), m_deadline(deadline) {};
 
         Function(const Function& f) = default;
         Function(Function&& f) = default;
@@ -131,13 +145,167 @@ namespace vgjs {
     concept FUNCTION = std::is_same_v<std::decay_t<T>, Function >;
 
     template<typename T>
-    concept STDFUNCTION = std::is_convertible_v< std::decay_t<T>, std::function<void(void)> >;
+    concept VOIDCALLABLE = std::is_invocable_v<std::decay_t<T>&> && std::is_void_v<std::invoke_result_t<std::decay_t<T>&>>
+        && std::is_move_constructible_v<std::decay_t<T>>;
+
+    template<typename T>
+    concept STDFUNCTION = std::is_convertible_v< std::decay_t<T>, std::function<void(void)> > || VOIDCALLABLE<T>; //also move-only lambdas
 
     template<typename T>
     concept FUNCTOR = FUNCTION<T> || STDFUNCTION<T>;
 
     using pfvoid = void(*)();
 
+    /**
+    * \brief Functions that run one after the other in the same Job, create with chain() and then().
+    *
+    * Each call runs the next stage, after the last stage it starts again with the first.
+    * All stages are stored in this one object, which is moved into the Job. A stage finishes like
+    * any Job, when its function has returned and all its children have finished. Then the next stage
+    * runs on the same thread, right away if possible, else from the local queue of the thread.
+    */
+    template<typename... Fs>
+    class chain_t {
+        std::tuple<Fs...>   m_stages;
+        uint32_t            m_next = 0;     //stage to run next
+
+        template<size_t... Is>
+        void run(std::index_sequence<Is...>) {
+            uint32_t stage = m_next;
+            m_next = (m_next + 1) % sizeof...(Fs);
+            ((Is == stage ? (void)std::get<Is>(m_stages)() : (void)0), ...);
+        }
+
+    public:
+        static inline const uint32_t c_num_stages = sizeof...(Fs);
+
+        explicit chain_t(std::tuple<Fs...>&& stages) noexcept : m_stages(std::move(stages)) {}
+
+        /**
+        * \brief Append a stage.
+        * \param[in] f The function of the new stage.
+        * \returns the chain with the new stage.
+        */
+        template<typename F>
+        requires VOIDCALLABLE<F>
+        [[nodiscard]] chain_t<Fs..., std::decay_t<F>> then(F&& f) && {
+            return chain_t<Fs..., std::decay_t<F>>{ std::tuple_cat(std::move(m_stages), std::tuple<std::decay_t<F>>(std::forward<F>(f))) };
+        }
+
+        void operator()() { run(std::index_sequence_for<Fs...>{}); }   //run the next stage
+    };
+
+    /**
+    * \brief Start a chain of functions that run one after the other in one Job, e.g. chain(f).then(g).then(h).
+    * \param[in] f The function of the first stage.
+    * \returns the chain, it can be scheduled like any function.
+    */
+    template<typename F>
+    requires VOIDCALLABLE<F>
+    [[nodiscard]] chain_t<std::decay_t<F>> chain(F&& f) {
+        return chain_t<std::decay_t<F>>{ std::tuple<std::decay_t<F>>(std::forward<F>(f)) };
+    }
+
+    template<typename>
+    struct is_chain : std::false_type {};
+
+    template<typename... Fs>
+    struct is_chain<chain_t<Fs...>> : std::true_type {};
+
+    const size_t c_job_function_size = 64;  //bytes of inline storage for the callable of a Job
+
+    /**
+    * \brief Move-only, type-erased void() callable stored inside a Job.
+    *
+    * Callables up to c_job_function_size bytes are constructed in place, so scheduling them
+    * does not allocate. Larger callables are explicitly moved to the heap. Function pointers,
+    * lambdas, std::function and move-only callables like lambdas capturing a std::unique_ptr
+    * can all be stored.
+    */
+    class JobFunction {
+        struct Ops {
+            void (*m_invoke)(void* storage);
+            void (*m_move)(void* dst, void* src) noexcept;     //move construct dst from src, then destroy src
+            void (*m_destroy)(void* storage) noexcept;
+        };
+
+        template<typename F>
+        static constexpr bool c_is_inline = sizeof(F) <= c_job_function_size && alignof(F) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<F>;
+
+        template<typename F>
+        static inline const Ops c_inline_ops{
+            [](void* storage) { (*std::launder((F*)storage))(); },
+            [](void* dst, void* src) noexcept { new (dst) F(std::move(*std::launder((F*)src))); std::launder((F*)src)->~F(); },
+            [](void* storage) noexcept { std::launder((F*)storage)->~F(); }
+        };
+
+        template<typename F>
+        static inline const Ops c_heap_ops{
+            [](void* storage) { (**(F**)storage)(); },
+            [](void* dst, void* src) noexcept { *(F**)dst = *(F**)src; },
+            [](void* storage) noexcept { delete *(F**)storage; }
+        };
+
+        alignas(std::max_align_t) std::byte m_storage[c_job_function_size];
+        const Ops* m_ops = nullptr;     //nullptr if empty
+
+        void move_from(JobFunction& other) noexcept {
+            if (other.m_ops != nullptr) {
+                other.m_ops->m_move(m_storage, other.m_storage);
+                m_ops = std::exchange(other.m_ops, nullptr);
+            }
+        }
+
+    public:
+        JobFunction() noexcept {};
+        JobFunction(const JobFunction&) = delete;
+        JobFunction(JobFunction&& other) noexcept { move_from(other); };
+        JobFunction& operator= (const JobFunction&) = delete;
+        JobFunction& operator= (JobFunction&& other) noexcept {
+            if (this != &other) {
+                reset();
+                move_from(other);
+            }
+            return *this;
+        }
+        ~JobFunction() { reset(); };
+
+        /**
+        * \brief Store a callable, replacing the previous one.
+        * \param[in] f The callable, it is moved if it is an rvalue, else copied.
+        */
+        template<typename F>
+        void emplace(F&& f) {
+            using T = std::decay_t<F>;
+            reset();
+            if constexpr (std::is_pointer_v<T> || std::is_same_v<T, std::function<void(void)>>) {
+                if (!f) return;         //null function pointer or empty std::function
+            }
+            if constexpr (c_is_inline<T>) {
+                new (m_storage) T(std::forward<F>(f));
+                m_ops = &c_inline_ops<T>;
+            }
+            else {
+                *(T**)m_storage = new T(std::forward<F>(f));  //too large for the inline buffer
+                m_ops = &c_heap_ops<T>;
+            }
+        }
+
+        /**
+        * \brief Destroy the callable and its captures.
+        */
+        void reset() noexcept {
+            if (m_ops != nullptr) {
+                m_ops->m_destroy(m_storage);
+                m_ops = nullptr;
+            }
+        }
+
+        void operator() () { m_ops->m_invoke(m_storage); }     //call only if not empty
+        explicit operator bool() const noexcept { return m_ops != nullptr; }
+    };
+
     //-----------------------------------------------------------------------------------------
 
     /**
@@ -163,25 +331,33 @@ namespace vgjs {
         std::atomic<int>    m_children;         //number of children this job is waiting for
         Job_base*           m_parent;           //parent job that created this job
         thread_index_t      m_thread_index;     //thread that the job should run on and ran on
+        pool_t              m_pool;             //worker pool the job runs in, set when it is scheduled first
         thread_type_t       m_type;             //for logging performance
         thread_id_t         m_id;               //for logging performance
         bool                m_is_function;      //default - this is not a function
+        std::atomic<bool>   m_cancelled;        //the job was cancelled, it and all its descendants are skipped
         JobPriority         m_job_priority;     //defines the position of the job in the JobQueue
         uint64_t            m_unique_id;        // unique job id across all JobSystem (0 - not set)
-        std::mutex          m_mutex;            // mutex for `job finished` notification
-        std::condition_variable m_cv;           // cv for `job finished` notification
+        JobCompletion*      m_completion;       // signalled when the job finishes, only if someone waits for it
+        uint64_t            m_trace_time;       // when the job was scheduled while recording, for the queue wait time (0 - not set)
+        uint64_t            m_deadline;         // finish before this time, in ns since the job system was started (0 - no deadline)
+        uint64_t            m_epoch;            // epoch whose arena holds this job, its children go there too (0 - none)
 
         Job_base() :
             m_children{ 0 },
             m_parent{ nullptr },
             m_thread_index{},
+            m_pool{},
             m_type{},
             m_id{},
             m_is_function{ false },
+            m_cancelled{ false },
             m_job_priority{ JobPriority::HIGH },
             m_unique_id { 0 },
-            m_mutex{},
-            m_cv{} {}
+            m_completion{ nullptr },
+            m_trace_time{ 0 },
+            m_deadline{ 0 },
+            m_epoch{ 0 } {}
 
         virtual bool resume() = 0;                      //this is the actual work to be done
         void operator() () noexcept {           //wrapper as function operator
@@ -199,8 +375,11 @@ namespace vgjs {
     public:
         n_pmr::memory_resource*     m_mr = nullptr;  //memory resource that was used to allocate this Job
         Job_base*                   m_continuation = nullptr;   //continuation follows this job (a coro is its own continuation)
-        std::function<void(void)>   m_function;      //function to compute
-        pfvoid                      m_pfvoid=nullptr;
+        JobFunction                 m_function;      //function to compute
+        TaskGraph*                  m_graph = nullptr;  //if this Job is a node of a TaskGraph, it is reused and not recycled
+        uint32_t                    m_node = 0;      //index of the node in the TaskGraph
+        uint16_t                    m_stages = 1;    //number of stages if the function is a chain_t, the Job runs once per stage
+        uint16_t                    m_stage = 0;     //stage that is running
 
         Job( n_pmr::memory_resource* pmr) : Job_base(), m_mr(pmr), m_continuation(nullptr) {
             m_children = 1;
@@ -213,16 +392,41 @@ namespace vgjs {
             m_parent = nullptr;
             m_continuation = nullptr;
             m_thread_index = thread_index_t{};
+            m_pool = pool_t{};
             m_type = thread_type_t{};
             m_id = thread_id_t{};
             m_job_priority = JobPriority::HIGH;
             m_unique_id = 0;
+            m_completion = nullptr;
+            m_deadline = 0;
+            m_cancelled = false;
+            m_stages = 1;
+            m_stage = 0;
+        }
+
+        /**
+        * \brief Append a continuation, so that several continuations run one after the other.
+        * A Coro continuation stays last and runs after the functions. A Coro cannot be continued by
+        * anything, so there can be only one Coro continuation.
+        * \param[in] next The continuation.
+        * \returns false if next is a Coro and there is a Coro continuation already, then nothing is changed.
+        */
+        bool add_continuation(Job_base* next) noexcept {
+            Job* last = this;
+            while (last->m_continuation != nullptr && last->m_continuation->is_function()) {
+                last = (Job*)last->m_continuation;
+            }
+            if (last->m_continuation != nullptr) {
+                if (!next->is_function()) return false;                //would replace the Coro
+                ((Job*)next)->m_continuation = last->m_continuation;    //keep the Coro at the end
+            }
+            last->m_continuation = next;
+            return true;
         }
 
         bool resume() noexcept {    //work is to call the function
             m_children = 1;         //job is its own child, so set to 1
-            if (m_pfvoid!=nullptr) m_pfvoid();
-            else m_function();           //run the function, can schedule more children here
+            m_function();           //run the function, can schedule more children here
             return true;
         }
 
@@ -242,20 +446,215 @@ namespace vgjs {
 
 
     /**
-    * \brief Data structure storing times when jobs where called and ended.
-    * Can be saved to a log file and loaded into Google Chrom about:://tracing.
+    * \brief Completion state of a Job that somebody waits for.
+    *
+    * Only Jobs scheduled with a JobHandle get one, all other Jobs do not pay for it.
+    * The object is shared between the Job and the JobHandle, whoever releases it last
+    * puts it back into the pool of its thread. Waiting uses std::atomic::wait(), so
+    * there is no mutex and no condition variable.
     */
-    struct JobLog {
-        std::chrono::high_resolution_clock::time_point m_t1, m_t2;	///< execution start and end
-        thread_index_t  m_exec_thread;
-        bool			m_finished;
-        thread_type_t   m_type;
-        thread_id_t     m_id;
+    class JobCompletion : public Queuable {
+        friend JobSystem;
+        static inline const uint32_t c_done      = 1 << 0;  //the job has finished
+        static inline const uint32_t c_cancelled = 1 << 1;  //the job has been cancelled
 
-        JobLog(std::chrono::high_resolution_clock::time_point& t1, std::chrono::high_resolution_clock::time_point& t2,
-            thread_index_t exec_thread, bool finished, thread_type_t type, thread_id_t id)
-                : m_t1(t1), m_t2(t2), m_exec_thread(exec_thread), m_finished(finished), m_type(type), m_id(id) {
-        };
+        std::atomic<uint32_t> m_done = 0;       //c_done and c_cancelled
+        std::atomic<uint32_t> m_refs = 0;       //number of owners: the job and the handle
+
+    public:
+        /**
+        * \brief Test whether the job has finished.
+        * \returns true if the job has finished.
+        */
+        bool is_done() noexcept { return (m_done.load(std::memory_order_acquire) & c_done) != 0; }
+
+        /**
+        * \brief Test whether the job has been cancelled.
+        * \returns true if the job has been cancelled.
+        */
+        bool is_cancelled() noexcept { return (m_done.load(std::memory_order_relaxed) & c_cancelled) != 0; }
+
+        /**
+        * \brief Block the calling thread until the job has finished.
+        */
+        void wait() noexcept {
+            uint32_t state;
+            while (((state = m_done.load(std::memory_order_acquire)) & c_done) == 0) {
+                m_done.wait(state, std::memory_order_acquire);
+            }
+        }
+
+        /**
+        * \brief Mark the job as cancelled.
+        * \returns true if the job had neither finished nor been cancelled before.
+        */
+        bool cancel() noexcept { return (m_done.fetch_or(c_cancelled, std::memory_order_acq_rel) & (c_done | c_cancelled)) == 0; }
+
+        /**
+        * \brief Mark the job as finished and wake up all waiting threads.
+        * \returns true if the job had been cancelled.
+        */
+        bool signal() noexcept {
+            uint32_t state = m_done.fetch_or(c_done, std::memory_order_acq_rel);
+            m_done.notify_all();
+            return (state & c_cancelled) != 0;
+        }
+
+        /**
+        * \brief Drop one owner.
+        * \returns true if this was the last owner, so the object can be reused.
+        */
+        bool release() noexcept { return m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+    };
+
+
+    /**
+    * \brief Handle to a scheduled Job that can be used to wait for its completion.
+    *
+    * Returned by JobSystem::schedule(f, priority, thread_index, waitable). If the handle is not waitable,
+    * it holds only the unique id of the job.
+    */
+    class JobHandle {
+        JobCompletion*  m_completion = nullptr;   //shared with the job, or nullptr
+        uint64_t        m_unique_id = 0;          //unique id of the job
+
+        void release() noexcept;
+
+    public:
+        JobHandle() noexcept {};
+        JobHandle(JobCompletion* completion, uint64_t unique_id) noexcept : m_completion(completion), m_unique_id(unique_id) {};
+        JobHandle(const JobHandle&) = delete;
+        JobHandle& operator=(const JobHandle&) = delete;
+        JobHandle(JobHandle&& h) noexcept : m_completion(std::exchange(h.m_completion, nullptr)), m_unique_id(h.m_unique_id) {};
+        JobHandle& operator=(JobHandle&& h) noexcept {
+            release();
+            m_completion = std::exchange(h.m_completion, nullptr);
+            m_unique_id = h.m_unique_id;
+            return *this;
+        }
+        ~JobHandle() { release(); }
+
+        /**
+        * \returns the unique id of the job.
+        */
+        uint64_t id() const noexcept { return m_unique_id; }
+
+        /**
+        * \returns true if the handle can be used to wait for the job.
+        */
+        bool is_waitable() const noexcept { return m_completion != nullptr; }
+
+        /**
+        * \brief Test whether the job and all its children have finished.
+        * \returns true if the job has finished, false if it has not or the handle is not waitable.
+        */
+        bool is_done() const noexcept { return m_completion != nullptr && m_completion->is_done(); }
+
+        /**
+        * \brief Block until the job and all its children have finished. Returns immediately if the handle is not waitable.
+        * A worker thread does not block, but runs other jobs in the meantime.
+        */
+        void wait() const noexcept;
+
+        /**
+        * \brief Cancel the job and all its descendants. Jobs that have not started yet are skipped, but still
+        * finish as usual. Does nothing if the handle is not waitable or the job has finished.
+        */
+        void cancel() noexcept;
+
+        /**
+        * \returns true if the job has been cancelled.
+        */
+        bool is_cancelled() const noexcept { return m_completion != nullptr && m_completion->is_cancelled(); }
+    };
+
+
+    /**
+    * \brief Types of events recorded by the tracer.
+    */
+    enum class TraceEventType : uint8_t {
+        job_scheduled,      ///<a job was pushed into a worker queue, m_value is the target thread, m_data the unique id of the parent
+        job_started,        ///<a worker started running a job, m_value is the job type, m_data the ns it waited in a queue
+        job_finished,       ///<a job returned control to the worker
+        job_stolen,         ///<a worker stole a job, m_value is the victim thread, m_data the number of jobs taken
+        events_dropped,     ///<written by the log writer, m_value is the thread whose ring was full, m_data the number of lost events
+        job_continued       ///<a continuation was released by a finished job, m_data is the unique id of the finished job
+    };
+
+    /**
+    * \brief A compact binary trace event. Events are only formatted into text when they are flushed or exported.
+    */
+    struct TraceEvent {
+        uint64_t        m_time;     ///<nanoseconds since the job system was started
+        uint64_t        m_job_id;   ///<unique id of the job, or 0
+        uint64_t        m_data;     ///<event specific data
+        int32_t         m_thread;   ///<thread that recorded the event, or -1 if not a worker
+        uint32_t        m_value;    ///<event specific data
+        int32_t         m_id;       ///<id of the job, see thread_id_t
+        TraceEventType  m_type;     ///<what happened
+    };
+
+    /**
+    * \brief Header of a binary log file. It is followed by TraceEvents in the order they were drained.
+    */
+    struct TraceFileHeader {
+        char            m_magic[8] = { 'V', 'G', 'J', 'S', 'T', 'R', 'C', '\0' };
+        uint32_t        m_version = 1;                      ///<format version
+        uint32_t        m_event_size = sizeof(TraceEvent);  ///<size of one event in bytes
+    };
+
+    /**
+    * \brief Fixed size single producer single consumer ring buffer for trace events.
+    *
+    * Each thread records into its own ring, so recording does not need any locks or allocations.
+    * If the ring is full, new events are dropped and counted.
+    */
+    class TraceRing {
+        static inline const uint32_t c_capacity = 1 << 14;     ///<number of events per thread, power of 2
+
+        std::array<TraceEvent, c_capacity>  m_events;
+        alignas(64) std::atomic<uint64_t>   m_head = 0;         ///<next event to write, written by the producer
+        alignas(64) std::atomic<uint64_t>   m_tail = 0;         ///<next event to read, written by the consumer
+        std::atomic<uint64_t>               m_dropped = 0;      ///<number of events lost because the ring was full
+
+    public:
+        int32_t                             m_thread = -1;      ///<thread that records into this ring
+
+        /**
+        * \brief Record an event. Must only be called by the owning thread.
+        * \param[in] ev The event to record.
+        */
+        void push(const TraceEvent& ev) noexcept {
+            uint64_t head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) >= c_capacity) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            m_events[head & (c_capacity - 1)] = ev;
+            m_head.store(head + 1, std::memory_order_release);
+        }
+
+        /**
+        * \brief Remove all recorded events and hand them to a function. Must only be called by one consumer at a time.
+        * \param[in] f Function that is called for each event.
+        * \returns the number of events that were drained.
+        */
+        template<typename F>
+        uint64_t drain(F&& f) {
+            uint64_t tail = m_tail.load(std::memory_order_relaxed);
+            uint64_t head = m_head.load(std::memory_order_acquire);
+            for (uint64_t i = tail; i < head; ++i) {
+                f(m_events[i & (c_capacity - 1)]);
+            }
+            m_tail.store(head, std::memory_order_release);
+            return head - tail;
+        }
+
+        /**
+        * \brief Get the number of dropped events and reset the counter.
+        * \returns the number of events lost since the last call.
+        */
+        uint64_t take_dropped() noexcept { return m_dropped.exchange(0, std::memory_order_relaxed); }
     };
 
 
@@ -263,9 +662,10 @@ namespace vgjs {
     * \brief General FIFO queue class.
     *
     * The queue allows for multiple producers multiple consumers. It uses a lightweight
-    * atomic flag as lock.
+    * atomic flag as lock. It is used for tags and for recycling Jobs, the worker threads
+    * use the lock-free WorkerQueue below.
     */
-    template<typename JOB = Queuable, bool SYNC = true, bool WORKER_QUEUE = true>
+    template<typename JOB = Queuable, bool SYNC = true>
     requires std::is_base_of_v<Queuable, JOB >
     class JobQueue {
         friend JobSystem;
@@ -273,13 +673,11 @@ namespace vgjs {
         JOB*             m_head = nullptr;	        //points to first entry
         JOB*             m_tail = nullptr;	        //points to last entry
         int32_t          m_size = 0;                 //number of entries in the queue
-        int32_t          m_thread_number = -1;
-        Log::SPloggerT   logger = Log::GetLogger("JobSystem");
     public:
 
         JobQueue() noexcept : m_head(nullptr), m_tail(nullptr), m_size(0) {};	///<JobQueue class constructor
 
-        JobQueue(const JobQueue<JOB>& queue) noexcept : m_head(nullptr), m_tail(nullptr), m_size(0) {};
+        JobQueue(const JobQueue<JOB,SYNC>& queue) noexcept : m_head(nullptr), m_tail(nullptr), m_size(0) {};
 
         /**
         * \brief Deallocate all Jobs in the queue.
@@ -299,10 +697,6 @@ namespace vgjs {
 
         ~JobQueue() {}  //destructor
 
-        void setThreadNumber(size_t thread_number) {
-            m_thread_number = thread_number;
-        }
-
         /**
         * \brief Get the number of jobs currently in the queue.
         * \returns the number of jobs (Coros and Jobs) currently in the queue.
@@ -323,53 +717,26 @@ namespace vgjs {
         * \param[in] job The job to be pushed into the queue.
         */
         void push(JOB* job) {
-
             if constexpr (SYNC) {
                 while (m_lock.test_and_set(std::memory_order::acquire));  // acquire lock
             }
-            size_t queue_idx = 0;
             job->m_next = nullptr;      //clear pointer to successor
             if (m_head == nullptr) {    //if queue is empty
                 m_head = job;           //let m_head point to the job
                 m_tail = job;           //let m_tail point to the job
             }
             else {
-                // It is not guaranteed, that JOB will have m_job_priority member, but it is ok for our case
-                JOB *cur = m_head;
-                JOB *prev = nullptr;
-                for (; cur; prev = cur, cur = static_cast<JOB*>(cur->m_next), queue_idx++) {
-                    if (cur->m_job_priority < job->m_job_priority) { // found place to insert job
-                        break;
-                    }
-                }
-                if (cur && prev) { // somewhere in the middle of the queue
-                    job->m_next = cur;
-                    prev->m_next = job;
-                }
-                if (cur == nullptr) { // current job have lowest priority, add to the end of the queue
-                    m_tail->m_next = job;
-                    m_tail = job;
-                }
-                if (prev == nullptr) { // current job has highest priority, add to the head of the queue
-                    job->m_next = m_head;
-                    m_head = job;
-                }
+                m_tail->m_next = job;   //append to the tail
+                m_tail = job;
             }
-
             m_size++;                   //increase size
-            if constexpr (WORKER_QUEUE) {
-                logger->trace(std::format(
-                    "New job added to thread {}, number in the queue: {}, queue size: {}",
-                    m_thread_number, queue_idx, m_size
-                ));
-            }
             if constexpr (SYNC) {
                 m_lock.clear(std::memory_order::release); //release lock
             }
         };
 
         /**
-        * \brief Pops a job from the tail of the queue.
+        * \brief Pops a job from the head of the queue.
         * \returns a job or nullptr.
         */
         JOB* pop() {
@@ -397,192 +764,2274 @@ namespace vgjs {
 
 
     /**
-    * \brief The main JobSystem class manages the whole VGJS job system.
+    * \brief Lock-free intrusive stack that any thread can push to, and any thread can empty at once.
     *
-    * The JobSystem starts N threads and provides them with data structures.
-    * It can add new jobs, and wait until they are done.
+    * Since single entries are never popped, there is no ABA problem. take_all() returns the
+    * whole list, the newest entry first.
     */
-    class JobSystem {
-        static inline const uint32_t c_queue_capacity = 1<<10; ///<save at most N Jobs for recycling
-        static inline const bool c_enable_logging = false;
+    template<typename JOB = Queuable>
+    requires std::is_base_of_v<Queuable, JOB >
+    class JobStack {
+        std::atomic<JOB*> m_head = nullptr;     //newest entry
+
+    public:
+        JobStack() noexcept {};
+        JobStack(const JobStack<JOB>& stack) noexcept {};
 
-    private:
-        static inline std::atomic<uint64_t>             m_init_counter = 0;
-        static inline n_pmr::memory_resource*           m_mr;                   ///<use to allocate/deallocate Jobs
-        static inline std::vector<std::thread>	        m_threads;	            ///<array of thread structures
-        static inline std::atomic<uint32_t>   		    m_thread_count = 0;     ///<number of threads in the pool
-        static inline std::atomic<bool>                 m_terminated = false;   ///<flag set true when the last thread has exited
-        static inline thread_index_t				    m_start_idx;            ///<idx of first thread that is created
-        static inline thread_local thread_index_t	    m_thread_index = thread_index_t{};  ///<each thread has its own number
-        static inline std::atomic<bool>				    m_terminate = false;	///<Flag for terminating the pool
-        static inline thread_local Job_base*            m_current_job = nullptr;///<Pointer to the current job of this thread0
-        static inline std::vector<JobQueue<Job_base>>   m_global_queues;	    ///<each thread has its own Job queue, multiple produce, single consume
-        static inline std::vector<JobQueue<Job_base>>   m_local_queues;	        ///<each thread has its own Job queue, multiple produce, single consume
-        static inline std::vector<std::unique_ptr<std::condition_variable>>                     m_cv;
-        static inline std::vector<std::unique_ptr<std::mutex>>                                  m_mutex;
-        static inline std::unordered_map<tag_t,std::unique_ptr<JobQueue<Job_base>>,tag_t::hash> m_tag_queues;
-        static inline thread_local JobQueue<Job,false,false>      m_recycle;        ///<save old jobs for recycling
-        static inline thread_local JobQueue<Job,false,false>      m_delete;         ///<save old jobs for deleting
-        static inline n_pmr::vector<n_pmr::vector<JobLog>>	m_logs;				    ///< log the start and stop times of jobs
-        static inline bool                                  m_logging = false;      ///< if true then jobs will be logged
-        static inline std::map<int32_t, std::string>        m_types;                ///<map types to a string for logging
-        static inline std::chrono::time_point<std::chrono::high_resolution_clock> m_start_time = std::chrono::high_resolution_clock::now();	//time when program started
-        static inline std::atomic<uint64_t>             m_unique_job_id = 1; //global unique job id (hope it will not overflow)
-        Log::SPloggerT logger = Log::GetLogger("JobSystem");
         /**
-        * \brief Allocate a job so that it can be scheduled.
-        *
-        * If there is a job in the recycle queue we use this. Else a new
-        * new Job struct is allocated from the memory resource m_mr.
-        *
-        * \returns a pointer to the job.
+        * \brief Test whether there is anything in the stack.
+        * \returns true if the stack is empty.
         */
-        Job* allocate_job() {
-            Job* job = m_recycle.pop();                                 //try recycle queue
-            if (job == nullptr ) {                                      //none found
-                n_pmr::polymorphic_allocator<Job> allocator(m_mr);      //use this allocator
-                job = allocator.allocate(1);                            //allocate the object
-                if (job == nullptr) {
-                    logger->trace("No job available");
-                    throw RTE::JobException("Job system can't allocate new job");
-                }
-                new (job) Job(m_mr);                 //call constructor
-            }
-            else {                                  //job found
-                job->reset();                       //reset it
-            }
-            return job;
+        bool empty() noexcept { return m_head.load(std::memory_order_relaxed) == nullptr; }
+
+        /**
+        * \brief Push a job on the stack. Can be called by any thread.
+        * \param[in] job The job to push.
+        */
+        void push(JOB* job) noexcept {
+            JOB* head = m_head.load(std::memory_order_relaxed);
+            do {
+                job->m_next = head;
+            } while (!m_head.compare_exchange_weak(head, job, std::memory_order_release, std::memory_order_relaxed));
         }
 
         /**
-        * \brief Allocate a job so that it can be scheduled.
-        * \param[in] f Function that should be executed by the job.
-        * \returns a pointer to the Job.
+        * \brief Push a whole linked list of jobs on the stack with one atomic operation. Can be called by any thread.
+        * \param[in] first The newest job of the list, it will be on top of the stack.
+        * \param[in] last The oldest job of the list, its m_next pointer is overwritten.
         */
-        template <typename F>
-        requires FUNCTOR<F>
-        Job* allocate_job(F&& f) {
-            Job* job = allocate_job();
-            if constexpr (std::is_same_v<std::decay_t<F>, Function>) {
-                job->m_function     = f.get_function();
-                job->m_pfvoid       = nullptr;
-                job->m_thread_index = f.m_thread_index;
-                job->m_type         = f.m_type;
-                job->m_id           = f.m_id;
-            }
-            else {
-                if constexpr (std::is_pointer_v<std::remove_reference_t<decltype(f)>>) {
-                    job->m_pfvoid = f;
-                }
-                else {
-                    job->m_function = f; //std::function<void(void)> or a lambda
-                    job->m_pfvoid = nullptr;
-                }
-            }
+        void push_list(JOB* first, JOB* last) noexcept {
+            JOB* head = m_head.load(std::memory_order_relaxed);
+            do {
+                last->m_next = head;
+            } while (!m_head.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+        }
 
-            if (!job->m_function && !job->m_pfvoid) {
-                logger->trace("Empty function");
-                throw RTE::JobException("Job do not have function to execute");
-            }
-            return job;
+        /**
+        * \brief Remove all jobs from the stack. Can be called by any thread.
+        * \returns the list of jobs linked through m_next, newest first, or nullptr.
+        */
+        JOB* take_all() noexcept {
+            if (empty()) return nullptr;
+            return m_head.exchange(nullptr, std::memory_order_acquire);
         }
+    };
+
+
+    /**
+    * \brief Statistics of the slab memory resource.
+    */
+    struct SlabStats {
+        uint64_t m_allocations = 0;     //number of allocations
+        uint64_t m_local_hits = 0;      //served from the thread's own free list
+        uint64_t m_remote_hits = 0;     //served from blocks that other threads gave back
+        uint64_t m_remote_frees = 0;    //blocks freed by a thread that does not own them
+        uint64_t m_slabs = 0;           //slabs taken from the upstream resource
+        uint64_t m_large = 0;           //allocations too large for a size class, passed to upstream
+
+        double hit_rate() const noexcept { return m_allocations > 0 ? (double)(m_local_hits + m_remote_hits) / m_allocations : 0.0; }
+    };
 
 
+    /**
+    * \brief Thread aware slab memory resource for Jobs and Coro frames.
+    *
+    * Blocks of up to c_max_block bytes are served from size classes (powers of 2). Every thread
+    * owns a cache with one free list per size class, and carves new blocks from its own slabs, so memory
+    * is first touched and thus placed by the thread using it. A block freed by another thread is
+    * pushed onto a lock-free remote list of its owner, which takes the whole list when its own list
+    * runs empty. Slabs are aligned to their size, so the owner is found from the block address.
+    * Larger blocks are passed to the upstream resource. There is only one instance, see slab_resource().
+    */
+    class SlabResource : public n_pmr::memory_resource {
     public:
+        static inline const size_t c_slab_size = 1 << 16;      //bytes per slab, also its alignment
+        static inline const size_t c_min_block = 64;           //smallest size class
+        static inline const size_t c_max_block = 4096;         //largest size class
+        static inline const uint32_t c_num_classes = 7;        //64, 128, ..., 4096
 
-        /**
-        * \brief JobSystem class constructor.
-        * \param[in] threadCount Number of threads in the system.
-        * \param[in] start_idx Number of first thread, if 1 then the main thread should enter as thread 0.
-        * \param[in] mr The memory resource to use for allocating Jobs.
-        */
-        JobSystem(thread_count_t threadCount = thread_count_t(0), thread_index_t start_idx = thread_index_t(0)
-            , n_pmr::memory_resource* mr = n_pmr::new_delete_resource()) noexcept {
+    private:
+        struct ThreadCache;
 
-            if (m_init_counter > 0) [[likely]] return;
-            auto cnt = m_init_counter.fetch_add(1);
-            if (cnt > 0) return;
+        struct SlabHeader {
+            ThreadCache*    m_owner;        //thread cache that carved this slab
+            SlabHeader*     m_next;         //all slabs of the resource
+        };
 
-            m_mr = mr;
-            m_start_idx = start_idx;
-            m_terminate = false;
-            m_terminated = false;
+        struct ThreadCache {
+            std::array<Queuable*, c_num_classes>          m_free{};       //owner only
+            std::array<JobStack<Queuable>, c_num_classes> m_remote;       //blocks freed by other threads
+            std::array<char*, c_num_classes>              m_bump{};       //next uncarved block of the current slab
+            std::array<char*, c_num_classes>              m_bump_end{};
+            std::atomic<uint64_t>   m_allocations = 0;      //written only by the owner, read by stats()
+            std::atomic<uint64_t>   m_local_hits = 0;
+            std::atomic<uint64_t>   m_remote_hits = 0;
+            std::atomic<uint64_t>   m_remote_frees = 0;
+            std::atomic<uint64_t>   m_slabs = 0;
+            std::atomic<uint64_t>   m_large = 0;
+            ThreadCache*            m_next = nullptr;       //all caches of the resource
+        };
 
-            m_thread_count = threadCount.value;
-            // we want at least 2 threads
-            int hardware_threads = std::max(std::thread::hardware_concurrency(), 2u);
-            if (m_thread_count <= 0) {
-                m_thread_count = hardware_threads;		///< main thread is also running
-            }
-            if (m_start_idx + 2 > hardware_threads) {
+        n_pmr::memory_resource*         m_upstream;
+        std::atomic<ThreadCache*>       m_caches = nullptr;     //all thread caches, never removed
+        std::atomic<SlabHeader*>        m_slabs = nullptr;      //all slabs, released in the destructor
+        static inline thread_local ThreadCache* t_cache = nullptr;
+
+        SlabResource(n_pmr::memory_resource* upstream = n_pmr::new_delete_resource()) noexcept : m_upstream(upstream) {};
+
+        static void inc(std::atomic<uint64_t>& counter) noexcept {     //single writer, so no atomic RMW
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        static uint32_t size_class(size_t bytes) noexcept {
+            return bytes <= c_min_block ? 0 : (uint32_t)std::bit_width(bytes - 1) - 6;   //64 = 2^6 is class 0
+        }
+
+        ThreadCache* cache() {
+            if (t_cache == nullptr) [[unlikely]] {
+                t_cache = new ThreadCache();
+                ThreadCache* head = m_caches.load(std::memory_order_relaxed);
+                do {
+                    t_cache->m_next = head;
+                } while (!m_caches.compare_exchange_weak(head, t_cache, std::memory_order_release, std::memory_order_relaxed));
+            }
+            return t_cache;
+        }
+
+        /**
+        * \brief Get a new slab from upstream and make it the current slab of a size class.
+        */
+        void new_slab(ThreadCache* tc, uint32_t cls) {
+            char* mem = (char*)m_upstream->allocate(c_slab_size, c_slab_size);
+            SlabHeader* slab = new (mem) SlabHeader{ tc, m_slabs.load(std::memory_order_relaxed) };
+            while (!m_slabs.compare_exchange_weak(slab->m_next, slab, std::memory_order_release, std::memory_order_relaxed)) {};
+            size_t block = c_min_block << cls;
+            tc->m_bump[cls] = mem + std::max(block, c_min_block);     //first block after the header
+            tc->m_bump_end[cls] = mem + c_slab_size;
+            inc(tc->m_slabs);
+        }
+
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            ThreadCache* tc = cache();
+            if (bytes > c_max_block || alignment > c_min_block) [[unlikely]] {
+                inc(tc->m_large);
+                return m_upstream->allocate(bytes, alignment);
+            }
+            uint32_t cls = size_class(bytes);
+            inc(tc->m_allocations);
+            if (tc->m_free[cls] == nullptr) {
+                tc->m_free[cls] = tc->m_remote[cls].take_all();     //take back what other threads have freed
+                if (tc->m_free[cls] != nullptr) inc(tc->m_remote_hits);
+            }
+            else {
+                inc(tc->m_local_hits);
+            }
+            if (Queuable* block = tc->m_free[cls]; block != nullptr) {
+                tc->m_free[cls] = block->m_next;
+                return block;
+            }
+            size_t size = c_min_block << cls;
+            if (tc->m_bump[cls] + size > tc->m_bump_end[cls]) {
+                new_slab(tc, cls);
+            }
+            void* block = tc->m_bump[cls];
+            tc->m_bump[cls] += size;
+            return block;
+        }
+
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+            if (bytes > c_max_block || alignment > c_min_block) [[unlikely]] {
+                m_upstream->deallocate(p, bytes, alignment);
+                return;
+            }
+            uint32_t cls = size_class(bytes);
+            SlabHeader* slab = (SlabHeader*)((uintptr_t)p & ~(uintptr_t)(c_slab_size - 1));
+            Queuable* block = new (p) Queuable();
+            ThreadCache* tc = cache();
+            if (slab->m_owner == tc) {
+                block->m_next = tc->m_free[cls];
+                tc->m_free[cls] = block;
+                return;
+            }
+            inc(tc->m_remote_frees);
+            slab->m_owner->m_remote[cls].push(block);   //return it to its owner
+        }
+
+        bool do_is_equal(const n_pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    public:
+        SlabResource(const SlabResource&) = delete;
+
+        ~SlabResource() {
+            SlabHeader* slab = m_slabs.load();
+            while (slab != nullptr) {
+                SlabHeader* next = slab->m_next;
+                m_upstream->deallocate(slab, c_slab_size, c_slab_size);
+                slab = next;
+            }
+            ThreadCache* tc = m_caches.load();
+            while (tc != nullptr) {
+                ThreadCache* next = tc->m_next;
+                delete tc;
+                tc = next;
+            }
+        }
+
+        /**
+        * \brief Get the one instance of the slab resource.
+        * \returns a reference to the resource.
+        */
+        static SlabResource& instance() noexcept {
+            static SlabResource resource;
+            return resource;
+        }
+
+        /**
+        * \brief Sum up the statistics of all threads. The numbers can be slightly off while threads are running.
+        * \returns the statistics.
+        */
+        SlabStats stats() noexcept {
+            SlabStats st;
+            for (ThreadCache* tc = m_caches.load(std::memory_order_acquire); tc != nullptr; tc = tc->m_next) {
+                st.m_allocations  += tc->m_allocations.load(std::memory_order_relaxed);
+                st.m_local_hits   += tc->m_local_hits.load(std::memory_order_relaxed);
+                st.m_remote_hits  += tc->m_remote_hits.load(std::memory_order_relaxed);
+                st.m_remote_frees += tc->m_remote_frees.load(std::memory_order_relaxed);
+                st.m_slabs        += tc->m_slabs.load(std::memory_order_relaxed);
+                st.m_large        += tc->m_large.load(std::memory_order_relaxed);
+            }
+            return st;
+        }
+    };
+
+    /**
+    * \brief Get the slab memory resource, the default resource for Jobs and Coros.
+    * \returns a pointer to the resource.
+    */
+    inline SlabResource* slab_resource() noexcept {
+        return &SlabResource::instance();
+    }
+
+    /**
+    * \brief Get the statistics of the slab memory resource.
+    * \returns the statistics summed up over all threads.
+    */
+    inline SlabStats slab_stats() noexcept {
+        return SlabResource::instance().stats();
+    }
+
+
+    const uint32_t c_num_epochs = 2;    //epochs that can be alive at the same time, e.g. the last frame and this frame
+
+    /**
+    * \brief Memory resource of an epoch, e.g. a frame, with one bump arena per thread.
+    *
+    * Allocating moves a pointer, deallocating only counts. There is one instance per epoch slot, see instance().
+    * When a slot is opened for a new epoch, each thread rewinds its arena the next time it allocates, so all
+    * memory of the old epoch is released at once. Before that, every allocation of the old epoch must have
+    * been freed. Each thread counts its allocations and frees, so the fast path needs no atomic RMW operation.
+    * Large blocks are passed to the upstream resource.
+    */
+    class EpochResource : public n_pmr::memory_resource {
+    public:
+        static inline const size_t c_chunk_size = 1 << 16;     //bytes per chunk of an arena
+        static inline const size_t c_max_block = c_chunk_size / 4;     //larger blocks come from upstream
+
+    private:
+        struct Chunk {
+            Chunk* m_next = nullptr;        //next chunk of the arena
+        };
+        static inline const size_t c_chunk_header = 64;        //the first bytes of a chunk hold the Chunk struct
+
+        struct ThreadArena {
+            Chunk*                  m_chunks = nullptr;     //all chunks of this thread, in the order they are used
+            Chunk*                  m_current = nullptr;    //chunk that is bumped
+            char*                   m_bump = nullptr;       //next free byte
+            char*                   m_end = nullptr;
+            uint64_t                m_epoch = 0;            //epoch the chunks are used for
+            std::atomic<uint64_t>   m_allocations = 0;      //written only by the owner
+            std::atomic<uint64_t>   m_frees = 0;            //frees done by the owner, of blocks from any thread
+            ThreadArena*            m_next = nullptr;       //all arenas of the resource
+        };
+
+        n_pmr::memory_resource*     m_upstream;
+        uint32_t                    m_slot;                 //index of this resource
+        std::atomic<uint64_t>       m_epoch = 0;            //the epoch that currently uses this slot
+        std::atomic<ThreadArena*>   m_arenas = nullptr;     //all thread arenas, never removed
+        std::atomic<int64_t>        m_jobs = 0;             //Jobs and Coros in the arenas
+        static inline thread_local std::array<ThreadArena*, c_num_epochs> t_arenas{};
+
+        static void inc(std::atomic<uint64_t>& counter) noexcept {     //single writer, so no atomic RMW
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        ThreadArena* arena() {
+            ThreadArena*& arena = t_arenas[m_slot];
+            if (arena == nullptr) [[unlikely]] {
+                arena = new ThreadArena();
+                ThreadArena* head = m_arenas.load(std::memory_order_relaxed);
+                do {
+                    arena->m_next = head;
+                } while (!m_arenas.compare_exchange_weak(head, arena, std::memory_order_release, std::memory_order_relaxed));
+            }
+            return arena;
+        }
+
+        /**
+        * \brief Start using the arena for a new epoch. All blocks of the old epoch have been freed.
+        */
+        void rewind(ThreadArena* arena, uint64_t epoch) noexcept {
+            if constexpr (c_check) {        //make dangling pointers into the old epoch visible
+                for (Chunk* chunk = arena->m_chunks; chunk != nullptr; chunk = chunk->m_next) {
+                    std::memset((char*)chunk + c_chunk_header, 0xDD, c_chunk_size - c_chunk_header);
+                }
+            }
+            arena->m_current = nullptr;
+            arena->m_bump = arena->m_end = nullptr;
+            arena->m_epoch = epoch;
+        }
+
+        /**
+        * \brief Continue with the next chunk of the arena, get a new one from upstream if there is none.
+        */
+        void next_chunk(ThreadArena* arena) {
+            Chunk* chunk = arena->m_current != nullptr ? arena->m_current->m_next : arena->m_chunks;
+            if (chunk == nullptr) {
+                chunk = new (m_upstream->allocate(c_chunk_size, c_chunk_header)) Chunk{};
+                if (arena->m_current != nullptr) arena->m_current->m_next = chunk;
+                else arena->m_chunks = chunk;
+            }
+            arena->m_current = chunk;
+            arena->m_bump = (char*)chunk + c_chunk_header;
+            arena->m_end = (char*)chunk + c_chunk_size;
+        }
+
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            ThreadArena* arena = this->arena();
+            inc(arena->m_allocations);          //count first, see live()
+            if (bytes > c_max_block || alignment > c_chunk_header) [[unlikely]] {
+                return m_upstream->allocate(bytes, alignment);
+            }
+            uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+            if (arena->m_epoch != epoch) [[unlikely]] rewind(arena, epoch);
+            char* p = (char*)(((uintptr_t)arena->m_bump + alignment - 1) & ~(uintptr_t)(alignment - 1));
+            if (arena->m_bump == nullptr || p + bytes > arena->m_end) {
+                next_chunk(arena);
+                p = (char*)(((uintptr_t)arena->m_bump + alignment - 1) & ~(uintptr_t)(alignment - 1));
+            }
+            arena->m_bump = p + bytes;
+            return p;
+        }
+
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+            if (bytes > c_max_block || alignment > c_chunk_header) [[unlikely]] {
+                m_upstream->deallocate(p, bytes, alignment);
+            }
+            inc(arena()->m_frees);
+        }
+
+        bool do_is_equal(const n_pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    public:
+#if defined(NDEBUG)
+        static inline const bool c_check = false;       ///<if true, the memory of an old epoch is overwritten, so dangling pointers into it show up
+#else
+        static inline const bool c_check = true;
+#endif
+
+        EpochResource(uint32_t slot, n_pmr::memory_resource* upstream = n_pmr::new_delete_resource()) noexcept : m_upstream(upstream), m_slot(slot) {};
+        EpochResource(const EpochResource&) = delete;
+
+        ~EpochResource() {
+            ThreadArena* arena = m_arenas.load();
+            while (arena != nullptr) {
+                for (Chunk* chunk = arena->m_chunks; chunk != nullptr; ) {
+                    Chunk* next = chunk->m_next;
+                    m_upstream->deallocate(chunk, c_chunk_size, c_chunk_header);
+                    chunk = next;
+                }
+                ThreadArena* next = arena->m_next;
+                delete arena;
+                arena = next;
+            }
+        }
+
+        /**
+        * \brief Get the instance for an epoch slot.
+        * \param[in] slot The slot, the epoch number modulo c_num_epochs.
+        * \returns a reference to the resource.
+        */
+        static EpochResource& instance(uint32_t slot) noexcept {
+            static auto resources = []<size_t... Is>(std::index_sequence<Is...>) {
+                return std::array<EpochResource, c_num_epochs>{ EpochResource(Is)... };
+            }(std::make_index_sequence<c_num_epochs>{});
+            return resources[slot];
+        }
+
+        /**
+        * \brief Find out whether a memory resource belongs to an epoch.
+        * \param[in] mr The memory resource.
+        * \returns the epoch resource, or nullptr.
+        */
+        static EpochResource* find(n_pmr::memory_resource* mr) noexcept {
+            for (uint32_t slot = 0; slot < c_num_epochs; ++slot) {
+                if (mr == &instance(slot)) return &instance(slot);
+            }
+            return nullptr;
+        }
+
+        /**
+        * \returns the epoch that currently uses this slot, 0 if none.
+        */
+        uint64_t epoch() const noexcept { return m_epoch.load(std::memory_order_acquire); }
+
+        /**
+        * \brief Hand the arenas to a new epoch. All memory of the old epoch must have been freed, see live().
+        * \param[in] epoch The new epoch.
+        */
+        void open(uint64_t epoch) noexcept { m_epoch.store(epoch, std::memory_order_release); }
+
+        /**
+        * \brief Count the blocks that have not been freed yet.
+        *
+        * The frees are summed up before the allocations, so a block that is freed meanwhile is never missed.
+        * New blocks are only allocated by Jobs of the epoch, which count as live themselves.
+        *
+        * \returns the number of live blocks.
+        */
+        uint64_t live() noexcept {
+            uint64_t frees = 0, allocations = 0;
+            for (ThreadArena* arena = m_arenas.load(std::memory_order_acquire); arena != nullptr; arena = arena->m_next) {
+                frees += arena->m_frees.load(std::memory_order_acquire);
+            }
+            for (ThreadArena* arena = m_arenas.load(std::memory_order_acquire); arena != nullptr; arena = arena->m_next) {
+                allocations += arena->m_allocations.load(std::memory_order_acquire);
+            }
+            return allocations - frees;
+        }
+
+        /**
+        * \brief Count a Job or Coro allocated from this resource.
+        */
+        void job_allocated() noexcept { m_jobs.fetch_add(1, std::memory_order_relaxed); }
+
+        /**
+        * \brief Count a Job or Coro that has been freed. Call after deallocating its memory.
+        */
+        void job_freed() noexcept { m_jobs.fetch_sub(1, std::memory_order_release); }
+
+        /**
+        * \returns the number of Jobs and Coros that have not been freed yet.
+        */
+        int64_t jobs() noexcept { return m_jobs.load(std::memory_order_acquire); }
+    };
+
+
+    /**
+    * \brief Chase-Lev work stealing deque.
+    *
+    * The owner thread pushes and pops at the bottom end (LIFO), all other threads steal
+    * from the top end (FIFO). Push and pop are O(1), and the owner only synchronizes with
+    * thieves when the deque holds a single job. If the ring buffer is full, it is doubled.
+    * Old buffers are kept until the deque is destroyed, since thieves might still read from them.
+    * See Le et al., Correct and Efficient Work-Stealing for Weak Memory Models, PPoPP 2013.
+    */
+    template<typename JOB = Job_base>
+    class WorkStealingDeque {
+        static inline const int64_t c_initial_capacity = 1 << 8;
+
+        struct Buffer {
+            int64_t             m_mask;             //capacity - 1, capacity is a power of 2
+            std::atomic<JOB*>*  m_entries;          //ring buffer
+            Buffer*             m_previous;         //smaller buffer this one has replaced
+
+            Buffer(int64_t capacity, Buffer* previous) noexcept
+                : m_mask(capacity - 1), m_entries(new std::atomic<JOB*>[capacity]), m_previous(previous) {};
+            ~Buffer() { delete[] m_entries; }
+
+            int64_t capacity() noexcept { return m_mask + 1; }
+            JOB* get(int64_t i) noexcept { return m_entries[i & m_mask].load(std::memory_order_relaxed); }
+            void put(int64_t i, JOB* job) noexcept { m_entries[i & m_mask].store(job, std::memory_order_relaxed); }
+        };
+
+        alignas(64) std::atomic<int64_t> m_top = 0;      //thieves steal here
+        alignas(64) std::atomic<int64_t> m_bottom = 0;   //the owner pushes and pops here
+        std::atomic<Buffer*>             m_buffer;
+
+        /**
+        * \brief Replace the current buffer by one of twice the size. Called by the owner only.
+        */
+        Buffer* grow(Buffer* buffer, int64_t bottom, int64_t top) {
+            Buffer* bigger = new Buffer(buffer->capacity() * 2, buffer);
+            for (int64_t i = top; i < bottom; ++i) {
+                bigger->put(i, buffer->get(i));
+            }
+            m_buffer.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+    public:
+        WorkStealingDeque() noexcept : m_buffer(new Buffer(c_initial_capacity, nullptr)) {};
+        WorkStealingDeque(const WorkStealingDeque<JOB>& deque) noexcept : WorkStealingDeque() {};
+
+        ~WorkStealingDeque() {
+            Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+            while (buffer != nullptr) {
+                Buffer* previous = buffer->m_previous;
+                delete buffer;
+                buffer = previous;
+            }
+        }
+
+        /**
+        * \brief Get the number of jobs in the deque. Can be off if other threads are working on the deque.
+        * \returns the number of jobs in the deque.
+        */
+        uint32_t size() noexcept {
+            int64_t diff = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+            return diff > 0 ? (uint32_t)diff : 0;
+        }
+
+        /**
+        * \brief Push a job to the bottom. Must only be called by the owner.
+        * \param[in] job The job to push.
+        */
+        void push(JOB* job) {
+            int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+            int64_t top = m_top.load(std::memory_order_acquire);
+            Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+            if (bottom - top > buffer->m_mask) {
+                buffer = grow(buffer, bottom, top);
+            }
+            buffer->put(bottom, job);
+            m_bottom.store(bottom + 1, std::memory_order_release);  //publish the job to thieves
+        }
+
+        /**
+        * \brief Pop a job from the bottom. Must only be called by the owner.
+        * \returns the job that was pushed last, or nullptr.
+        */
+        JOB* pop() noexcept {
+            if (m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed)) return nullptr; //cheap test whether empty
+
+            int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+            Buffer* buffer = m_buffer.load(std::memory_order_relaxed);
+            m_bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t top = m_top.load(std::memory_order_relaxed);
+
+            JOB* job = nullptr;
+            if (top <= bottom) {                        //deque was not empty
+                job = buffer->get(bottom);
+                if (top == bottom) {                    //last job - race against thieves
+                    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                        job = nullptr;                  //a thief was faster
+                    }
+                    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                }
+            }
+            else {                                      //deque was empty
+                m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        /**
+        * \brief Steal a job from the top. Can be called by any thread.
+        * \returns the oldest job in the deque, or nullptr if the deque was empty or another thief was faster.
+        */
+        JOB* steal() noexcept {
+            int64_t top = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = m_bottom.load(std::memory_order_acquire);
+            if (top >= bottom) return nullptr;
+
+            Buffer* buffer = m_buffer.load(std::memory_order_acquire);
+            JOB* job = buffer->get(top);
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;                         //lost the race
+            }
+            return job;
+        }
+    };
+
+
+    /**
+    * \brief Number of JobPriority levels that get their own deque in a WorkerQueue.
+    */
+    const uint32_t c_num_priorities = 3;
+
+    /**
+    * \brief Map a job priority to a deque index. Higher priorities have larger indices and are run first.
+    * \param[in] priority The job priority.
+    * \returns the index of the deque for this priority.
+    */
+    inline uint32_t priority_index(JobPriority priority) noexcept {
+        auto idx = static_cast<int64_t>(priority);
+        return (uint32_t)std::clamp<int64_t>(idx, 0, c_num_priorities - 1);
+    }
+
+    /**
+    * \brief Every c_aging_period-th pop of a worker starts with a lower priority, so a stream of high priority jobs cannot starve the others.
+    */
+    const uint32_t c_aging_period = 16;
+
+
+    /**
+    * \brief The queue of a worker thread.
+    *
+    * Each priority level has its own WorkStealingDeque, so push and pop are O(1).
+    * Jobs that are pushed by the owner thread go directly into the deques. Jobs pushed by other
+    * threads go into a lock-free inbox for this priority, which is moved into the deque when the owner
+    * pops, or taken as a whole by a thief. Jobs with higher priority are always taken first.
+    */
+    template<typename JOB = Job_base>
+    class WorkerQueue {
+        friend JobSystem;
+        std::array<WorkStealingDeque<JOB>, c_num_priorities> m_deques;  //owner side, one per priority
+        alignas(64) std::array<JobStack<JOB>, c_num_priorities> m_inbox; //jobs pushed by other threads
+        std::atomic<int32_t>                                  m_inbox_size = 0;
+        alignas(64) int32_t                                   m_thread_number = -1;     //owner only, not on the line of the inbox
+        uint32_t                                              m_pops = 0;   //number of pops, for aging
+
+        /**
+        * \brief Reverse a list taken from an inbox so that the oldest job comes first.
+        * \param[in] list List taken from an inbox, newest first.
+        * \returns the list, oldest first.
+        */
+        JOB* reverse(JOB* list) noexcept {
+            JOB* reversed = nullptr;
+            while (list != nullptr) {
+                JOB* next = (JOB*)list->m_next;
+                list->m_next = reversed;
+                reversed = list;
+                list = next;
+            }
+            return reversed;
+        }
+
+    public:
+        WorkerQueue() noexcept {};
+        WorkerQueue(const WorkerQueue<JOB>& queue) noexcept {};
+
+        void setThreadNumber(size_t thread_number) {
+            m_thread_number = (int32_t)thread_number;
+        }
+
+        /**
+        * \brief Get the number of jobs currently in the queue. Can be off if other threads are working on the queue.
+        * \returns the number of jobs (Coros and Jobs) currently in the queue.
+        */
+        uint32_t size() noexcept {
+            uint32_t s = std::max(m_inbox_size.load(std::memory_order_relaxed), 0);
+            for (auto& deque : m_deques) s += deque.size();
+            return s;
+        }
+
+        /**
+        * \brief Push a job into the inbox. Can be called by any thread.
+        * \param[in] job The job to be pushed into the queue.
+        */
+        void push(JOB* job) noexcept {
+            m_inbox_size.fetch_add(1, std::memory_order_relaxed);
+            m_inbox[priority_index(job->m_job_priority)].push(job);
+        }
+
+        /**
+        * \brief Push a list of jobs into the inbox with one atomic operation. Can be called by any thread.
+        * \param[in] first The newest job of the list, linked through m_next.
+        * \param[in] last The oldest job of the list.
+        * \param[in] num Number of jobs in the list, all must have the same priority.
+        */
+        void push_list(JOB* first, JOB* last, int32_t num) noexcept {
+            m_inbox_size.fetch_add(num, std::memory_order_relaxed);
+            m_inbox[priority_index(first->m_job_priority)].push_list(first, last);
+        }
+
+        /**
+        * \brief Push a job directly into a deque. Must only be called by the owner thread.
+        * \param[in] job The job to be pushed into the queue.
+        */
+        void push_owner(JOB* job) {
+            m_deques[priority_index(job->m_job_priority)].push(job);
+        }
+
+        /**
+        * \brief Pop the job with the highest priority. Must only be called by the owner thread.
+        *
+        * Waiting jobs age: every c_aging_period-th pop starts with one of the lower priorities,
+        * taking turns, and only then goes on with the higher ones.
+        *
+        * \returns a job or nullptr.
+        */
+        JOB* pop() {
+            int32_t first = c_num_priorities - 1;
+            if (++m_pops % c_aging_period == 0) {
+                first = (m_pops / c_aging_period) % (c_num_priorities - 1);
+            }
+            for (uint32_t i = 0; i < c_num_priorities; ++i) {
+                int32_t p = first == c_num_priorities - 1 ? first - i : (first + i) % c_num_priorities;
+                JOB* job = pop_priority(p);
+                if (job != nullptr) return job;
+            }
+            return nullptr;
+        }
+
+        /**
+        * \brief Pop a job of one priority, without aging. Must only be called by the owner thread.
+        * \param[in] p The index of the priority.
+        * \returns a job or nullptr.
+        */
+        JOB* pop_priority(uint32_t p) {
+            JOB* list = m_inbox[p].take_all();          //move new jobs from the inbox to the deque
+            if (list != nullptr) {
+                list = reverse(list);
+                while (list != nullptr) {
+                    JOB* next = (JOB*)list->m_next;
+                    m_inbox_size.fetch_sub(1, std::memory_order_relaxed);
+                    m_deques[p].push(list);
+                    list = next;
+                }
+            }
+            return m_deques[p].pop();
+        }
+
+        /**
+        * \brief Test whether there are jobs of a priority. Can be off if other threads are working on the queue.
+        * \param[in] p The index of the priority.
+        * \returns true if the deque or the inbox of the priority is not empty.
+        */
+        bool has_jobs(uint32_t p) noexcept {
+            return m_deques[p].size() > 0 || !m_inbox[p].empty();
+        }
+
+        /**
+        * \brief Steal the job with the highest priority. Can be called by any thread.
+        *
+        * If a deque is empty but its inbox is not, then the thief takes the whole inbox.
+        * It keeps the oldest job and pushes the rest into its own queue. If max_more > 0, the thief
+        * also takes up to half of the remaining jobs of the deque, at most max_more, and pushes them into
+        * its own queue. The Chase-Lev deque cannot hand out several jobs with one CAS safely, so they are
+        * stolen one by one, but without looking for another victim in between.
+        *
+        * \param[in] thief The queue of the stealing thread, the caller must be its owner.
+        * \param[in] max_more Maximum number of additional jobs to take from the deque.
+        * \param[out] num If not nullptr, receives the number of jobs taken in total.
+        * \returns a job or nullptr.
+        */
+        JOB* steal(WorkerQueue<JOB>& thief, uint32_t max_more = 0, uint32_t* num = nullptr) {
+            uint32_t taken = 0;
+            JOB* job = nullptr;
+            for (int32_t p = c_num_priorities - 1; p >= 0 && job == nullptr; --p) {
+                job = m_deques[p].steal();
+                if (job != nullptr) {
+                    taken = 1;
+                    for (uint32_t more = std::min(m_deques[p].size() / 2, max_more); more > 0; --more) {  //steal half
+                        JOB* extra = m_deques[p].steal();
+                        if (extra == nullptr) break;
+                        thief.push_owner(extra);
+                        ++taken;
+                    }
+                    break;
+                }
+
+                JOB* list = m_inbox[p].take_all();
+                if (list != nullptr) {
+                    list = reverse(list);
+                    job = list;
+                    list = (JOB*)list->m_next;
+                    m_inbox_size.fetch_sub(1, std::memory_order_relaxed);
+                    taken = 1;
+                    while (list != nullptr) {
+                        JOB* next = (JOB*)list->m_next;
+                        m_inbox_size.fetch_sub(1, std::memory_order_relaxed);
+                        thief.push_owner(list);
+                        list = next;
+                        ++taken;
+                    }
+                }
+            }
+            if (num != nullptr) *num = taken;
+            return job;
+        }
+
+        /**
+        * \brief Steal the job with the highest priority for a thread without a queue of its own. Can be called by any thread.
+        *
+        * If a deque is empty but its inbox is not, the oldest job of the inbox is taken and the rest is put back.
+        *
+        * \returns a job or nullptr.
+        */
+        JOB* steal_one() noexcept {
+            for (int32_t p = c_num_priorities - 1; p >= 0; --p) {
+                JOB* job = m_deques[p].steal();
+                if (job != nullptr) return job;
+
+                JOB* list = m_inbox[p].take_all();      //newest first
+                if (list != nullptr) {
+                    m_inbox_size.fetch_sub(1, std::memory_order_relaxed);
+                    if (list->m_next == nullptr) return list;
+                    JOB* last = list;
+                    while (last->m_next->m_next != nullptr) last = (JOB*)last->m_next;
+                    job = (JOB*)last->m_next;           //the oldest job
+                    m_inbox[p].push_list(list, last);
+                    return job;
+                }
+            }
+            return nullptr;
+        }
+
+        /**
+        * \brief Deallocate all Jobs in the queue. Must only be called by the owner thread.
+        * \returns the number of deallocated jobs.
+        */
+        uint32_t clear() {
+            uint32_t res = 0;
+            JOB* job = pop();
+            while (job != nullptr) {
+                auto da = job->get_deallocator(); //get deallocator
+                da.deallocate(job);             //deallocate the memory
+                job = pop();                    //get next entry
+                ++res;
+            }
+            return res;
+        }
+    };
+
+
+    const uint64_t c_no_deadline = std::numeric_limits<uint64_t>::max();
+
+    /**
+    * \brief Jobs with a deadline, earliest deadline first.
+    *
+    * A binary heap behind a mutex. The earliest deadline is also kept in an atomic, so workers
+    * can check the queue without taking the lock, and it costs nothing while no job has a deadline.
+    */
+    template<typename JOB = Job_base>
+    class DeadlineQueue {
+        std::mutex              m_mutex;
+        std::vector<JOB*>       m_heap;
+        std::atomic<uint64_t>   m_earliest = c_no_deadline;    //deadline of the first job
+
+        static bool later(JOB* a, JOB* b) noexcept { return a->m_deadline > b->m_deadline; }
+
+    public:
+        DeadlineQueue() noexcept {};
+        DeadlineQueue(const DeadlineQueue<JOB>&) noexcept {};
+
+        /**
+        * \returns the earliest deadline, or c_no_deadline if the queue is empty.
+        */
+        uint64_t earliest() const noexcept { return m_earliest.load(std::memory_order_acquire); }
+
+        /**
+        * \brief Push a job. Can be called by any thread.
+        * \param[in] job The job, its m_deadline must be set.
+        */
+        void push(JOB* job) {
+            std::lock_guard lock(m_mutex);
+            m_heap.push_back(job);
+            std::push_heap(m_heap.begin(), m_heap.end(), later);
+            m_earliest.store(m_heap.front()->m_deadline, std::memory_order_release);
+        }
+
+        /**
+        * \brief Pop the job with the earliest deadline. Can be called by any thread.
+        * \param[in] before Only pop the job if its deadline is earlier than this.
+        * \returns a job or nullptr.
+        */
+        JOB* pop(uint64_t before = c_no_deadline) {
+            if (earliest() >= before && before != c_no_deadline) return nullptr;
+            std::lock_guard lock(m_mutex);
+            if (m_heap.empty() || (m_heap.front()->m_deadline >= before && before != c_no_deadline)) return nullptr;
+            std::pop_heap(m_heap.begin(), m_heap.end(), later);
+            JOB* job = m_heap.back();
+            m_heap.pop_back();
+            m_earliest.store(m_heap.empty() ? c_no_deadline : m_heap.front()->m_deadline, std::memory_order_release);
+            return job;
+        }
+
+        /**
+        * \returns the number of jobs in the queue.
+        */
+        uint32_t size() {
+            std::lock_guard lock(m_mutex);
+            return (uint32_t)m_heap.size();
+        }
+
+        /**
+        * \brief Deallocate all Jobs in the queue.
+        * \returns the number of deallocated jobs.
+        */
+        uint32_t clear() {
+            uint32_t res = 0;
+            JOB* job = pop();
+            while (job != nullptr) {
+                auto da = job->get_deallocator(); //get deallocator
+                da.deallocate(job);             //deallocate the memory
+                job = pop();                    //get next entry
+                ++res;
+            }
+            return res;
+        }
+    };
+
+    /**
+    * \brief Jobs that are scheduled at a later time, in a hierarchical timer wheel.
+    *
+    * Each of the c_timer_levels levels has 64 slots, a slot of level L spans 64^L ticks of c_timer_tick ns.
+    * Adding a timer is O(1), and when time has passed, the timers of a higher level slot cascade down
+    * into the level below. Each timer keeps its exact expiry time, so the earliest expiry is exact and
+    * a parked worker can sleep until then. Timers further away than the wheel spans wait in its last slot.
+    */
+    template<typename JOB = Job_base>
+    class TimerWheel {
+    public:
+        static const uint32_t c_timer_levels = 4;
+        static const uint32_t c_timer_slots = 64;
+        static const uint32_t c_timer_tick = 16;        //log2 of the tick length in ns, i.e. 65.5 us
+
+    private:
+        struct Timer {
+            JOB*        m_job;
+            uint64_t    m_expiry;                       //ns since the job system was started
+        };
+
+        std::mutex              m_mutex;
+        std::array<std::array<std::vector<Timer>, c_timer_slots>, c_timer_levels> m_slots;
+        std::array<uint32_t, c_timer_levels> m_num{};   //number of timers of each level
+        uint64_t                m_current = 0;          //the tick that has been harvested last
+        std::atomic<uint64_t>   m_earliest = c_no_deadline;    //expiry of the first timer
+
+        static uint32_t shift(uint32_t level) noexcept { return 6 * level; }
+
+        void insert(Timer timer) {
+            uint64_t tick = timer.m_expiry >> c_timer_tick;
+            uint32_t level = 0;
+            if (tick <= m_current) tick = m_current;    //due already, harvest it next time
+            while (level < c_timer_levels - 1 && tick - m_current >= (1ull << shift(level + 1))) ++level;
+            if (tick - m_current >= (1ull << shift(c_timer_levels))) {
+                tick = m_current + (1ull << shift(c_timer_levels)) - 1; //too far away, wait in the last slot
+            }
+            m_slots[level][(tick >> shift(level)) % c_timer_slots].push_back(timer);
+            ++m_num[level];
+        }
+
+        void cascade(uint32_t level) {
+            auto& slot = m_slots[level][(m_current >> shift(level)) % c_timer_slots];
+            m_num[level] -= (uint32_t)slot.size();
+            for (auto& timer : slot) insert(timer);
+            slot.clear();
+        }
+
+        uint64_t find_earliest() noexcept {
+            uint64_t earliest = c_no_deadline;
+            for (uint32_t level = 0; level < c_timer_levels; ++level) {     //a higher level can expire before a lower one, since levels depend on m_current when added
+                if (m_num[level] == 0) continue;
+                uint64_t start = level == 0 ? m_current : (m_current >> shift(level)) + 1;
+                for (uint32_t i = 0; i < c_timer_slots; ++i) {
+                    auto& slot = m_slots[level][(start + i) % c_timer_slots];
+                    if (slot.empty()) continue;
+                    for (auto& timer : slot) earliest = std::min(earliest, timer.m_expiry);     //the first slot of a level holds its earliest timer
+                    break;
+                }
+            }
+            return earliest;
+        }
+
+    public:
+        TimerWheel() noexcept {};
+        TimerWheel(const TimerWheel<JOB>& wheel) noexcept {};
+
+        /**
+        * \returns the earliest expiry time, or c_no_deadline if there is no timer.
+        */
+        uint64_t earliest() const noexcept { return m_earliest.load(std::memory_order_seq_cst); }
+
+        /**
+        * \brief Add a timer. Can be called by any thread.
+        * \param[in] job The job to schedule when the timer expires.
+        * \param[in] expiry The time in ns since the job system was started.
+        * \returns true if this is the earliest timer now.
+        */
+        bool add(JOB* job, uint64_t expiry) {
+            std::lock_guard lock(m_mutex);
+            insert(Timer{ job, expiry });
+            if (expiry >= m_earliest.load(std::memory_order_relaxed)) return false;
+            m_earliest.store(expiry, std::memory_order_seq_cst);
+            return true;
+        }
+
+        /**
+        * \brief Remove all timers that have expired. Can be called by any thread.
+        * \param[in] now The current time in ns since the job system was started.
+        * \param[out] jobs The jobs of the expired timers are appended here.
+        * \returns the number of expired timers.
+        */
+        uint32_t harvest(uint64_t now, std::vector<JOB*>& jobs) {
+            if (earliest() > now) return 0;
+            std::lock_guard lock(m_mutex);
+            uint32_t res = 0;
+            uint64_t tick = now >> c_timer_tick;
+            while (true) {
+                auto& slot = m_slots[0][m_current % c_timer_slots];
+                for (uint32_t i = 0; i < slot.size(); ) {
+                    if (slot[i].m_expiry <= now) {
+                        jobs.push_back(slot[i].m_job);
+                        slot[i] = slot.back();
+                        slot.pop_back();
+                        --m_num[0];
+                        ++res;
+                    }
+                    else ++i;
+                }
+                if (m_current >= tick) break;
+                uint32_t empty = 0;                     //the levels below have no timers
+                while (empty < c_timer_levels && m_num[empty] == 0) ++empty;
+                if (empty == 0) {
+                    ++m_current;
+                }
+                else {                                  //skip empty ticks until the next cascade
+                    uint64_t boundary = (m_current | ((1ull << shift(std::min(empty, c_timer_levels - 1))) - 1)) + 1;
+                    if (boundary > tick) {
+                        m_current = tick;
+                        continue;
+                    }
+                    m_current = boundary;
+                }
+                for (uint32_t level = c_timer_levels - 1; level > 0; --level) {   //highest level first
+                    if ((m_current & ((1ull << shift(level)) - 1)) == 0) cascade(level);
+                }
+            }
+            m_earliest.store(find_earliest(), std::memory_order_seq_cst);
+            return res;
+        }
+
+        /**
+        * \brief Remove the timers of some jobs before they expire. Can be called by any thread.
+        * \param[in] pred Returns true for the jobs whose timers are removed.
+        * \param[out] jobs The jobs of the removed timers are appended here.
+        * \returns the number of removed timers.
+        */
+        template<typename P>
+        uint32_t remove_if(P&& pred, std::vector<JOB*>& jobs) {
+            if (earliest() == c_no_deadline) return 0;
+            std::lock_guard lock(m_mutex);
+            uint32_t res = 0;
+            for (uint32_t level = 0; level < c_timer_levels; ++level) {
+                if (m_num[level] == 0) continue;
+                for (auto& slot : m_slots[level]) {
+                    for (uint32_t i = 0; i < slot.size(); ) {
+                        if (pred(slot[i].m_job)) {
+                            jobs.push_back(slot[i].m_job);
+                            slot[i] = slot.back();
+                            slot.pop_back();
+                            --m_num[level];
+                            ++res;
+                        }
+                        else ++i;
+                    }
+                }
+            }
+            if (res > 0) m_earliest.store(find_earliest(), std::memory_order_seq_cst);
+            return res;
+        }
+
+        /**
+        * \brief Deallocate all Jobs that are waiting for a timer.
+        * \returns the number of deallocated jobs.
+        */
+        uint32_t clear() {
+            std::lock_guard lock(m_mutex);
+            uint32_t res = 0;
+            for (auto& level : m_slots) {
+                for (auto& slot : level) {
+                    for (auto& timer : slot) {
+                        auto da = timer.m_job->get_deallocator(); //get deallocator
+                        da.deallocate(timer.m_job);     //deallocate the memory
+                        ++res;
+                    }
+                    slot.clear();
+                }
+            }
+            m_num = {};
+            m_earliest.store(c_no_deadline);
+            return res;
+        }
+    };
+
+
+    const int32_t c_num_tag_slots = 1 << 10;    //tags below this value do not need any lock
+
+    /**
+    * \brief A thread can park itself here until another thread unparks it.
+    *
+    * An unpark() that happens before park() is not lost, the next park() returns immediately.
+    * Parked threads block without any timed polling, only the worker waiting for the next timer uses a timeout.
+    */
+    class Parker {
+        std::mutex              m_mutex;
+        std::condition_variable m_cv;
+        bool                    m_notified = false;     //true if unpark() was called since the last park()
+
+    public:
+        Parker() noexcept {};
+        Parker(const Parker&) noexcept {};
+
+        /**
+        * \brief Block the calling thread until unpark() is called.
+        */
+        void park() {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_cv.wait(lk, [&]() { return m_notified; });
+            m_notified = false;
+        }
+
+        /**
+        * \brief Block the calling thread until unpark() is called, or until a point in time.
+        * \param[in] time Wake up at this time at the latest.
+        * \returns true if unpark() was called, false if the time has come.
+        */
+        template<typename T>
+        bool park_until(const T& time) {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            bool notified = m_cv.wait_until(lk, time, [&]() { return m_notified; });
+            m_notified = false;
+            return notified;
+        }
+
+        /**
+        * \brief Wake up the parked thread, or let its next park() return immediately.
+        */
+        void unpark() {
+            {
+                std::lock_guard<std::mutex> lg(m_mutex);
+                m_notified = true;
+            }
+            m_cv.notify_one();
+        }
+    };
+
+
+    /**
+    * \brief Registry of idle worker threads, one bit per thread.
+    *
+    * A worker sets its bit before it parks. A thread that makes work available clears a bit
+    * and unparks exactly this worker, so no two threads wake up the same worker.
+    */
+    class IdleMask {
+        std::vector<std::atomic<uint64_t>> m_words;     //bit i of word w is set if worker 64*w+i is idle
+
+    public:
+        /**
+        * \brief Make room for a number of threads and clear all bits.
+        * \param[in] num_threads Number of worker threads.
+        */
+        void resize(uint32_t num_threads) {
+            m_words = std::vector<std::atomic<uint64_t>>((num_threads + 63) / 64);
+        }
+
+        /**
+        * \brief Mark a worker as idle.
+        * \param[in] i Index of the worker.
+        */
+        void set(uint32_t i) noexcept {
+            m_words[i / 64].fetch_or(1ull << (i % 64), std::memory_order_seq_cst);
+        }
+
+        /**
+        * \brief Mark a worker as busy.
+        * \param[in] i Index of the worker.
+        * \returns true if the worker was idle before, i.e. the caller is responsible for waking it up.
+        */
+        bool clear(uint32_t i) noexcept {
+            uint64_t bit = 1ull << (i % 64);
+            if ((m_words[i / 64].load(std::memory_order_relaxed) & bit) == 0) return false;
+            return (m_words[i / 64].fetch_and(~bit, std::memory_order_seq_cst) & bit) != 0;
+        }
+
+        /**
+        * \brief Mark any idle worker in a range of workers as busy.
+        * \param[in] first Index of the first worker in the range.
+        * \param[in] last Index after the last worker in the range.
+        * \returns the index of the worker that was idle before, or -1 if no worker is idle.
+        */
+        int32_t claim_any(uint32_t first = 0, uint32_t last = std::numeric_limits<uint32_t>::max()) noexcept {
+            last = std::min(last, (uint32_t)m_words.size() * 64);
+            for (uint32_t w = first / 64; w * 64 < last; ++w) {
+                uint64_t mask = ~0ull;
+                if (w == first / 64) mask &= ~0ull << (first % 64);                       //no workers before first
+                if ((w + 1) * 64 > last) mask &= ~0ull >> (64 - (last - w * 64));         //no workers from last on
+                uint64_t word = m_words[w].load(std::memory_order_relaxed) & mask;
+                while (word != 0) {
+                    uint64_t bit = word & (~word + 1);      //lowest set bit
+                    if (m_words[w].fetch_and(~bit, std::memory_order_seq_cst) & bit) {
+                        return (int32_t)(w * 64 + std::countr_zero(bit));
+                    }
+                    word = m_words[w].load(std::memory_order_relaxed) & mask;
+                }
+            }
+            return -1;
+        }
+
+        /**
+        * \param[in] i Index of the worker.
+        * \returns true if the worker is idle.
+        */
+        bool test(uint32_t i) noexcept {
+            return (m_words[i / 64].load(std::memory_order_relaxed) & (1ull << (i % 64))) != 0;
+        }
+
+        /**
+        * \returns the number of idle workers.
+        */
+        uint32_t count() noexcept {
+            uint32_t num = 0;
+            for (auto& word : m_words) num += std::popcount(word.load(std::memory_order_relaxed));
+            return num;
+        }
+    };
+
+
+    /**
+    * \brief How idle workers steal jobs from other workers.
+    */
+    struct StealPolicy {
+        bool     m_locality = true;     //victims in the own L3 domain first, then the own NUMA node, then the rest
+        bool     m_steal_half = true;   //take up to half of the victim's deque at once
+        uint32_t m_max_batch = 32;      //at most this many jobs are taken in one steal
+        uint32_t m_max_backoff = 16;    //remote victims are tried every 1, 2, 4, ... up to m_max_backoff rounds after failing
+    };
+
+
+    /**
+    * \brief How a worker runs short jobs back to back.
+    *
+    * After a job, a worker goes on with more jobs of the same priority from its own queues,
+    * without looking at the other queues in between. While siblings run one after the other, the
+    * child counter decrements of their parent are collected and then done at once. Waking up other
+    * workers is not deferred, since a parked worker that is not woken up could not steal the jobs.
+    * A batch ends after m_max_jobs jobs, after m_max_time, or when the queues run out of jobs of its
+    * priority. A batch of lower priority also ends as soon as HIGH jobs or jobs with a deadline are waiting.
+    */
+    struct BatchPolicy {
+        std::array<uint32_t, c_num_priorities> m_max_jobs{ 32, 16, 4 };  //per priority index (LOW, MEDIUM, HIGH), 1 turns batches off
+        std::chrono::nanoseconds m_max_time{ 20'000 };                   //long jobs end the batch, so they are not delayed
+    };
+
+
+    /**
+    * \brief Steal counters of one worker, or summed up over all workers.
+    */
+    struct StealStats {
+        uint64_t m_attempts = 0;        //victims probed
+        uint64_t m_successes = 0;       //probes that returned a job
+        uint64_t m_jobs = 0;            //jobs taken, including the additional jobs of steal-half
+        uint64_t m_remote = 0;          //successes outside the own L3 domain
+        uint64_t m_backoffs = 0;        //rounds in which the remote victims were skipped
+
+        uint64_t failures() const noexcept { return m_attempts - m_successes; }
+        double success_rate() const noexcept { return m_attempts > 0 ? (double)m_successes / m_attempts : 0.0; }
+
+        StealStats& operator+=(const StealStats& other) noexcept {
+            m_attempts += other.m_attempts;
+            m_successes += other.m_successes;
+            m_jobs += other.m_jobs;
+            m_remote += other.m_remote;
+            m_backoffs += other.m_backoffs;
+            return *this;
+        }
+    };
+
+
+    /**
+    * \brief The victims of one worker, ordered by distance, together with its backoff state and counters.
+    *
+    * Only the owning worker changes the state. The counters can be read by any thread.
+    */
+    struct alignas(64) StealState {
+        std::vector<uint32_t>   m_victims;          //all other workers: same L3 domain, same NUMA node, the rest
+        uint32_t                m_near = 0;         //victims [0, m_near) share the L3 domain
+        uint32_t                m_numa = 0;         //victims [m_near, m_numa) share the NUMA node
+        uint32_t                m_backoff = 1;      //remote victims are tried every m_backoff rounds
+        uint32_t                m_rounds = 0;       //rounds since the remote victims were tried
+        std::atomic<uint64_t>   m_attempts = 0;
+        std::atomic<uint64_t>   m_successes = 0;
+        std::atomic<uint64_t>   m_jobs = 0;
+        std::atomic<uint64_t>   m_remote = 0;
+        std::atomic<uint64_t>   m_backoffs = 0;
+
+        StealState() noexcept {};
+        StealState(const StealState&) noexcept {};
+
+        /**
+        * \brief Increase a counter. Only the owner writes, so no read-modify-write is needed.
+        */
+        static void add(std::atomic<uint64_t>& counter, uint64_t num = 1) noexcept {
+            counter.store(counter.load(std::memory_order_relaxed) + num, std::memory_order_relaxed);
+        }
+
+        /**
+        * \returns a copy of the counters.
+        */
+        StealStats stats() const noexcept {
+            return { m_attempts.load(std::memory_order_relaxed), m_successes.load(std::memory_order_relaxed)
+                , m_jobs.load(std::memory_order_relaxed), m_remote.load(std::memory_order_relaxed), m_backoffs.load(std::memory_order_relaxed) };
+        }
+    };
+
+
+    /**
+    * \brief Counters of one worker, or summed up over all workers, see JobSystem::snapshot_metrics().
+    */
+    struct WorkerMetrics {
+        uint64_t    m_jobs = 0;                 //jobs and coro resumptions run
+        uint64_t    m_stolen_from = 0;          //jobs other workers stole from this worker
+        uint64_t    m_parks = 0;                //times the worker went to sleep
+        uint64_t    m_parked_ns = 0;            //time spent sleeping
+        uint64_t    m_busy_ns = 0;              //time spent running jobs
+        uint64_t    m_allocated = 0;            //Jobs allocated
+        uint64_t    m_freed = 0;                //Jobs given back to the memory resource
+        uint64_t    m_completion_hits = 0;      //completions taken from the recycle queue
+        uint64_t    m_completion_misses = 0;    //completions that had to be allocated
+        uint64_t    m_deadline_jobs = 0;        //jobs with a deadline that have finished
+        uint64_t    m_deadline_misses = 0;      //jobs that finished after their deadline
+        uint64_t    m_cancelled = 0;            //jobs and coros that were skipped because they had been cancelled
+        uint64_t    m_batched = 0;              //jobs that ran back to back after another job, see BatchPolicy
+        uint64_t    m_queued = 0;               //jobs in the queues of the worker when the snapshot was taken
+        uint32_t    m_idle = 0;                 //number of workers that were idle when the snapshot was taken
+        StealStats  m_steal;                    //jobs this worker stole, and failed attempts
+
+        WorkerMetrics& operator+=(const WorkerMetrics& other) noexcept {
+            m_jobs += other.m_jobs;
+            m_stolen_from += other.m_stolen_from;
+            m_parks += other.m_parks;
+            m_parked_ns += other.m_parked_ns;
+            m_busy_ns += other.m_busy_ns;
+            m_allocated += other.m_allocated;
+            m_freed += other.m_freed;
+            m_completion_hits += other.m_completion_hits;
+            m_completion_misses += other.m_completion_misses;
+            m_deadline_jobs += other.m_deadline_jobs;
+            m_deadline_misses += other.m_deadline_misses;
+            m_cancelled += other.m_cancelled;
+            m_batched += other.m_batched;
+            m_queued += other.m_queued;
+            m_idle += other.m_idle;
+            m_steal += other.m_steal;
+            return *this;
+        }
+    };
+
+
+    /**
+    * \brief A snapshot of the metrics of all workers.
+    */
+    struct SchedulerMetrics {
+        std::vector<WorkerMetrics>  m_workers;      //one entry per worker, the last entry counts threads outside the pool
+        WorkerMetrics               m_total;        //sum over all entries
+        SlabStats                   m_slab;         //statistics of the slab resource
+        uint64_t                    m_time_ns = 0;  //nanoseconds since the job system was started
+    };
+
+
+    /**
+    * \brief Live counters of one worker.
+    *
+    * Only the owning worker changes the counters, except m_stolen_from, which is increased by thieves
+    * and lives on its own cache line. Threads outside the pool share one instance and use atomic adds.
+    */
+    struct alignas(64) WorkerCounters {
+        std::atomic<uint64_t>   m_jobs = 0;
+        std::atomic<uint64_t>   m_parks = 0;
+        std::atomic<uint64_t>   m_parked_ns = 0;
+        std::atomic<uint64_t>   m_busy_ns = 0;
+        std::atomic<uint64_t>   m_allocated = 0;
+        std::atomic<uint64_t>   m_freed = 0;
+        std::atomic<uint64_t>   m_completion_hits = 0;
+        std::atomic<uint64_t>   m_completion_misses = 0;
+        std::atomic<uint64_t>   m_deadline_jobs = 0;
+        std::atomic<uint64_t>   m_deadline_misses = 0;
+        std::atomic<uint64_t>   m_cancelled = 0;
+        std::atomic<uint64_t>   m_batched = 0;
+        alignas(64) std::atomic<uint64_t> m_stolen_from = 0;
+
+        WorkerCounters() noexcept {};
+        WorkerCounters(const WorkerCounters&) noexcept {};
+
+        /**
+        * \returns a copy of the counters.
+        */
+        WorkerMetrics metrics() const noexcept {
+            WorkerMetrics m;
+            m.m_jobs = m_jobs.load(std::memory_order_relaxed);
+            m.m_stolen_from = m_stolen_from.load(std::memory_order_relaxed);
+            m.m_parks = m_parks.load(std::memory_order_relaxed);
+            m.m_parked_ns = m_parked_ns.load(std::memory_order_relaxed);
+            m.m_busy_ns = m_busy_ns.load(std::memory_order_relaxed);
+            m.m_allocated = m_allocated.load(std::memory_order_relaxed);
+            m.m_freed = m_freed.load(std::memory_order_relaxed);
+            m.m_completion_hits = m_completion_hits.load(std::memory_order_relaxed);
+            m.m_completion_misses = m_completion_misses.load(std::memory_order_relaxed);
+            m.m_deadline_jobs = m_deadline_jobs.load(std::memory_order_relaxed);
+            m.m_deadline_misses = m_deadline_misses.load(std::memory_order_relaxed);
+            m.m_cancelled = m_cancelled.load(std::memory_order_relaxed);
+            m.m_batched = m_batched.load(std::memory_order_relaxed);
+            return m;
+        }
+    };
+
+
+    /**
+    * \brief Everything that belongs to one worker, in one block on the NUMA node of the worker.
+    *
+    * The queues, the steal state and the counters start on their own cache lines, and the
+    * fields written by other threads are on other lines than those only the owner writes,
+    * so neighbouring workers do not invalidate each other's lines. The magazines of the allocators
+    * (ThreadCache, the epoch arenas and m_completions) and the trace rings stay thread_local,
+    * since threads outside the pool use them too, and they are touched first by their own thread anyway.
+    */
+    struct alignas(64) WorkerContext {
+        WorkerQueue<Job_base>   m_global;       //global job queue, multiple produce, multiple consume
+        WorkerQueue<Job_base>   m_local;        //local job queue, multiple produce, single consume
+        StealState              m_steal;        //victims and steal counters
+        WorkerCounters          m_counters;     //metrics, written by the owner
+        alignas(64) Parker      m_parker;       //the worker parks here while idle
+        CpuInfo                 m_cpu;          //the CPU, L3 domain and NUMA node of the worker
+        bool                    m_numa_local = false;   //allocated by Topology::allocate_local()
+
+        struct deleter {
+            void operator()(WorkerContext* context) noexcept {
+                bool local = context->m_numa_local;
+                context->~WorkerContext();
+                if (local) Topology::deallocate_local(context, sizeof(WorkerContext));
+                else ::operator delete(context, std::align_val_t{ alignof(WorkerContext) });
+            }
+        };
+
+        /**
+        * \brief Create the context of a worker on the NUMA node of its CPU.
+        * \param[in] cpu The CPU of the worker.
+        * \returns the context.
+        */
+        static std::unique_ptr<WorkerContext, deleter> create(const CpuInfo& cpu) {
+            void* memory = Topology::allocate_local(sizeof(WorkerContext), cpu);
+            bool local = memory != nullptr;
+            if (!local) memory = ::operator new(sizeof(WorkerContext), std::align_val_t{ alignof(WorkerContext) });
+            auto context = new (memory) WorkerContext();
+            context->m_cpu = cpu;
+            context->m_numa_local = local;
+            return std::unique_ptr<WorkerContext, deleter>(context);
+        }
+    };
+
+
+    /**
+    * \brief An additional worker pool that the job system starts next to its default pool.
+    */
+    struct PoolConfig {
+        thread_count_t           m_threads{ 1 };    //number of workers in the pool
+        n_pmr::memory_resource*  m_mr = nullptr;    //allocates the Jobs and Coros scheduled into the pool, nullptr for the one of the job system
+    };
+
+
+    /**
+    * \brief The workers of a pool and the jobs that any of them can take.
+    */
+    struct JobPool {
+        uint32_t                    m_first = 0;    //index of the first worker of the pool
+        uint32_t                    m_count = 0;    //number of workers, they have consecutive indices
+        n_pmr::memory_resource*     m_mr = nullptr; //allocates the Jobs and Coros of this pool
+        DeadlineQueue<Job_base>     m_deadlines;    //jobs with a deadline, earliest deadline first
+
+        JobPool(uint32_t first, uint32_t count, n_pmr::memory_resource* mr) noexcept : m_first(first), m_count(count), m_mr(mr) {};
+
+        bool contains(uint32_t index) const noexcept { return index - m_first < m_count; }
+    };
+
+
+    /**
+    * \brief The main JobSystem class manages the whole VGJS job system.
+    *
+    * The JobSystem starts N threads and provides them with data structures.
+    * It can add new jobs, and wait until they are done.
+    */
+    class JobSystem {
+        template<typename I, typename D> friend class parallel_range_t;
+        friend class TaskGraph;
+
+        static inline const uint32_t c_queue_capacity = 1<<10; ///<save at most N completions for recycling
+        static inline const bool c_enable_logging = false;  ///<if false, enable_logging() has no effect
+        static inline const bool c_enable_tracing = false;  ///<if false and c_enable_logging is false, all trace_event() calls compile to nothing
+        static inline const std::chrono::milliseconds c_log_interval{ 1 };  ///<the log writer drains the trace rings this often
+        static inline const bool c_enable_metrics = true;   ///<if false, the worker counters are not updated
+        static inline const uint32_t c_busy_flush = 256;    ///<a busy worker adds its busy time every N jobs
+        static inline const std::chrono::nanoseconds c_deadline_window{ 2'000'000 };  ///<default for set_deadline_window()
+        static inline const uint32_t c_timer_check = 64;    ///<a busy worker looks for expired timers every N loops
+
+    private:
+        static inline std::atomic<uint64_t>             m_init_counter = 0;
+        static inline n_pmr::memory_resource*           m_mr;                   ///<use to allocate/deallocate Jobs
+        static inline std::vector<std::thread>	        m_threads;	            ///<array of thread structures
+        static inline std::atomic<uint32_t>   		    m_thread_count = 0;     ///<number of threads in the pool
+        static inline std::atomic<bool>                 m_terminated = false;   ///<flag set true when the last thread has exited
+        static inline thread_index_t				    m_start_idx;            ///<idx of first thread that is created
+        static inline thread_local thread_index_t	    m_thread_index = thread_index_t{};  ///<each thread has its own number
+        static inline std::atomic<bool>				    m_terminate = false;	///<Flag for terminating the pool
+        static inline thread_local Job_base*            m_current_job = nullptr;///<Pointer to the current job of this thread0
+        static inline thread_local Job_base*            m_next_job = nullptr;   ///<job that run_job() runs right after the current job
+        static inline std::vector<std::unique_ptr<WorkerContext, WorkerContext::deleter>> m_workers;  ///<queues, parker, steal state and counters of each thread
+        static inline StealPolicy                       m_steal_policy;         ///<how idle threads steal jobs
+        static inline BatchPolicy                       m_batch_policy;         ///<how workers run short jobs back to back
+        static inline thread_local bool                 m_batching = false;     ///<true while this thread runs a batch, see run_batch()
+        static inline thread_local Job_base*            m_deferred_parent = nullptr;    ///<parent whose child counter is decreased when the batch ends
+        static inline thread_local uint32_t             m_deferred_children = 0;       ///<number of finished children of m_deferred_parent
+        static inline WorkerCounters                    m_outside_counters;     ///<counters of the threads outside the pools
+        static inline IdleMask                          m_idle;                 ///<which threads are parked or about to park
+        static inline std::vector<JobPool>              m_pools;                ///<the default pool 0 and the additional pools, fixed after start
+        static inline thread_local pool_t               m_pool_index = pool_t{};    ///<pool of this thread, -1 for threads outside the pools
+        static inline thread_local pool_t               m_schedule_pool = pool_t{}; ///<pool that schedule_on() is scheduling into, -1 if none
+        static inline std::atomic<uint64_t>             m_deadline_window = c_deadline_window.count();  ///<ns, jobs due that soon are run before all other jobs
+        static inline TimerWheel<Job_base>              m_timers;               ///<jobs that are scheduled later
+        static inline std::atomic<int32_t>              m_timer_keeper = -1;    ///<the parked worker that wakes up for the next timer, or -1
+        static inline std::atomic<uint64_t>             m_epoch = 0;            ///<the open epoch, 0 if none
+        static inline std::atomic<uint64_t>             m_epoch_counter = 0;    ///<number of epochs so far
+        static inline std::atomic<Job_base*>            m_epoch_opener = nullptr;   ///<the job that called begin_epoch(), or nullptr for a thread outside the pool
+        static inline thread_local uint64_t             t_epoch_opened = 0;     ///<the epoch opened by this thread outside of a job
+        static inline std::atomic<int32_t>              m_cancellations = 0;    ///<cancelled jobs and coros that have not finished yet
+        static inline std::array<JobStack<Job_base>, c_num_tag_slots>                m_tag_stacks;      ///<jobs waiting for a tag
+        static inline std::unordered_map<tag_t, JobStack<Job_base>, tag_t::hash>    m_tag_overflow;    ///<stacks for tags >= c_num_tag_slots
+        static inline std::mutex                                                    m_tag_mutex;       ///<protects m_tag_overflow
+        static inline thread_local JobQueue<JobCompletion,false> m_completions; ///<save old completions for recycling
+        static inline std::atomic<bool>                     m_logging = false;      ///< if true then trace events are streamed to the log file
+        static inline std::thread                           m_log_writer;           ///< drains the trace rings into the log file
+        static inline std::ofstream                         m_log_file;             ///< the binary log file, written only by the log writer
+        static inline std::mutex                            m_log_mutex;            ///< serializes enable_logging() and disable_logging()
+        static inline std::map<int32_t, std::string>        m_types;                ///<map types to a string for logging
+        static inline std::chrono::time_point<std::chrono::high_resolution_clock> m_start_time = std::chrono::high_resolution_clock::now();	//time when program started
+        static inline std::atomic<uint64_t>             m_unique_job_id = 1; //global unique job id (hope it will not overflow)
+        static inline std::atomic<bool>                 m_tracing = false;      ///<if true then trace events are recorded
+        static inline thread_local TraceRing*           m_trace_ring = nullptr; ///<trace events of this thread
+        static inline std::vector<std::unique_ptr<TraceRing>> m_trace_rings;    ///<trace rings of all threads that recorded events
+        static inline std::mutex                        m_trace_mutex;          ///<protects m_trace_rings and flushing
+        Log::SPloggerT logger = Log::GetLogger("JobSystem");
+        /**
+        * \brief Allocate a job so that it can be scheduled.
+        *
+        * A new Job struct is allocated from the memory resource m_mr, by default
+        * from the free list of this thread in the slab resource. Inside an epoch it is
+        * allocated from the arena of the epoch instead.
+        *
+        * \param[in] in_epoch If false, then the Job does not belong to an epoch, e.g. because it is reused.
+        * \returns a pointer to the job.
+        */
+        Job* allocate_job(bool in_epoch = true) {
+            uint64_t epoch = in_epoch ? caller_epoch() : 0;
+            n_pmr::memory_resource* mr = epoch != 0 ? &EpochResource::instance(epoch % c_num_epochs) : pool_resource();
+            n_pmr::polymorphic_allocator<Job> allocator(mr);        //use this allocator
+            Job* job = allocator.allocate(1);                       //allocate the object
+            if (job == nullptr) {
+                logger->trace("No job available");
+                throw RTE::JobException("Job system can't allocate new job");
+            }
+            new (job) Job(mr);                   //call constructor
+            job->m_epoch = epoch;
+            if (epoch != 0) EpochResource::instance(epoch % c_num_epochs).job_allocated();
+            count(&WorkerCounters::m_allocated);
+            return job;
+        }
+
+        /**
+        * \brief Get the epoch that new Jobs, Coros and other memory of the caller belong to.
+        *
+        * The opener of the current epoch allocates in it, every other Job allocates in the epoch of its own memory.
+        *
+        * \returns the epoch, or 0 if the caller does not belong to an epoch.
+        */
+        uint64_t caller_epoch() noexcept {
+            uint64_t epoch = m_epoch.load(std::memory_order_acquire);
+            if (epoch != 0 && (m_current_job == nullptr ? t_epoch_opened == epoch : m_current_job == m_epoch_opener.load(std::memory_order_relaxed))) {
+                return epoch;
+            }
+            return m_current_job != nullptr ? m_current_job->m_epoch : 0;
+        }
+
+        /**
+        * \brief Get the pool that new Jobs and Coros of the caller go into.
+        * \returns the pool given to schedule_on() if it exists, else the pool of the calling worker, else the default pool 0.
+        */
+        pool_t schedule_pool() noexcept {
+            if (m_schedule_pool.value >= 0 && m_schedule_pool.value < (int)m_pools.size()) return m_schedule_pool;
+            return m_pool_index.value >= 0 ? m_pool_index : pool_t{ 0 };
+        }
+
+        /**
+        * \brief Get the pool of a job. A job that has none yet, or an invalid one, goes into the pool of the caller
+        * and stays there until it is moved explicitly, e.g. by resume_on().
+        * \param[in] job The job.
+        * \returns the index of the pool.
+        */
+        uint32_t resolve_pool(Job_base* job) noexcept {
+            if (job->m_pool.value < 0 || job->m_pool.value >= (int)m_pools.size()) [[unlikely]] {
+                job->m_pool = schedule_pool();
+            }
+            return job->m_pool.value;
+        }
+
+        /**
+        * \brief Get the memory resource of the pool that new Jobs and Coros of the caller go into.
+        * \returns the memory resource.
+        */
+        n_pmr::memory_resource* pool_resource() noexcept {
+            uint32_t pool = schedule_pool().value;
+            return pool < m_pools.size() ? m_pools[pool].m_mr : m_mr;
+        }
+
+        /**
+        * \brief Increase a counter of the calling thread. Compiles to nothing if c_enable_metrics is false.
+        * \param[in] counter The counter.
+        * \param[in] num The number to add.
+        */
+        void count(std::atomic<uint64_t> WorkerCounters::* counter, uint64_t num = 1) noexcept {
+            if constexpr (c_enable_metrics) {
+                uint32_t index = (uint32_t)m_thread_index.value;      //threads outside the pool have -1
+                if (index < m_workers.size()) [[likely]] {
+                    StealState::add(m_workers[index]->m_counters.*counter, num);    //only the owner writes
+                }
+                else {
+                    (m_outside_counters.*counter).fetch_add(num, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+        * \brief Allocate a job so that it can be scheduled.
+        * \param[in] f Function that should be executed by the job.
+        * \returns a pointer to the Job.
+        */
+        template <typename F>
+        requires FUNCTOR<F>
+        Job* allocate_job(F&& f, bool in_epoch = true) {
+            Job* job = allocate_job(in_epoch);
+            if constexpr (std::is_same_v<std::decay_t<F>, Function>) {
+                job->m_function.emplace(std::forward<F>(f).get_function());
+                job->m_thread_index = f.m_thread_index;
+                job->m_type         = f.m_type;
+                job->m_id           = f.m_id;
+                job->m_deadline     = deadline_after(f.m_deadline);
+            }
+            else {
+                if constexpr (is_chain<std::decay_t<F>>::value) {
+                    job->m_stages = std::decay_t<F>::c_num_stages;
+                }
+                job->m_function.emplace(std::forward<F>(f)); //function pointer, std::function<void(void)> or a lambda, moved if possible
+            }
+
+            if (!job->m_function) {
+                logger->trace("Empty function");
+                throw RTE::JobException("Job do not have function to execute");
+            }
+            return job;
+        }
+
+
+    public:
+
+        /**
+        * \brief JobSystem class constructor.
+        * \param[in] threadCount Number of threads in the system.
+        * \param[in] start_idx Number of first thread, if 1 then the main thread should enter as thread 0.
+        * \param[in] mr The memory resource to use for allocating Jobs and Coros, by default the slab resource.
+        * \param[in] placement How the threads are pinned to the CPUs of this machine.
+        * \param[in] pools Additional worker pools, their workers are started after the workers of the default pool 0.
+        */
+        JobSystem(thread_count_t threadCount = thread_count_t(0), thread_index_t start_idx = thread_index_t(0)
+            , n_pmr::memory_resource* mr = slab_resource(), placement_t placement = placement_t::compact
+            , const std::vector<PoolConfig>& pools = {}) noexcept {
+
+            if (m_init_counter > 0) [[likely]] return;
+            auto cnt = m_init_counter.fetch_add(1);
+            if (cnt > 0) return;
+
+            m_mr = mr;
+            m_start_idx = start_idx;
+            m_terminate = false;
+            m_terminated = false;
+
+            m_thread_count = threadCount.value;
+            // we want at least 2 threads
+            int hardware_threads = std::max((uint32_t)topology().m_cpus.size(), 2u);
+            if (m_thread_count <= 0) {
+                m_thread_count = hardware_threads;		///< main thread is also running
+            }
+            if (m_start_idx + 2 > hardware_threads) {
                 m_start_idx = 0;
                 logger->trace("start_idx parameter ignored - not enough hardware concurrency");
             }
-            m_thread_count -= m_start_idx; // do not create threads which we should skip
+            m_thread_count -= m_start_idx; // do not create threads which we should skip
+
+            m_pools.push_back(JobPool{ 0, m_thread_count.load(), mr });       //the default pool
+            for (auto& config : pools) {
+                uint32_t threads = (uint32_t)std::max(config.m_threads.value, 1);
+                m_pools.push_back(JobPool{ m_thread_count.load(), threads, config.m_mr != nullptr ? config.m_mr : mr });
+                m_thread_count += threads;
+            }
+
+            logger->trace(
+                std::format("Number of threads created: {}, pools: {}, hardware number of threads: {}, cores: {}, L3 domains: {}, NUMA nodes: {}",
+                    m_thread_count.load(), m_pools.size(), hardware_threads, topology().m_num_cores, topology().m_num_l3, topology().m_num_numa
+                )
+            );
+            auto cpus = topology().place(placement, m_thread_count, m_start_idx.value);  //do not bind to CPUs less than start_idx
+
+            for (uint32_t i = 0; i < m_thread_count; i++) {
+                m_workers.push_back(WorkerContext::create(cpus[i]));   //on the NUMA node of the worker
+            }
+            m_idle.resize(m_thread_count);
+            init_victims();
+
+            for (uint32_t i = 0; i < m_thread_count; i++) {
+                m_threads.emplace_back(std::thread(&JobSystem::thread_task, this, thread_index_t(i))); //spawn the pool threads
+                if (placement != placement_t::none && !Topology::pin(m_threads[i].native_handle(), cpus[i])) {
+                    logger->trace(std::format("Thread {} can't be pinned to CPU {}", i, cpus[i].m_index));
+                }
+                m_threads[i].detach();
+            }
+        };
+
+
+        /**
+        * \brief Test whether the job system has been started yet.
+        * \returns true if the instance exists, else false.
+        */
+        static bool is_instance_created() noexcept {
+            return m_current_job != nullptr;
+        };
+
+        JobSystem(const JobSystem&) = delete;				// non-copyable,
+        JobSystem& operator=(const JobSystem&) = delete;
+        JobSystem(JobSystem&&) = default;					// but movable
+        JobSystem& operator=(JobSystem&&) = default;
+        ~JobSystem() = default;
+
+        void on_finished(Job* job) noexcept;            //called when the job finishes, i.e. all children have finished
+
+        /**
+        * \brief Child tells its parent that it has finished.
+        *
+        * A child that finished calls this function for its parent, thus decreasing
+        * the number of left children by one. If the last one finishes (including the
+        * parent itself) then the parent also finishes (and may call its own parent).
+        * Note that a Job is also its own child, so it must have returned from
+        * its function before on_finished() is called. Note that a Job is also its own
+        * child so that the Job can only finish after its function has returned.
+        */
+        inline bool child_finished(Job_base* job, uint32_t finished = 1) noexcept {
+            uint32_t num = job->m_children.fetch_sub(finished); //less children
+            if (num == finished) {                              //was it the last child?
+
+                if (job->is_function()) {            //Jobs call always on_finished()
+                    on_finished((Job*)job);     //if yes then finish this job
+                }
+                else {
+                    schedule_job(job);   //a coro just gets scheduled again so it can go on
+                }
+                return true;
+            }
+            return false;
+        }
+
+        /**
+        * \brief Get the pool of a worker.
+        * \param[in] index Index of the worker.
+        * \returns the index of the pool, or 0 if the index is not a worker.
+        */
+        uint32_t pool_of(uint32_t index) const noexcept {
+            for (uint32_t p = 1; p < m_pools.size(); ++p) {
+                if (m_pools[p].contains(index)) return p;
+            }
+            return 0;
+        }
+
+        /**
+        * \brief Order the victims of every thread by distance: first the threads in the same L3 domain,
+        * then the threads on the same NUMA node, then all others of the same pool.
+        */
+        void init_victims() {
+            for (uint32_t i = 0; i < m_thread_count; ++i) {
+                auto& state = m_workers[i]->m_steal;
+                auto& me = m_workers[i]->m_cpu;
+                auto& pool = m_pools[pool_of(i)];      //workers steal only inside their own pool
+                std::vector<uint32_t> tiers[3];
+                for (uint32_t k = 1; k < pool.m_count; ++k) {
+                    uint32_t j = pool.m_first + (i - pool.m_first + k) % pool.m_count;
+                    auto& other = m_workers[j]->m_cpu;
+                    uint32_t tier = !m_steal_policy.m_locality || other.m_l3 == me.m_l3 ? 0 : (other.m_numa == me.m_numa ? 1 : 2);
+                    tiers[tier].push_back(j);
+                }
+                state.m_victims = tiers[0];
+                state.m_near = (uint32_t)state.m_victims.size();
+                state.m_victims.insert(state.m_victims.end(), tiers[1].begin(), tiers[1].end());
+                state.m_numa = (uint32_t)state.m_victims.size();
+                state.m_victims.insert(state.m_victims.end(), tiers[2].begin(), tiers[2].end());
+            }
+        }
+
+        /**
+        * \brief Get the next job for this worker: from the deadlines of its pool, the local queue, the own global queue, or by stealing.
+        * \param[in,out] next Position where stealing continues.
+        * \param[in] all If true, then try all victims regardless of the backoff.
+        * \returns a job or nullptr.
+        */
+        Job_base* find_job(uint32_t& next, bool all = false) noexcept {
+            Job_base* job = nullptr;
+            auto& pool_deadlines = m_pools[m_pool_index.value].m_deadlines;
+            bool deadlines = pool_deadlines.earliest() != c_no_deadline;
+            if (deadlines) [[unlikely]] {   //jobs due within the window go first, earliest deadline first
+                job = pool_deadlines.pop(trace_time() + m_deadline_window.load(std::memory_order_relaxed));
+            }
+            if (job == nullptr) {
+                job = m_workers[m_thread_index.value]->m_local.pop();       //try get a job from the local queue
+            }
+            if (job == nullptr) {
+                job = m_workers[m_thread_index.value]->m_global.pop();  //try get a job from the global queue
+            }
+            if (job == nullptr && deadlines) {
+                job = pool_deadlines.pop();                         //nothing else to do, run a job that is not due yet
+            }
+            if (job == nullptr) {
+                job = steal_job(next, all);                         //try steal a job from another thread
+            }
+            return job;
+        }
+
+        /**
+        * \brief Steal a job from another thread, following the steal policy.
+        *
+        * The victims in the own L3 domain are tried in every round, starting at a rotating position.
+        * Victims in other L3 domains and on other NUMA nodes are tried only every m_backoff rounds.
+        * The backoff doubles whenever they have nothing, and is reset when a remote steal succeeds.
+        * With steal-half, the thief takes up to half of the victim's jobs into its own queue.
+        *
+        * \param[in,out] next Position where stealing continues.
+        * \param[in] all If true, then try all victims regardless of the backoff.
+        * \returns a job or nullptr.
+        */
+        Job_base* steal_job(uint32_t& next, bool all) noexcept {
+            auto& state = m_workers[m_thread_index.value]->m_steal;
+            auto& own = m_workers[m_thread_index.value]->m_global;
+            uint32_t size = (uint32_t)state.m_victims.size();
+            bool remote = all || state.m_near == size || ++state.m_rounds >= state.m_backoff;
+            if (!remote) StealState::add(state.m_backoffs);
+
+            uint32_t max_more = m_steal_policy.m_steal_half && m_steal_policy.m_max_batch > 0 ? m_steal_policy.m_max_batch - 1 : 0;
+            uint32_t bounds[4] = { 0, state.m_near, state.m_numa, size };
+            ++next;
+            for (uint32_t t = 0; t < 3 && (t == 0 || remote); ++t) {
+                uint32_t begin = bounds[t], num_tier = bounds[t + 1] - bounds[t];
+                for (uint32_t k = 0; k < num_tier; ++k) {
+                    uint32_t victim = state.m_victims[begin + (next + k) % num_tier];
+                    uint32_t num = 0;
+                    StealState::add(state.m_attempts);
+                    Job_base* job = m_workers[victim]->m_global.steal(own, max_more, &num);
+                    if (job != nullptr) {
+                        StealState::add(state.m_successes);
+                        StealState::add(state.m_jobs, num);
+                        if (t > 0) {
+                            StealState::add(state.m_remote);
+                            state.m_backoff = 1;
+                        }
+                        if constexpr (c_enable_metrics) {
+                            m_workers[victim]->m_counters.m_stolen_from.fetch_add(num, std::memory_order_relaxed);
+                        }
+                        trace_event(TraceEventType::job_stolen, job->m_unique_id, victim, num);
+                        if (num > 1) wake_one(m_pool_index);    //there is more work now, let another idle thread steal from us
+                        return job;
+                    }
+                }
+            }
+            if (remote && state.m_near < size) {       //the remote victims had nothing -> try them less often
+                state.m_rounds = 0;
+                state.m_backoff = std::min(state.m_backoff * 2, std::max(m_steal_policy.m_max_backoff, 1u));
+            }
+            return nullptr;
+        }
+
+        /**
+        * \brief Park this worker until there is work for it.
+        *
+        * The worker first registers as idle, then checks all queues once more. A thread pushing a job
+        * first publishes the job and then looks for idle workers, so either the worker sees the job,
+        * or the pusher sees the worker and unparks it.
+        *
+        * If there are timers and no other worker waits for them, then this worker becomes the timer keeper.
+        * It parks only until the earliest timer expires, and then harvests the expired timers.
+        * Adding an earlier timer wakes up the keeper, or any parked worker if there is no keeper.
+        *
+        * \param[in,out] next Position where stealing continues.
+        * \returns a job that was found during the last check, or nullptr after being woken up.
+        */
+        Job_base* park(uint32_t& next) {
+            if (harvest_timers() > 0) return nullptr;           //there is new work
+            m_idle.set(m_thread_index.value);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            Job_base* job = m_terminate ? nullptr : find_job(next, true);   //check all queues, ignore the backoff
+            if (job != nullptr || m_terminate) {
+                if (!m_idle.clear(m_thread_index.value)) {  //somebody else has already claimed this worker
+                    m_workers[m_thread_index.value]->m_parker.park(); //consume the wake up token, returns immediately
+                }
+                return job;
+            }
+            bool keeper = false;
+            if (m_timers.earliest() != c_no_deadline) {
+                int32_t none = -1;
+                keeper = m_timer_keeper.compare_exchange_strong(none, m_thread_index.value);
+            }
+            uint64_t expiry = keeper ? m_timers.earliest() : c_no_deadline;    //read after becoming the keeper
 
-            logger->trace(
-                std::format("Number of threads created: {}, hardware number of threads: {}",
-                    m_thread_count.load(), hardware_threads
-                )
-            );
-            for (uint32_t i = 0; i < m_thread_count; i++) {
-                m_global_queues.push_back(JobQueue<Job_base>());     //global job queue
-                m_local_queues.push_back(JobQueue<Job_base>());     //local job queue
-                m_cv.emplace_back(std::make_unique<std::condition_variable>());
-                m_mutex.emplace_back(std::make_unique<std::mutex>());
+            high_resolution_clock::time_point t0;
+            if constexpr (c_enable_metrics) t0 = high_resolution_clock::now();
+            if (expiry == c_no_deadline) {
+                m_workers[m_thread_index.value]->m_parker.park();
+            }
+            else if (!m_workers[m_thread_index.value]->m_parker.park_until(m_start_time + nanoseconds(expiry))) {  //the timer has expired
+                if (!m_idle.clear(m_thread_index.value)) {      //somebody else has claimed this worker meanwhile
+                    m_workers[m_thread_index.value]->m_parker.park();     //consume the wake up token, returns immediately
+                }
+            }
+            if constexpr (c_enable_metrics) {
+                count(&WorkerCounters::m_parks);
+                count(&WorkerCounters::m_parked_ns, duration_cast<nanoseconds>(high_resolution_clock::now() - t0).count());
             }
 
-            for (uint32_t i = 0; i < m_thread_count; i++) {
-                m_threads.emplace_back(std::thread(&JobSystem::thread_task, this, thread_index_t(i))); //spawn the pool threads
-                // do not bind to threads less then start_idx
-                uint32_t affinity_mask = 1ll << ((i % (hardware_threads - start_idx)) + start_idx); // map thread to [start_idx, hardware_concurrency -1] (affinity starts from 0)
-                SetThreadAffinityMask(m_threads[i].native_handle(), affinity_mask);
-                m_threads[i].detach();
+            if (keeper) {
+                m_timer_keeper.store(-1);
+                harvest_timers();
+                if (m_timers.earliest() != c_no_deadline) wake_one();   //let another parked worker wait for the next timer
             }
+            return nullptr;
+        }
 
-            m_logs.resize(m_thread_count, n_pmr::vector<JobLog>{mr});    //make room for the log files
-        };
+        /**
+        * \brief Schedule the jobs of all expired timers.
+        * \returns the number of scheduled jobs.
+        */
+        uint32_t harvest_timers() noexcept {
+            if (m_timers.earliest() == c_no_deadline) return 0;     //no timers, do not even read the clock
+            thread_local static std::vector<Job_base*> jobs;
+            uint32_t num = m_timers.harvest(trace_time(), jobs);
+            for (Job_base* job : jobs) schedule_job(job);
+            jobs.clear();
+            return num;
+        }
 
+        /**
+        * \brief Schedule the jobs and coros whose timers have not expired yet, but which have been cancelled.
+        * A cancelled job is then skipped and a cancelled coro is stopped right away, instead of at the end of its sleep.
+        * \returns the number of scheduled jobs.
+        */
+        uint32_t release_cancelled_timers() noexcept {
+            if (m_cancellations.load() <= 0) return 0;
+            std::vector<Job_base*> jobs;
+            uint32_t num = m_timers.remove_if([](Job_base* job) { return is_cancelled(job); }, jobs);
+            for (Job_base* job : jobs) schedule_job(job);
+            return num;
+        }
 
         /**
-        * \brief Test whether the job system has been started yet.
-        * \returns true if the instance exists, else false.
+        * \brief Wake up a specific worker if it is parked.
+        * \param[in] index Index of the worker.
         */
-        static bool is_instance_created() noexcept {
-            return m_current_job != nullptr;
-        };
+        void wake(uint32_t index) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);    //the job must be visible before looking at the idle mask
+            if (m_idle.clear(index)) {
+                m_workers[index]->m_parker.unpark();
+            }
+        }
 
-        JobSystem(const JobSystem&) = delete;				// non-copyable,
-        JobSystem& operator=(const JobSystem&) = delete;
-        JobSystem(JobSystem&&) = default;					// but movable
-        JobSystem& operator=(JobSystem&&) = default;
-        ~JobSystem() = default;
+        /**
+        * \brief Wake up exactly one parked worker, if there is one.
+        * \param[in] pool Only wake up a worker of this pool, -1 for any worker.
+        */
+        void wake_one(pool_t pool = pool_t{}) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);    //the job must be visible before looking at the idle mask
+            int32_t index = pool.value < 0 ? m_idle.claim_any() : m_idle.claim_any(m_pools[pool.value].m_first, m_pools[pool.value].m_first + m_pools[pool.value].m_count);
+            if (index >= 0) {
+                m_workers[index]->m_parker.unpark();
+            }
+        }
 
-        void on_finished(Job* job) noexcept;            //called when the job finishes, i.e. all children have finished
+        /**
+        * \brief Wake up parked workers of a pool, one for each new job, as long as there are parked workers.
+        * \param[in] num Number of new jobs.
+        * \param[in] pool The pool of the jobs.
+        */
+        void wake_many(uint32_t num, pool_t pool) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);    //the jobs must be visible before looking at the idle mask
+            for (; num > 0; --num) {
+                int32_t index = m_idle.claim_any(m_pools[pool.value].m_first, m_pools[pool.value].m_first + m_pools[pool.value].m_count);
+                if (index < 0) return;
+                m_workers[index]->m_parker.unpark();
+            }
+        }
 
         /**
-        * \brief Child tells its parent that it has finished.
-        *
-        * A child that finished calls this function for its parent, thus decreasing
-        * the number of left children by one. If the last one finishes (including the
-        * parent itself) then the parent also finishes (and may call its own parent).
-        * Note that a Job is also its own child, so it must have returned from
-        * its function before on_finished() is called. Note that a Job is also its own
-        * child so that the Job can only finish after its function has returned.
+        * \brief Skip a cancelled Job. Its function is not called, the Job finishes right away.
+        * \param[in] job The Job.
         */
-        inline bool child_finished(Job_base* job) noexcept {
-            uint32_t num = job->m_children.fetch_sub(1);        //one less child
-            if (num == 1) {                                     //was it the last child?
+        void skip(Job* job) noexcept {
+            count_skipped();
+            job->m_children = 1;                    //the job is its own child, as in Job::resume()
+            job->m_stage = job->m_stages - 1;       //a chain skips all stages that are left
+        }
 
-                if (job->is_function()) {            //Jobs call always on_finished()
-                    on_finished((Job*)job);     //if yes then finish this job
+        /**
+        * \brief Run a job on this thread and finish it.
+        *
+        * This is used by thread_task() and by threads that help out while waiting for something.
+        * The current job of the thread is restored afterwards.
+        *
+        * \param[in] job The job to run.
+        */
+        void run_job(Job_base* job) noexcept {
+            Job_base* previous = m_current_job;
+
+            while (job != nullptr) {            //the next stage or continuation of a job that just finished runs in the same loop
+                m_current_job = job;
+
+                auto is_function = job->is_function();      //save certain info since a coro might be destroyed
+                auto unique_id = job->m_unique_id;
+                count(&WorkerCounters::m_jobs);
+                if constexpr (c_enable_tracing || c_enable_logging) {
+                    if (is_recording()) {
+                        uint64_t now = trace_time();
+                        uint64_t waited = job->m_trace_time > 0 && now > job->m_trace_time ? now - job->m_trace_time : 0;
+                        job->m_trace_time = 0;
+                        trace_event(TraceEventType::job_started, unique_id, job->m_type.value, waited, job->m_id.value);
+                    }
+                }
+                if (is_function && is_cancelled(job)) [[unlikely]] {
+                    skip((Job*)job);    //the function is not called, but the job finishes as usual
                 }
                 else {
-                    schedule_job(job);   //a coro just gets scheduled again so it can go on
+                    (*job)();   //execute the job - a coro might be destroyed here! A cancelled coro stops right away
+                }
+                trace_event(TraceEventType::job_finished, unique_id);
+
+                if (is_function) {
+                    child_finished((Job*)job);  //a job always finishes itself, a coro will deal with this itself
                 }
+                job = std::exchange(m_next_job, nullptr);
+            }
+            m_current_job = previous;
+        }
+
+        /**
+        * \brief Tell a parent that a child has finished, or leave it for later while a batch runs.
+        *
+        * While a batch runs, consecutive children of the same parent are counted and the parent
+        * is told once, when the batch goes on with a job that is not a sibling, or ends. So the
+        * decrement is only deferred while a sibling runs, and the parent could not finish anyway.
+        *
+        * \param[in] parent The parent of the finished child.
+        */
+        void parent_finished(Job_base* parent) noexcept {
+            if (!m_batching) {
+                child_finished(parent);
+                return;
+            }
+            while (m_deferred_parent != nullptr && m_deferred_parent != parent) {
+                flush_deferred();       //can defer the grandparent, so repeat
+            }
+            m_deferred_parent = parent;
+            ++m_deferred_children;
+        }
+
+        /**
+        * \brief Do the deferred child counter decrement of a batch.
+        */
+        void flush_deferred() noexcept {
+            Job_base* parent = std::exchange(m_deferred_parent, nullptr);
+            uint32_t children = std::exchange(m_deferred_children, 0);
+            if (parent != nullptr) child_finished(parent, children);
+        }
+
+        /**
+        * \brief End a batch and do the deferred decrement.
+        */
+        void end_batch() noexcept {
+            m_batching = false;
+            flush_deferred();
+        }
+
+        /**
+        * \brief Test whether a batch must end because more urgent jobs are waiting.
+        * \param[in] p The priority index of the batch.
+        * \returns true if HIGH jobs wait while a lower priority batch runs, or jobs with a deadline are due.
+        */
+        bool batch_preempted(uint32_t p) noexcept {
+            auto& worker = *m_workers[m_thread_index.value];
+            if (p < c_num_priorities - 1 && (worker.m_local.has_jobs(c_num_priorities - 1) || worker.m_global.has_jobs(c_num_priorities - 1))) {
                 return true;
             }
-            return false;
+            auto& pool_deadlines = m_pools[m_pool_index.value].m_deadlines;
+            uint64_t earliest = pool_deadlines.earliest();
+            return earliest != c_no_deadline && earliest < trace_time() + m_deadline_window.load(std::memory_order_relaxed);
+        }
+
+        /**
+        * \brief Run a job and then more jobs of the same priority from the own queues, following the batch policy.
+        *
+        * The jobs are popped one by one, so the jobs that are left can still be stolen by other workers.
+        * Is only called by workers from thread_task(), not from run_until(), and waiting inside a
+        * job ends the batch.
+        *
+        * \param[in] job The first job.
+        * \returns the number of jobs that have been run.
+        */
+        uint32_t run_batch(Job_base* job) noexcept {
+            uint32_t p = priority_index(job->m_job_priority);
+            uint32_t max_jobs = m_batch_policy.m_max_jobs[p];
+            if (max_jobs <= 1) {
+                run_job(job);
+                return 1;
+            }
+            auto& worker = *m_workers[m_thread_index.value];
+            auto start = high_resolution_clock::now();
+            uint32_t num = 1;
+            m_batching = true;
+            run_job(job);
+            while (num < max_jobs && !m_terminate && high_resolution_clock::now() - start < m_batch_policy.m_max_time && !batch_preempted(p)) {
+                job = worker.m_local.pop_priority(p);
+                if (job == nullptr) job = worker.m_global.pop_priority(p);
+                if (job == nullptr) break;
+                while (m_deferred_parent != nullptr && job->m_parent != m_deferred_parent) {
+                    flush_deferred();   //not a sibling, and a finished parent can defer the grandparent
+                }
+                ++num;
+                m_batching = true;      //a job that waited has ended the batch
+                run_job(job);
+            }
+            end_batch();
+            count(&WorkerCounters::m_batched, num - 1);
+            return num;
+        }
+
+        /**
+        * \brief Run the next stage of a chain or a continuation on this thread.
+        *
+        * If the finished job is the current job, i.e. it has just returned from its function
+        * without waiting for children, then the next job runs right after it in run_job().
+        * Otherwise it goes into the local queue of this thread. Jobs pinned to other threads, jobs of
+        * other pools, and jobs finished by threads outside the pools are scheduled as usual.
+        *
+        * \param[in] finished The job that has finished.
+        * \param[in] next The job to run next.
+        */
+        void schedule_next(Job_base* finished, Job_base* next) noexcept {
+            bool worker = m_thread_index.value >= 0 && m_thread_index.value < (int)m_thread_count;
+            bool pinned = next->m_thread_index.value >= 0 && next->m_thread_index != m_thread_index;
+            if (!worker || pinned || (int)resolve_pool(next) != m_pool_index.value) {
+                schedule_job(next);
+                return;
+            }
+            trace_scheduled(next, m_thread_index.value);
+            if (finished == m_current_job && m_next_job == nullptr) {
+                m_next_job = next;          //no queue round trip
+            }
+            else {
+                m_workers[m_thread_index.value]->m_local.push_owner(next);
+            }
+        }
+
+        /**
+        * \brief Continue with another coro on this thread, without going through a queue.
+        *
+        * This is used when the last child of a coro has finished or yielded and the parent can
+        * go on, and when a child is awaited eagerly. On a worker thread, the coro becomes the current
+        * job and the caller resumes it right away by symmetric transfer. Coros pinned to other
+        * threads or belonging to other pools, and callers running outside the pools, schedule the coro as usual.
+        *
+        * \param[in] coro The coro to continue with.
+        * \returns true if the caller must resume the coro, false if it has been scheduled.
+        */
+        bool transfer(Job_base* coro) noexcept {
+            bool worker = m_thread_index.value >= 0 && m_thread_index.value < (int)m_thread_count;
+            bool pinned = coro->m_thread_index.value >= 0 && coro->m_thread_index != m_thread_index;
+            if (!worker || pinned || m_current_job == nullptr || (int)resolve_pool(coro) != m_pool_index.value) {
+                schedule_job(coro);
+                return false;
+            }
+            count(&WorkerCounters::m_jobs);
+            if constexpr (c_enable_tracing || c_enable_logging) {
+                if (is_recording()) {
+                    if (coro->m_unique_id == 0) {
+                        trace_scheduled(coro, m_thread_index.value);        //give an eager child its id
+                    }
+                    trace_event(TraceEventType::job_finished, m_current_job->m_unique_id);    //the current job ends here, run_job() ends the last one
+                    trace_event(TraceEventType::job_started, coro->m_unique_id, coro->m_type.value, 0, coro->m_id.value);
+                }
+            }
+            m_current_job = coro;
+            return true;
+        }
+
+        /**
+        * \brief Run other jobs on this thread until a condition is met, or the job system terminates.
+        *
+        * A worker thread does not block, but runs jobs from its queues or steals them.
+        * Any other thread, e.g. the main thread or a render thread, steals jobs from the global
+        * queues of the workers of the default pool, so it does useful work while it waits. Jobs pinned
+        * to a worker are only run by this worker.
+        *
+        * \param[in] done The condition, it is called repeatedly.
+        */
+        template<typename P>
+        void run_until(P&& done) noexcept {
+            bool worker = m_thread_index.value >= 0 && m_thread_index.value < (int)m_thread_count;
+            uint32_t next = worker ? m_thread_index.value : (uint32_t)rand();
+            if (m_batching) end_batch();    //what we wait for might depend on the deferred decrements
+            while (!done() && !m_terminate) {
+                Job_base* job = worker ? find_job(next) : steal_external(next);
+                if (job != nullptr) run_job(job);
+                else std::this_thread::yield();
+            }
+        }
+
+        /**
+        * \brief Run jobs on this thread until a job and all its children have finished.
+        * \param[in] handle The handle of the job, returns immediately if it is not waitable.
+        */
+        void wait(const JobHandle& handle) noexcept {
+            run_until([&]() { return !handle.is_waitable() || handle.is_done(); });
+        }
+
+        /**
+        * \brief Steal a job for a thread that is not a worker, trying the global queues of the default pool one after the other.
+        * The other pools are left alone, so their jobs only run on their own workers.
+        * \param[in,out] next Position where stealing continues.
+        * \returns a job or nullptr.
+        */
+        Job_base* steal_external(uint32_t& next) noexcept {
+            uint32_t size = m_pools.empty() ? 0 : m_pools[0].m_count;
+            for (uint32_t k = 0; k < size; ++k) {
+                uint32_t victim = ++next % size;
+                Job_base* job = m_workers[victim]->m_global.steal_one();
+                if (job != nullptr) {
+                    trace_event(TraceEventType::job_stolen, job->m_unique_id, victim, 1);
+                    return job;
+                }
+            }
+            return nullptr;
+        }
+
+        /**
+        * \brief Test whether the global queue of this thread is empty, i.e. there is nothing left to steal from it.
+        * \returns true if the queue is empty or this is not a worker thread.
+        */
+        bool own_queue_empty() noexcept {
+            if (m_thread_index.value < 0 || m_thread_index.value >= (int)m_thread_count) return true;
+            return m_workers[m_thread_index.value]->m_global.size() == 0;
         }
 
         /**
@@ -593,168 +3042,425 @@ namespace vgjs {
             constexpr uint32_t NOOP = 1<<8;                                   //number of empty loops until garbage collection
             thread_local static uint32_t noop_counter = 0;
             m_thread_index = threadIndex;	                                //Remember your own thread index number
+            m_pool_index = pool_t(pool_of(threadIndex.value));              //and your pool
             static std::atomic<uint32_t> thread_counter = m_thread_count.load();	//Counted down when started
 
-            m_global_queues[m_thread_index.value].setThreadNumber(threadIndex);
-            m_local_queues[m_thread_index.value].setThreadNumber(threadIndex);
+            m_workers[m_thread_index.value]->m_global.setThreadNumber(threadIndex);
+            m_workers[m_thread_index.value]->m_local.setThreadNumber(threadIndex);
 
+#if defined(_WIN32)
             HRESULT coinited = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
             if (coinited == S_FALSE) {
                 logger->error(std::format("Thread {} can't use COM library functions", m_thread_index.value));
             }
+#endif
 
             thread_counter--;			                                    //count down
             while (thread_counter.load() > 0) {}	                        //Continue only if all threads are running
 
             uint32_t next = rand() % m_thread_count;                        //initialize at random position for stealing
             auto start = high_resolution_clock::now();
+            uint32_t busy = 0;                                              //jobs run since start, 0 if idle
+            uint32_t timer_check = 0;                                       //loops since looking for expired timers
 
-            std::unique_lock<std::mutex> lk(*m_mutex[m_thread_index.value]);
+            auto add_busy = [&]() {                                         //add the busy time since start
+                auto now = high_resolution_clock::now();
+                count(&WorkerCounters::m_busy_ns, duration_cast<nanoseconds>(now - start).count());
+                start = now;
+            };
 
             while (!m_terminate) {			                                //Run until the job system is terminated
-                m_current_job = m_local_queues[m_thread_index.value].pop();       //try get a job from the local queue
-                if (m_current_job == nullptr) {
-                    m_current_job = m_global_queues[m_thread_index.value].pop();  //try get a job from the global queue
-                }
-                int num_try = m_thread_count - 1;
-                while (m_current_job == nullptr && --num_try >0) {                             //try steal job from another thread
-                    if (++next >= m_thread_count) next = 0;
-                    m_current_job = m_global_queues[next].pop();
+                if (++timer_check >= c_timer_check) {                       //workers harvest timers while they are busy too
+                    harvest_timers();
+                    timer_check = 0;
                 }
-
-                if (m_current_job != nullptr) {
-                    std::chrono::high_resolution_clock::time_point t1, t2;	///< execution start and end
-                    thread_type_t type;
-                    thread_id_t id;
-
-                    if constexpr (c_enable_logging) {
-                        if (is_logging()) {
-                            t1 = std::chrono::high_resolution_clock::now();	//time of finishing;
-                        }
-                        type = m_current_job->m_type;
-                        id = m_current_job->m_id;
-                    }
-                    auto is_function = m_current_job->is_function();      //save certain info since a coro might be destroyed
-                    logger->trace(std::format("Starting job with id {} on thread {}", m_current_job->m_unique_id, m_thread_index.value));
-                    (*m_current_job)();   //if any job found execute it - a coro might be destroyed here!
-                    logger->trace(std::format("Job with id {} finished on thread {}", m_current_job->m_unique_id, m_thread_index.value));
-
-                    {
-                        std::lock_guard lg{ m_current_job->m_mutex };
-                        m_current_job->m_unique_id = 0;
-                    }
-                    m_current_job->m_cv.notify_one();
-
-                    if constexpr (c_enable_logging) {
-                        if (is_logging()) {
-                            t2 = std::chrono::high_resolution_clock::now();	//time of finishing
-                            log_data(t1, t2, m_thread_index, false, type, id);
-                        }
+                Job_base* job = find_job(next);
+                if constexpr (c_enable_metrics) {
+                    if (job == nullptr && busy > 0) {                       //only measure at the transitions between busy and idle
+                        add_busy();
+                        busy = 0;
                     }
+                }
+                if (job == nullptr && ++noop_counter > NOOP) [[unlikely]] {   //if none found too long let thread sleep
+                    job = park(next);
+                    noop_counter = 0;
+                }
 
-                    if (is_function) {
-                        child_finished((Job*)m_current_job);  //a job always finishes itself, a coro will deal with this itself
+                if (job != nullptr) {
+                    if constexpr (c_enable_metrics) {
+                        if (busy == 0) start = high_resolution_clock::now();
+                        else if (busy % c_busy_flush == 0) add_busy();      //so snapshots see long busy periods
+                        ++busy;
                     }
+                    run_batch(job);
                     noop_counter = 0;
                 }
-                else if (++noop_counter > NOOP) [[unlikely]] {   //if none found too longs let thread sleep
-                    m_delete.clear();       //delete jobs to reclaim memory
-                    m_cv[m_thread_index.value]->wait_for(lk, std::chrono::microseconds(100));
-                    noop_counter = noop_counter / 2;
-                }
             };
+            if constexpr (c_enable_metrics) {
+                if (busy > 0) add_busy();
+            }
 
+#if defined(_WIN32)
             if (coinited == S_OK) {
                 CoUninitialize();
             }
+#endif
+
+           //std::cout << "Thread " << m_thread_index.value << " left " << m_thread_count.load() << "\n";
+
+           m_workers[m_thread_index.value]->m_global.clear(); //clear your global queue
+           m_workers[m_thread_index.value]->m_local.clear();  //clear your local queue
+
+           uint32_t num = m_thread_count.fetch_sub(1);  //last thread clears recycle and garbage queues
+
+           clear_completions();
+
+           if (num == 1) {
+               if constexpr (c_enable_logging) {
+                   disable_logging();       //stop the log writer and export the log file
+               }
+               if constexpr (c_enable_tracing) {
+                   flush_trace();
+               }
+               for (auto& pool : m_pools) pool.m_deadlines.clear();     //deadline jobs that never ran
+               m_timers.clear();            //timers that never expired
+               //std::cout << "Last thread " << m_thread_index << " terminated\n";
+               m_terminated = true;
+               m_terminated.notify_all();
+           }
+        };
+
+        /**
+        * \brief Give a finished Job back to its memory resource.
+        *
+        * With the default slab resource, the memory goes back to the free list of the thread
+        * that allocated it, even if the Job finished on another thread.
+        *
+        * \param[in] job Pointer to the finished Job.
+        */
+        void recycle(Job* job) noexcept {
+            count(&WorkerCounters::m_freed);
+            uint64_t epoch = job->m_epoch;
+            job_deallocator{}.deallocate(job);
+            if (epoch != 0) EpochResource::instance(epoch % c_num_epochs).job_freed();     //after the memory was freed, see begin_epoch()
+        }
+
+        /**
+        * \brief Get a completion object with two owners, the job and its handle.
+        * \returns a pointer to the completion.
+        */
+        JobCompletion* allocate_completion() {
+            JobCompletion* completion = m_completions.pop();    //try recycle queue
+            if (completion == nullptr) {
+                completion = new JobCompletion();
+                count(&WorkerCounters::m_completion_misses);
+            }
+            else {
+                count(&WorkerCounters::m_completion_hits);
+            }
+            completion->m_done.store(0, std::memory_order_relaxed);
+            completion->m_refs.store(2, std::memory_order_relaxed);
+            return completion;
+        }
+
+        /**
+        * \brief Drop one owner of a completion. The last owner puts it into the recycle queue of its thread.
+        * \param[in] completion Pointer to the completion.
+        */
+        void release_completion(JobCompletion* completion) noexcept {
+            if (!completion->release()) return;
+            if (m_completions.size() <= c_queue_capacity) {
+                m_completions.push(completion);
+            }
+            else {
+                delete completion;
+            }
+        }
+
+        /**
+        * \brief Delete all recycled completions of this thread.
+        */
+        void clear_completions() noexcept {
+            JobCompletion* completion = m_completions.pop();
+            while (completion != nullptr) {
+                delete completion;
+                completion = m_completions.pop();
+            }
+        }
+
+        /**
+        * \brief Terminate the job system.
+        */
+        void terminate() noexcept {
+            m_terminate = true;
+            for (uint32_t i = 0; i < m_workers.size(); ++i) {   //wake up all parked workers so they can exit
+                m_idle.clear(i);
+                m_workers[i]->m_parker.unpark();
+            }
+        }
+
+        /**
+        * \brief Wait for termination of all jobs.
+        *
+        * Can be called by the main thread to wait for all threads to terminate.
+        * Blocks without polling and returns as soon as the last thread has exited.
+        */
+        void wait_for_termination() noexcept {
+            while (m_terminated.load() == false) {
+                m_terminated.wait(false);
+            }
+        };
+
+        /**
+        * \brief Get a pointer to the current job.
+        * \returns a pointer to the current job.
+        */
+        static Job_base* current_job() noexcept {
+            return m_current_job;
+        }
+
+        /**
+        * \brief Get the thread index the current job is running on.
+        * \returns the index of the thread the current job is running on, or -1.
+        */
+        thread_index_t get_thread_index() {
+            return m_thread_index;
+        }
+
+        /**
+        * \brief Get the number of threads in the system.
+        * \returns the number of threads in the system.
+        */
+        thread_count_t get_thread_count() const {
+            return thread_count_t( m_thread_count.load() );
+        }
+
+        /**
+        * \brief Get the pool of the calling thread.
+        * \returns the pool of the calling worker, or -1 for threads outside the pools.
+        */
+        pool_t get_pool() const noexcept {
+            return m_pool_index;
+        }
+
+        /**
+        * \brief Get the number of pools, including the default pool 0.
+        * \returns the number of pools.
+        */
+        uint32_t get_pool_count() const noexcept {
+            return (uint32_t)m_pools.size();
+        }
+
+        /**
+        * \brief Get the number of threads in a pool.
+        * \param[in] pool The pool.
+        * \returns the number of threads in the pool, 0 if there is no such pool.
+        */
+        thread_count_t get_thread_count(pool_t pool) const noexcept {
+            if (pool.value < 0 || pool.value >= (int)m_pools.size()) return thread_count_t{ 0 };
+            return thread_count_t( (int)m_pools[pool.value].m_count );
+        }
 
-           //std::cout << "Thread " << m_thread_index.value << " left " << m_thread_count.load() << "\n";
+        /**
+        * \brief Set the pool that the calling thread schedules new Jobs and Coros into, see schedule_on().
+        * \param[in] pool The pool, -1 for the pool of the caller.
+        * \returns the previous pool.
+        */
+        static pool_t exchange_schedule_pool(pool_t pool) noexcept {
+            return std::exchange(m_schedule_pool, pool);
+        }
 
-           m_global_queues[m_thread_index.value].clear(); //clear your global queue
-           m_local_queues[m_thread_index.value].clear();  //clear your local queue
+        /**
+        * \brief Get the CPU a thread has been placed on, with its core, L3 domain and NUMA node.
+        * \param[in] index The thread, by default the thread calling this function.
+        * \returns the CPU of the thread. Threads outside the pool get the first CPU.
+        */
+        const CpuInfo& get_cpu(thread_index_t index = thread_index_t{}) const {
+            if (index.value < 0) index = m_thread_index;
+            if (index.value < 0 || index.value >= (int)m_workers.size()) return topology().m_cpus.front();
+            return m_workers[index.value]->m_cpu;
+        }
 
-           uint32_t num = m_thread_count.fetch_sub(1);  //last thread clears recycle and garbage queues
+        /**
+        * \brief Set the steal policy. Must be called before the job system is created.
+        * \param[in] policy The new steal policy.
+        */
+        static void set_steal_policy(const StealPolicy& policy) noexcept {
+            m_steal_policy = policy;
+        }
 
-           m_recycle.clear();
-           m_delete.clear();
+        /**
+        * \brief Set the batch policy. Must be called before the job system is created.
+        * \param[in] policy The new batch policy.
+        */
+        static void set_batch_policy(const BatchPolicy& policy) noexcept {
+            m_batch_policy = policy;
+        }
 
-           if (num == 1) {
-               if constexpr (c_enable_logging) {
-                   if (m_logging) {         //dump trace file
-                       save_log_file();
-                   }
-               }
-               //std::cout << "Last thread " << m_thread_index << " terminated\n";
-               m_terminated = true;
-           }
-        };
+        /**
+        * \brief Get the steal counters of a thread, or of all threads.
+        * \param[in] index The thread, or -1 for the sum over all threads.
+        * \returns the steal counters.
+        */
+        StealStats get_steal_stats(thread_index_t index = thread_index_t{}) const noexcept {
+            StealStats stats;
+            for (uint32_t i = 0; i < m_workers.size(); ++i) {
+                if (index.value < 0 || index.value == (int)i) stats += m_workers[i]->m_steal.stats();
+            }
+            return stats;
+        }
 
         /**
-        * \brief An old Job can be recycled.
+        * \brief Take a snapshot of the counters of all workers, together with their queue depths.
         *
-        * There is one recycle queue that can store old Jobs.
-        * If it is full then put the Job to the delete queue.
+        * The workers keep running, so the numbers of different workers can be from slightly
+        * different points in time. Reading the counters does not write to any shared cache line.
         *
-        * \param[in] job Pointer to the finished Job.
+        * \param[in] pool Only the workers of this pool, or -1 for all workers and the threads outside the pools.
+        * \returns the metrics of each worker and their sum.
         */
-        void recycle(Job* job) noexcept {
-            if (m_recycle.size() <= c_queue_capacity) {
-                m_recycle.push(job);        //save it so it can be reused later
+        SchedulerMetrics snapshot_metrics(pool_t pool = pool_t{}) noexcept {
+            SchedulerMetrics snapshot;
+            snapshot.m_time_ns = trace_time();
+            uint32_t first = 0, size = (uint32_t)m_workers.size() + 1;     //the last one for the threads outside the pools
+            if (pool.value >= 0 && pool.value < (int)m_pools.size()) {
+                first = m_pools[pool.value].m_first;
+                size = m_pools[pool.value].m_count;
             }
-            else {
-                m_delete.push(job);   //push to delete queue
+            snapshot.m_workers.resize(size);
+            for (uint32_t i = first; i < first + size; ++i) {
+                auto& m = snapshot.m_workers[i - first];
+                if (i < m_workers.size()) {
+                    auto& worker = *m_workers[i];
+                    m = worker.m_counters.metrics();
+                    m.m_steal = worker.m_steal.stats();
+                    m.m_queued = worker.m_global.size() + worker.m_local.size();
+                    m.m_idle = m_idle.test(i) ? 1 : 0;
+                }
+                else {
+                    m = m_outside_counters.metrics();
+                }
+                snapshot.m_total += m;
             }
+            snapshot.m_slab = slab_stats();
+            return snapshot;
         }
 
         /**
-        * \brief Terminate the job system.
+        * \brief Set the deadline window. A job whose deadline is less than the window away runs before all jobs
+        * without a deadline. Other jobs with a deadline run when a worker finds nothing else to do in its own queues.
+        * A large window favors the deadlines, a small one the throughput.
+        * \param[in] window The deadline window.
         */
-        void terminate() noexcept {
-            m_terminate = true;
+        void set_deadline_window(std::chrono::nanoseconds window) noexcept {
+            m_deadline_window.store((uint64_t)std::max<int64_t>(window.count(), 0), std::memory_order_relaxed);
         }
 
         /**
-        * \brief Wait for termination of all jobs.
-        *
-        * Can be called by the main thread to wait for all threads to terminate.
-        * Returns as soon as all threads have exited.
+        * \brief Turn a time span into a deadline for a job.
+        * \param[in] span The job should finish within this time from now.
+        * \returns the deadline in ns since the job system was started, or 0 if the span is not positive.
         */
-        void wait_for_termination() noexcept {
-            while (m_terminated.load() == false) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            }
-        };
+        uint64_t deadline_after(std::chrono::nanoseconds span) noexcept {
+            return span.count() > 0 ? trace_time() + span.count() : 0;
+        }
 
         /**
-        * \brief Get a pointer to the current job.
-        * \returns a pointer to the current job.
+        * \brief Count a job with a deadline that has finished, and whether it was late.
+        * \param[in] job The job.
         */
-        static Job_base* current_job() noexcept {
-            return m_current_job;
+        void deadline_finished(Job_base* job) noexcept {
+            count(&WorkerCounters::m_deadline_jobs);
+            if (trace_time() > job->m_deadline) count(&WorkerCounters::m_deadline_misses);
         }
 
         /**
-        * \brief Get the thread index the current job is running on.
-        * \returns the index of the thread the current job is running on, or -1.
+        * \brief Test whether a job or coro has been cancelled, i.e. it or one of its ancestors.
+        *
+        * As long as nothing is cancelled, this is a single load. Otherwise the parents are followed up to the root,
+        * they live at least as long as their descendants.
+        *
+        * \param[in] job The job.
+        * \returns true if the job has been cancelled.
         */
-        thread_index_t get_thread_index() {
-            return m_thread_index;
+        static bool is_cancelled(Job_base* job) noexcept {
+            if (m_cancellations.load(std::memory_order_relaxed) <= 0) [[likely]] return false;
+            for (; job != nullptr; job = job->m_parent) {
+                if (job->m_cancelled.load(std::memory_order_relaxed)) return true;
+                if (job->m_completion != nullptr && job->m_completion->is_cancelled()) return true;
+            }
+            return false;
         }
 
         /**
-        * \brief Get the number of threads in the system.
-        * \returns the number of threads in the system.
+        * \brief Count the cancelled jobs and coros that have not finished yet.
+        * \param[in] num 1 if a job has been cancelled, -1 if a cancelled job has finished.
         */
-        thread_count_t get_thread_count() const {
-            return thread_count_t( m_thread_count.load() );
+        static void count_cancellation(int32_t num) noexcept {
+            m_cancellations.fetch_add(num);
+        }
+
+        /**
+        * \brief Count a job or coro that was skipped because it had been cancelled.
+        */
+        void count_skipped() noexcept {
+            count(&WorkerCounters::m_cancelled);
         }
 
         /**
         * \brief Get the memory resource used for allocating job structures.
-        * \returns the memory resource used for allocating job structures.
+        * \returns the memory resource used for allocating job structures, the arena of the caller's epoch if there is one,
+        * else the memory resource of the pool the caller schedules into.
         */
         n_pmr::memory_resource* memory_resource() {
-            return m_mr;
+            uint64_t epoch = caller_epoch();
+            return epoch != 0 ? &EpochResource::instance(epoch % c_num_epochs) : pool_resource();
+        }
+
+        /**
+        * \brief Start a new epoch, e.g. a frame, and end the current one.
+        *
+        * From now on, the caller and all Jobs and Coros it starts, as well as their children, allocate from
+        * the per-thread arenas of the new epoch. The memory of an epoch is released at once, when its slot
+        * is used again c_num_epochs epochs later. Before that, all its memory must have been freed, so this
+        * function first runs jobs until this is the case. If there is still memory allocated although all
+        * Jobs and Coros of the old epoch are gone, then the memory has escaped the epoch and would never be
+        * freed, so an exception is thrown instead of waiting forever. The caller and its ancestors must not belong to the old epoch of the slot,
+        * since they could never finish while the caller waits, so then an exception is thrown as well.
+        *
+        * \returns the number of the new epoch.
+        */
+        uint64_t begin_epoch() {
+            uint64_t epoch = m_epoch_counter.fetch_add(1) + 1;
+            EpochResource& resource = EpochResource::instance(epoch % c_num_epochs);
+            for (Job_base* job = m_current_job; job != nullptr; job = job->m_parent) {
+                if (job->m_epoch != 0 && job->m_epoch % c_num_epochs == epoch % c_num_epochs) {
+                    logger->error(std::format("Epoch {} cannot be started by a job of epoch {}, which uses the same slot", epoch, job->m_epoch));
+                    throw RTE::JobException("Epoch started from a job of the epoch it replaces");
+                }
+            }
+            bool escaped = false;
+            run_until([&]() {
+                if (resource.live() == 0) return true;
+                escaped = resource.jobs() == 0 && resource.live() > 0;      //jobs count down after freeing their memory
+                return escaped;
+            });
+            if (escaped) {
+                logger->error(std::format("Memory of epoch {} is still allocated after all its jobs have finished", resource.epoch()));
+                throw RTE::JobException("Memory escaped from an epoch");
+            }
+            resource.open(epoch);
+            m_epoch_opener.store(m_current_job, std::memory_order_relaxed);
+            t_epoch_opened = epoch;
+            m_epoch.store(epoch, std::memory_order_release);
+            return epoch;
+        }
+
+        /**
+        * \brief End the current epoch without starting a new one. Its memory is released when its slot is used again.
+        */
+        void end_epoch() noexcept {
+            m_epoch.store(0, std::memory_order_release);
         }
 
         /**
@@ -764,62 +3470,207 @@ namespace vgjs {
         * \param[in] job A pointer to the job to schedule.
         */
         uint32_t schedule_job(Job_base* job, tag_t tg = tag_t{}) noexcept {
-            thread_local static thread_index_t thread_index(rand() % m_thread_count);
+            thread_local static uint32_t round_robin = rand();
 
             assert(job!=nullptr);
+            pool_t pool{ (int)resolve_pool(job) };   //a tagged job keeps the pool of the thread that tagged it
 
             if ( tg.value >= 0 ) {                  //tagged scheduling
-                if(!m_tag_queues.contains(tg)) {
-                    m_tag_queues[tg] = std::make_unique<JobQueue<Job_base>>();
-                }
-                m_tag_queues.at(tg)->push(job); //save for later
+                tag_stack(tg).push(job);            //save for later
                 return 0;
             }
 
             if (job->m_thread_index.value < 0 || job->m_thread_index.value >= (int)m_thread_count ) {
-                thread_index.value = (++thread_index.value) >= (decltype(thread_index.value))m_thread_count ? 0 : thread_index.value;
-                m_global_queues[thread_index].push(job);
-                //m_cv[thread_index.value]->notify_one();       //wake up the thread
-                m_cv[0]->notify_all();       //wake up the thread
+                auto& jp = m_pools[pool.value];
+                if (job->m_deadline > 0) {              //earliest deadline first, taken by any worker of the pool
+                    trace_scheduled(job, m_thread_index.value);
+                    jp.m_deadlines.push(job);
+                    wake_one(pool);
+                    return 1;
+                }
+                if (m_pool_index == pool) {
+                    trace_scheduled(job, m_thread_index.value);             //before the push, another thread may run the job right away
+                    m_workers[m_thread_index.value]->m_global.push_owner(job);  //a worker pushes into its own deque, other workers can steal it
+                    wake_one(pool);             //let a parked worker steal it
+                    return 1;
+                }
+                uint32_t target = jp.m_first + ++round_robin % jp.m_count;
+                trace_scheduled(job, target);
+                m_workers[target]->m_global.push(job);
+                wake_one(pool);             //the target thread or any other of the pool can take it
                 return 1;
             }
 
-            m_local_queues[job->m_thread_index.value].push(job); //to a specific thread
-            //m_cv[job->m_thread_index]->notify_one();
-            m_cv[0]->notify_all();       //wake up the thread
+            uint32_t target = job->m_thread_index.value;
+            trace_scheduled(job, target);
+            if (job->m_thread_index == m_thread_index) {
+                m_workers[target]->m_local.push_owner(job); //to this thread
+            }
+            else {
+                m_workers[target]->m_local.push(job); //to a specific thread
+            }
+            wake(target);    //only the target thread can run it
             return 1;
         };
 
+        /**
+        * \brief Schedule a job into the global queue of a given thread, where other threads can still steal it.
+        *
+        * The thread is woken up if it is parked, else any parked thread of the pool. A thread outside the
+        * pool of the job is replaced by one inside it.
+        *
+        * \param[in] job A pointer to the job to schedule.
+        * \param[in] target The preferred thread, e.g. the placement hint of a TaskGraph node.
+        */
+        uint32_t schedule_hint(Job_base* job, uint32_t target) noexcept {
+            pool_t pool{ (int)resolve_pool(job) };
+            auto& jp = m_pools[pool.value];
+            if (!jp.contains(target)) target = jp.m_first + target % jp.m_count;    //stay inside the pool of the job
+            trace_scheduled(job, target);
+            if ((int)target == m_thread_index.value) {
+                m_workers[target]->m_global.push_owner(job);
+            }
+            else {
+                m_workers[target]->m_global.push(job);
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);    //the job must be visible before looking at the idle mask
+            if (m_idle.clear(target)) {
+                m_workers[target]->m_parker.unpark();
+            }
+            else {
+                wake_one(pool);
+            }
+            return 1;
+        }
+
+        /**
+        * \brief Schedule a job when a timer expires.
+        *
+        * If this is the earliest timer now, then the timer keeper is woken up so it can wait for
+        * the new time, or any parked worker if there is no keeper yet.
+        *
+        * \param[in] job A pointer to the job to schedule.
+        * \param[in] expiry The time in ns since the job system was started, see trace_time().
+        */
+        void add_timer(Job_base* job, uint64_t expiry) noexcept {
+            resolve_pool(job);          //any worker may harvest the timer, the job stays in the pool of the caller
+            bool earliest = m_timers.add(job, expiry);
+            release_cancelled_timers(); //the job might have been cancelled before its timer was added
+            if (!earliest) return;
+            int32_t keeper = m_timer_keeper.load();
+            if (keeper >= 0) wake(keeper);
+            else wake_one();
+        }
+
+        /**
+        * \brief Schedule a function after a delay. Until then no thread is busy with it.
+        * \param[in] delay The time to wait.
+        * \param[in] function The function, it is copied into the scheduled job.
+        * \param[in] parent The parent of this Job, it finishes only after the delayed Job has finished.
+        */
+        template<typename F>
+        requires FUNCTOR<F>
+        void schedule_after(std::chrono::nanoseconds delay, F&& function, Job_base* parent = m_current_job) noexcept {
+            Job* job = allocate_job(std::forward<F>(function));
+            job->m_parent = parent;
+            if (parent != nullptr) parent->m_children.fetch_add(1);
+            add_timer(job, trace_time() + std::max(delay.count(), (int64_t)0));
+        }
+
+        /**
+        * \brief Schedule a function at a point in time. Until then no thread is busy with it.
+        * \param[in] time The point in time, of any clock.
+        * \param[in] function The function, it is copied into the scheduled job.
+        * \param[in] parent The parent of this Job, it finishes only after the delayed Job has finished.
+        */
+        template<typename C, typename D, typename F>
+        requires FUNCTOR<F>
+        void schedule_at(std::chrono::time_point<C, D> time, F&& function, Job_base* parent = m_current_job) noexcept {
+            schedule_after(duration_cast<nanoseconds>(time - C::now()), std::forward<F>(function), parent);
+        }
+
+
+        /**
+        * \brief Get the stack holding the jobs of a tag.
+        *
+        * Tags below c_num_tag_slots have a fixed slot, so no lock is needed. Larger tags are
+        * looked up in a map under a lock, but pushing into the stack is lock-free in both cases.
+        *
+        * \param[in] tg The tag.
+        * \returns a reference to the stack, it stays valid.
+        */
+        JobStack<Job_base>& tag_stack(tag_t tg) noexcept {
+            if (tg.value < c_num_tag_slots) [[likely]] {
+                return m_tag_stacks[tg.value];
+            }
+            std::lock_guard<std::mutex> lock(m_tag_mutex);
+            return m_tag_overflow[tg];
+        }
 
         /**
         * \brief Schedule all Jobs from a tag
+        *
+        * The whole tag list is taken at once. Jobs that are not pinned to a thread and belong to the pool
+        * of the caller are spliced into a global queue with one atomic operation per priority.
+        *
         * \param[in] tg The tag that is scheduled
         * \param[in] parent The parent of this Job.
         * \param[in] children Number used to increase the number of children of the parent.
         * \returns the number of scheduled jobs.
         */
         uint32_t schedule_tag( tag_t& tg, tag_t tg2 = tag_t{}, Job_base* parent = m_current_job, int32_t children = -1) noexcept {
-            if (!m_tag_queues.contains(tg)) return 0;
-
-            JobQueue<Job_base>* queue = m_tag_queues[tg].get();   //get the queue for this tag
-            uint32_t num_jobs = queue->size();
+            Job_base* list = tag_stack(tg).take_all();     //newest job first
+            if (list == nullptr) return 0;
+
+            std::array<Job_base*, c_num_priorities> first{}, last{};    //unpinned jobs, one list per priority
+            std::array<int32_t, c_num_priorities> num{};
+            Job_base* pinned = nullptr;                     //jobs that must run on a specific thread, in another pool, or have a deadline
+            uint32_t num_jobs = 0;
+            pool_t pool = m_pool_index.value >= 0 ? m_pool_index : pool_t{ 0 };     //the pool of the target queue
+            auto& jp = m_pools[pool.value];
+            while (list != nullptr) {
+                Job_base* job = list;
+                list = (Job_base*)list->m_next;
+                job->m_parent = parent;
+                ++num_jobs;
+                if ((job->m_thread_index.value >= 0 && job->m_thread_index.value < (int)m_thread_count) || job->m_pool != pool || job->m_deadline > 0) {
+                    job->m_next = pinned;
+                    pinned = job;
+                    continue;
+                }
+                auto p = priority_index(job->m_job_priority);
+                job->m_next = nullptr;
+                if (first[p] == nullptr) first[p] = job;
+                else last[p]->m_next = job;
+                last[p] = job;
+                ++num[p];
+            }
 
             if (parent != nullptr) {
-                if (children < 0) children = num_jobs;     //if the number of children is not given, then use queue size
+                if (children < 0) children = num_jobs;     //if the number of children is not given, then use the number of jobs
                 parent->m_children.fetch_add((int)children);    //add this number to the number of children of parent
             }
 
-            uint32_t num = num_jobs;        //schedule at most num_jobs, since someone could add more jobs now
-            int i = 0;
-            while ( num>0 ) {     //schedule all jobs from the tag queue
-                Job_base* job = queue->pop();
-                if (!job) return i;
-                job->m_parent = parent;
+            uint32_t target = m_pool_index.value >= 0 ? m_thread_index.value : jp.m_first + rand() % jp.m_count;
+            uint32_t num_unpinned = 0;
+            for (uint32_t p = 0; p < c_num_priorities; ++p) {
+                if (first[p] == nullptr) continue;
+                if constexpr (c_enable_tracing || c_enable_logging) {
+                    for (Job_base* job = first[p]; job != nullptr; job = (Job_base*)job->m_next) {
+                        trace_scheduled(job, target);
+                    }
+                }
+                m_workers[target]->m_global.push_list(first[p], last[p], num[p]);
+                num_unpinned += num[p];
+            }
+            wake_many(num_unpinned, pool);
+
+            while (pinned != nullptr) {
+                Job_base* job = pinned;
+                pinned = (Job_base*)pinned->m_next;
                 schedule_job(job, tag_t{});
-                --num;
-                ++i;
             }
-            return i;
+            return num_jobs;
         };
 
 
@@ -850,28 +3701,146 @@ namespace vgjs {
             }
         };
 
+        /**
+        * \brief Schedule a whole vector of functions at once.
+        *
+        * All Jobs are allocated in one pass, and the parent's child counter is increased once.
+        * The Jobs are distributed in contiguous chunks over the global queues of all threads of the pool,
+        * Jobs pinned to a thread go to its local queue. Each chunk is spliced into its queue with
+        * one atomic operation, afterwards parked workers are woken up.
+        *
+        * \param[in] functions A vector of functions, they are moved if the vector is an rvalue.
+        * \param[in] tg A tag, if given then the Jobs wait for the tag to be scheduled.
+        * \param[in] parent The parent of the Jobs.
+        * \param[in] children Number used to increase the number of children of the parent, -1 means the vector size.
+        * \returns the number of children.
+        */
+        template<typename V>
+        uint32_t schedule_batch(V&& functions, tag_t tg = tag_t{}, Job_base* parent = m_current_job, int32_t children = -1) noexcept {
+            struct Sublist {
+                Job_base* m_first = nullptr;    //newest job
+                Job_base* m_last = nullptr;     //oldest job
+                int32_t   m_num = 0;
+
+                void push(Job_base* job) noexcept {
+                    job->m_next = m_first;
+                    m_first = job;
+                    if (m_last == nullptr) m_last = job;
+                    ++m_num;
+                }
+            };
+            using Lists = std::array<Sublist, c_num_priorities>;
+            thread_local static std::vector<Lists> global_lists;
+            thread_local static std::vector<Lists> local_lists;
+
+            if (children < 0) {                     //default? use vector size.
+                children = (int)functions.size();
+            }
+            const uint32_t num = (uint32_t)functions.size();
+            if (num == 0) return children;
+
+            pool_t pool = schedule_pool();          //all Jobs go into the same pool
+            auto& jp = m_pools[pool.value];
+
+            if (tg.value >= 0) {                    //tagged jobs have no parent, they all go into the tag
+                Sublist list;
+                for (auto&& f : functions) {
+                    if constexpr (std::is_lvalue_reference_v<V>) list.push(allocate_job(f));
+                    else list.push(allocate_job(std::move(f)));
+                    list.m_first->m_pool = pool;
+                }
+                tag_stack(tg).push_list(list.m_first, list.m_last);
+                return children;
+            }
+
+            global_lists.assign(m_thread_count, Lists{});
+            local_lists.assign(m_thread_count, Lists{});
+            uint32_t start = m_pool_index == pool ? m_thread_index.value - jp.m_first : rand() % jp.m_count;
+            uint32_t i = 0;
+            Sublist deadline_list;
+            for (auto&& f : functions) {            //allocate all jobs first, nothing is visible to other threads yet
+                Job* job;
+                if constexpr (std::is_lvalue_reference_v<V>) job = allocate_job(f);
+                else job = allocate_job(std::move(f));
+                job->m_parent = parent;
+                job->m_pool = pool;
+                auto p = priority_index(job->m_job_priority);
+                if (job->m_thread_index.value >= 0 && job->m_thread_index.value < (int)m_thread_count) {
+                    local_lists[job->m_thread_index.value][p].push(job);
+                }
+                else if (job->m_deadline > 0) {
+                    deadline_list.push(job);
+                }
+                else {
+                    global_lists[jp.m_first + (start + (uint64_t)i * jp.m_count / num) % jp.m_count][p].push(job);
+                }
+                ++i;
+            }
+
+            if (parent != nullptr) {
+                parent->m_children.fetch_add((int)children);    //once for all jobs
+            }
+
+            uint32_t num_global = deadline_list.m_num;
+            for (Job_base* job = deadline_list.m_first; job != nullptr; ) {
+                Job_base* next = (Job_base*)job->m_next;
+                trace_scheduled(job, m_thread_index.value);
+                jp.m_deadlines.push(job);
+                job = next;
+            }
+            for (uint32_t t = 0; t < m_thread_count; ++t) {
+                bool has_local = false;
+                for (uint32_t p = 0; p < c_num_priorities; ++p) {
+                    if constexpr (c_enable_tracing || c_enable_logging) {
+                        for (Job_base* job = global_lists[t][p].m_first; job != nullptr; job = (Job_base*)job->m_next) {
+                            trace_scheduled(job, t);
+                        }
+                        for (Job_base* job = local_lists[t][p].m_first; job != nullptr; job = (Job_base*)job->m_next) {
+                            trace_scheduled(job, t);
+                        }
+                    }
+                    if (global_lists[t][p].m_num > 0) {
+                        m_workers[t]->m_global.push_list(global_lists[t][p].m_first, global_lists[t][p].m_last, global_lists[t][p].m_num);
+                        num_global += global_lists[t][p].m_num;
+                    }
+                    if (local_lists[t][p].m_num > 0) {
+                        m_workers[t]->m_local.push_list(local_lists[t][p].m_first, local_lists[t][p].m_last, local_lists[t][p].m_num);
+                        has_local = true;
+                    }
+                }
+                if (has_local) wake(t);             //only this thread can run its local jobs
+            }
+            wake_many(num_global, pool);
+            return children;
+        }
+
         /**
         * \brief Schedule a function holding a function into the job system - or a tag
         * \param[in] function - An external function that is copied into the scheduled job.
         * \param[in] priority - job priority.
         * \param[in] thread_num - which thread to attach job to.
+        * \param[in] waitable - if true, the returned handle can be used to wait for the job to finish.
+        * \returns a handle holding the unique id of the job.
         */
         template<typename F>
         requires FUNCTOR<F>
-        std::pair<Job*, uint64_t> schedule(F&& function, JobPriority priority, thread_index_t thread_num) noexcept {
+        JobHandle schedule(F&& function, JobPriority priority, thread_index_t thread_num, bool waitable = false) noexcept {
             Job* job = allocate_job(std::forward<F>(function));
             job->m_parent = nullptr;
             job->m_job_priority = priority;
             job->m_thread_index = thread_num;
-            // TODO: use another memory order ?
-            job->m_unique_id = m_unique_job_id.fetch_add(1);
-            uint64_t uid = job->m_unique_id;
+            job->m_unique_id = m_unique_job_id.fetch_add(1, std::memory_order_relaxed);
+            if (waitable) {
+                job->m_completion = allocate_completion();  //shared by the job and the handle
+            }
+            JobHandle handle{ job->m_completion, job->m_unique_id };
             schedule_job(job, tag_t{});
-            return {job , uid};
+            return handle;
         };
 
         /**
         * \brief Store a continuation for the current Job. Will be scheduled once the current Job finishes.
+        * Several continuations run one after the other, in the order they were added.
         * \param[in] f The function to schedule as continuation.
         */
         template<typename F>
@@ -881,47 +3850,55 @@ namespace vgjs {
             if (current == nullptr || !current->is_function()) {
                 return;
             }
-            ((Job*)current)->m_continuation = allocate_job(std::forward<F>(f));
+            ((Job*)current)->add_continuation(allocate_job(std::forward<F>(f)));
         }
 
         //-----------------------------------------------------------------------------------------
 
-        /**
-        * \brief Get the logging data so it can be saved to file.
-        * \returns a reference to the logging data.
-        */
-        auto& get_logs() {
-            return m_logs;
-        }
-
-        /**
-        * \brief Clear all logs.
-        */
-        void clear_logs() {
-            for (auto& log : m_logs) {
-                log.clear();
-            }
-        }
-
         /**
         * \brief Enable logging.
-        * If logging is enabled, start/stop times and other data of each thread is saved
-        * in a memory data structure.
+        *
+        * If logging is enabled, all trace events are recorded into the per thread trace rings.
+        * A background thread drains them every c_log_interval into the binary file "log.vgjs",
+        * so the memory used for logging stays the same however long it runs.
+        * Has no effect if c_enable_logging is false.
         */
         void enable_logging() {
-            m_logging = true;
+            if constexpr (c_enable_logging) {
+                std::lock_guard lg{ m_log_mutex };
+                if (m_logging) return;
+                m_log_file.open("log.vgjs", std::ios::binary | std::ios::trunc);
+                if (!m_log_file) {
+                    logger->error("Could not open the log file log.vgjs");
+                    return;
+                }
+                TraceFileHeader header;
+                m_log_file.write((const char*)&header, sizeof(header));
+                m_logging = true;
+                m_log_writer = std::thread([this]() {
+                    while (m_logging.load(std::memory_order_relaxed)) {
+                        std::this_thread::sleep_for(c_log_interval);
+                        write_log();
+                    }
+                });
+            }
         }
 
         /**
         * \brief Disable logging.
-        * If logging is enabled, start/stop times and other data of each thread is saved
-        * in a memory data structure.
+        *
+        * The log writer is stopped, the remaining events are written to "log.vgjs",
+        * and the file is exported to "log.json" for chrome://tracing or Perfetto.
         */
         void disable_logging() {
-            if (m_logging) {
+            if constexpr (c_enable_logging) {
+                std::lock_guard lg{ m_log_mutex };
+                if (!m_logging.exchange(false)) return;
+                if (m_log_writer.joinable()) m_log_writer.join();
+                write_log();                //events recorded after the last round
+                m_log_file.close();
                 save_log_file();
             }
-            m_logging = false;
         }
 
         /**
@@ -952,6 +3929,182 @@ namespace vgjs {
             return m_types;
         }
 
+        //-----------------------------------------------------------------------------------------
+
+        /**
+        * \brief Get the time used by trace events.
+        * \returns the nanoseconds since the job system was started.
+        */
+        uint64_t trace_time() noexcept {
+            return (uint64_t)duration_cast<nanoseconds>(high_resolution_clock::now() - m_start_time).count();
+        }
+
+        /**
+        * \brief Ask whether trace events are currently recorded, because of tracing or logging.
+        * \returns true or false
+        */
+        bool is_recording() noexcept {
+            return (c_enable_tracing && m_tracing.load(std::memory_order_relaxed)) || (c_enable_logging && m_logging.load(std::memory_order_relaxed));
+        }
+
+        /**
+        * \brief Record a trace event into the ring buffer of the calling thread.
+        *
+        * If c_enable_tracing and c_enable_logging are false this compiles to nothing, else it costs
+        * loading the flags if neither tracing nor logging is enabled at runtime.
+        * No strings are formatted and nothing is allocated, except the ring of a thread
+        * that records its first event.
+        *
+        * \param[in] type The event type.
+        * \param[in] job_id The unique id of the job this event is about.
+        * \param[in] value Event specific data.
+        * \param[in] data Event specific data.
+        * \param[in] id The id of the job.
+        */
+        void trace_event(TraceEventType type, uint64_t job_id = 0, uint32_t value = 0, uint64_t data = 0, int32_t id = -1) noexcept {
+            if constexpr (c_enable_tracing || c_enable_logging) {
+                if (!is_recording()) [[likely]] return;
+                if (m_trace_ring == nullptr) [[unlikely]] {
+                    std::lock_guard lg{ m_trace_mutex };
+                    m_trace_ring = m_trace_rings.emplace_back(std::make_unique<TraceRing>()).get();
+                    m_trace_ring->m_thread = m_thread_index.value;
+                }
+                m_trace_ring->push(TraceEvent{ trace_time(), job_id, data, m_thread_index.value, value, id, type });
+            }
+        }
+
+        /**
+        * \brief Record that a job is about to be pushed into a queue.
+        *
+        * The time is stored in the job, so the queue wait time can be recorded when it starts.
+        * Jobs without a unique id get one. This must be called before the job becomes visible to other threads.
+        *
+        * \param[in] job The job.
+        * \param[in] target The thread whose queue gets the job.
+        */
+        void trace_scheduled(Job_base* job, uint32_t target) noexcept {
+            if constexpr (c_enable_tracing || c_enable_logging) {
+                if (!is_recording()) [[likely]] return;
+                if (job->m_unique_id == 0) {        //the flow arrows of the trace need an id for each job
+                    job->m_unique_id = m_unique_job_id.fetch_add(1, std::memory_order_relaxed);
+                }
+                job->m_trace_time = trace_time();
+                trace_event(TraceEventType::job_scheduled, job->m_unique_id, target, job->m_parent != nullptr ? job->m_parent->m_unique_id : 0);
+            }
+        }
+
+        /**
+        * \brief Record that a finished job releases its continuation, so the edge between them is in the trace.
+        * Must be called before the continuation is scheduled.
+        * \param[in] finished The job that has finished.
+        * \param[in] next The continuation.
+        */
+        void trace_continued(Job_base* finished, Job_base* next) noexcept {
+            if constexpr (c_enable_tracing || c_enable_logging) {
+                if (!is_recording()) [[likely]] return;
+                if (next->m_unique_id == 0) {
+                    next->m_unique_id = m_unique_job_id.fetch_add(1, std::memory_order_relaxed);
+                }
+                trace_event(TraceEventType::job_continued, next->m_unique_id, 0, finished->m_unique_id);
+            }
+        }
+
+        /**
+        * \brief Enable recording of trace events. Has no effect if c_enable_tracing is false.
+        */
+        void enable_tracing() noexcept {
+            m_tracing = true;
+        }
+
+        /**
+        * \brief Disable recording of trace events. Events recorded so far are kept until flush_trace() is called.
+        */
+        void disable_tracing() noexcept {
+            m_tracing = false;
+        }
+
+        /**
+        * \brief Ask whether tracing is currently enabled or not
+        * \returns true or false
+        */
+        bool is_tracing() noexcept {
+            return c_enable_tracing && m_tracing.load(std::memory_order_relaxed);
+        }
+
+        /**
+        * \brief Remove all recorded trace events and hand them to a function.
+        * \param[in] f Function that is called for each TraceEvent.
+        * \returns the number of events that were drained.
+        */
+        template<typename F>
+        uint64_t drain_trace(F&& f) {
+            std::lock_guard lg{ m_trace_mutex };
+            uint64_t num = 0;
+            for (auto& ring : m_trace_rings) {
+                num += ring->drain(f);
+            }
+            return num;
+        }
+
+        /**
+        * \brief Format all recorded trace events and write them to the logger.
+        *
+        * This is the only place where trace strings are formatted, it should be called
+        * outside of time critical code. While logging is enabled the events belong to the
+        * log file, and nothing is written.
+        *
+        * \returns the number of events that were written.
+        */
+        uint64_t flush_trace() {
+            if (m_logging) return 0;
+            uint64_t dropped = 0;
+            {
+                std::lock_guard lg{ m_trace_mutex };
+                for (auto& ring : m_trace_rings) dropped += ring->take_dropped();
+            }
+            if (dropped > 0) {
+                logger->trace(std::format("{} trace events were dropped, the trace ring buffer was full", dropped));
+            }
+            return drain_trace([&](const TraceEvent& ev) {
+                switch (ev.m_type) {
+                case TraceEventType::job_scheduled:
+                    logger->trace(std::format("[{} ns] New job with id {} added to thread {}", ev.m_time, ev.m_job_id, ev.m_value));
+                    break;
+                case TraceEventType::job_started:
+                    logger->trace(std::format("[{} ns] Starting job with id {} on thread {}", ev.m_time, ev.m_job_id, ev.m_thread));
+                    break;
+                case TraceEventType::job_finished:
+                    logger->trace(std::format("[{} ns] Job with id {} finished on thread {}", ev.m_time, ev.m_job_id, ev.m_thread));
+                    break;
+                case TraceEventType::job_stolen:
+                    logger->trace(std::format("[{} ns] Thread {} stole {} jobs from thread {}", ev.m_time, ev.m_thread, ev.m_data, ev.m_value));
+                    break;
+                case TraceEventType::job_continued:
+                    logger->trace(std::format("[{} ns] Job with id {} continues job with id {}", ev.m_time, ev.m_job_id, ev.m_data));
+                    break;
+                default:
+                    break;
+                }
+            });
+        }
+
+    private:
+        /**
+        * \brief Write all recorded trace events to the binary log file. Called by the log writer.
+        */
+        void write_log() {
+            std::lock_guard lg{ m_trace_mutex };
+            for (auto& ring : m_trace_rings) {
+                ring->drain([&](const TraceEvent& ev) {
+                    m_log_file.write((const char*)&ev, sizeof(ev));
+                });
+                if (uint64_t dropped = ring->take_dropped(); dropped > 0) {
+                    TraceEvent ev{ trace_time(), 0, dropped, -1, (uint32_t)ring->m_thread, -1, TraceEventType::events_dropped };
+                    m_log_file.write((const char*)&ev, sizeof(ev));
+                }
+            }
+        }
+
     };
 
     //----------------------------------------------------------------------------------------------
@@ -960,29 +4113,87 @@ namespace vgjs {
     * \brief A Job holding a function and all its children have finished.
     *
     * This is called when a Job and its children has finished.
+    * If the Job is a chain with stages left, the next stage is run instead.
     * If there is a continuation stored in the job, then the continuation
-    * gets scheduled. Also the job's parent is notified of this new child.
+    * gets scheduled on the same thread. Also the job's parent is notified of this new child.
     * Then, if there is a parent, the parent's child_finished() function is called.
     */
     inline void JobSystem::on_finished(Job *job) noexcept {
 
+        if (++job->m_stage < job->m_stages) {      //a chain runs its next stage with the same Job
+            schedule_next(job, job);
+            return;
+        }
+        job->m_stage = 0;                           //start with the first stage if the Job is run again
+
+        if (job->m_deadline > 0) {
+            deadline_finished(job);
+        }
+
         if (job->m_continuation != nullptr) {		//is there a successor Job?
 
             if (job->m_parent != nullptr) {         //is there is a parent?
                 job->m_parent->m_children++;
                 job->m_continuation->m_parent = job->m_parent;   //add successor as child to the parent
             }
-            schedule_job(job->m_continuation);    //schedule the successor
+            trace_continued(job, job->m_continuation);
+            schedule_next(job, job->m_continuation);    //run the successor on this thread
         }
 
         if (job->m_parent != nullptr) {		//if there is parent then inform it
-            child_finished((Job*)job->m_parent);	//if this is the last child job then the parent will also finish
+            parent_finished(job->m_parent);	//if this is the last child job then the parent will also finish
+        }
+
+        if (job->m_completion != nullptr) [[unlikely]] {   //is someone waiting for this job?
+            if (job->m_completion->signal()) count_cancellation(-1);    //a cancelled job has finished
+            release_completion(job->m_completion);
+        }
+
+        if (job->m_graph != nullptr) [[unlikely]] {     //nodes of a task graph are reused
+            graph_node_finished(job);                   //release the successors
+            return;
         }
 
         recycle(job);       //recycle the Job
     }
 
 
+    /**
+    * \brief Cancel the job and all its descendants.
+    */
+    inline void JobHandle::cancel() noexcept {
+        if (m_completion == nullptr) return;
+        JobSystem::count_cancellation(1);           //count first, so that is_cancelled() looks at the jobs
+        if (!m_completion->cancel()) {
+            JobSystem::count_cancellation(-1);      //the job has finished or was cancelled before
+            return;
+        }
+        JobSystem().release_cancelled_timers();     //descendants waiting for a timer are skipped right away
+    }
+
+    /**
+    * \brief Drop the handle's ownership of the completion.
+    */
+    inline void JobHandle::release() noexcept {
+        if (m_completion != nullptr) {
+            JobSystem().release_completion(std::exchange(m_completion, nullptr));
+        }
+    }
+
+    /**
+    * \brief Wait for the job. Blocking a worker could deadlock, so workers run other jobs instead.
+    */
+    inline void JobHandle::wait() const noexcept {
+        if (m_completion == nullptr) return;
+        JobSystem js;
+        if (js.get_thread_index().value >= 0 && js.get_thread_index().value < (int)js.get_thread_count().value) {
+            js.run_until([this]() { return m_completion->is_done(); });
+        }
+        else {
+            m_completion->wait();
+        }
+    }
+
     //----------------------------------------------------------------------------------
 
     /**
@@ -993,6 +4204,15 @@ namespace vgjs {
         return (Job_base*)JobSystem::current_job();
     }
 
+    /**
+    * \brief Test whether the current job or coro has been cancelled. Long running jobs can call this
+    * now and then and return early.
+    * \returns true if the current job or one of its ancestors has been cancelled.
+    */
+    inline bool is_cancelled() noexcept {
+        return JobSystem::is_cancelled(JobSystem::current_job());
+    }
+
     /**
     * \brief Schedule functions into the system. T can be a Function, std::function or a task<U>.
     *
@@ -1011,20 +4231,25 @@ namespace vgjs {
     template <typename F>
     inline uint32_t schedule(F&& functions, tag_t tg = tag_t{}, Job_base* parent = current_job(), int32_t children = -1) noexcept {
         if constexpr (is_pmr_vector<std::decay_t<F>>::value) {
-            if (children < 0) {                     //default? use vector size.
-                children = (int)functions.size();
+            if constexpr (FUNCTION<typename std::decay_t<F>::value_type> || VOIDCALLABLE<typename std::decay_t<F>::value_type>) {
+                return JobSystem().schedule_batch(std::forward<F>(functions), tg, parent, children); //all functions at once
             }
-            auto ret = children;
-            for (auto&& f : functions) { //schedule all elements, use the total number of children for the first call, then 0
-                if constexpr (std::is_lvalue_reference_v<decltype(functions)>) {
-                    schedule(f, tg, parent, children); //might call the coro version, so do not call job system here!
+            else {                                  //e.g. coros are scheduled one by one
+                if (children < 0) {                     //default? use vector size.
+                    children = (int)functions.size();
                 }
-                else {
-                    schedule(std::move(f), tg, parent, children); //might call the coro version, so do not call job system here!
+                auto ret = children;
+                for (auto&& f : functions) { //schedule all elements, use the total number of children for the first call, then 0
+                    if constexpr (std::is_lvalue_reference_v<decltype(functions)>) {
+                        schedule(f, tg, parent, children); //might call the coro version, so do not call job system here!
+                    }
+                    else {
+                        schedule(std::move(f), tg, parent, children); //might call the coro version, so do not call job system here!
+                    }
+                    children = 0;
                 }
-                children = 0;
+                return ret;
             }
-            return ret;
         }
         else {
             return JobSystem().schedule(std::forward<F>(functions), tg, parent, children);
@@ -1032,6 +4257,36 @@ namespace vgjs {
     }
 
 
+    /**
+    * \brief Schedule functions or Coros into a worker pool, e.g. schedule_on(pool_t{ 1 }, [](){ load_level(); }).
+    *
+    * Everything scheduled here, and all their children, run on the workers of the pool
+    * and allocate from its memory resource. Continuations stay in the pool too.
+    *
+    * \param[in] pool The pool, an invalid pool means the pool of the caller.
+    * \param[in] functions The functions or Coros, as for schedule().
+    * \param[in] tg A tag, if given then the Jobs wait for the tag to be scheduled.
+    * \param[in] parent The parent of this Job.
+    * \param[in] children Number used to increase the number of children of the parent.
+    * \returns the number of scheduled functions.
+    */
+    template <typename F>
+    inline uint32_t schedule_on(pool_t pool, F&& functions, tag_t tg = tag_t{}, Job_base* parent = current_job(), int32_t children = -1) noexcept {
+        pool_t previous = JobSystem::exchange_schedule_pool(pool);
+        uint32_t num = children < 0 ? schedule(std::forward<F>(functions), tg, parent)     //keep the default of Coros
+            : schedule(std::forward<F>(functions), tg, parent, children);
+        JobSystem::exchange_schedule_pool(previous);
+        return num;
+    }
+
+    /**
+    * \brief Get the pool of the calling thread.
+    * \returns the pool of the calling worker, or -1 for threads outside the pools.
+    */
+    inline pool_t current_pool() noexcept {
+        return JobSystem().get_pool();
+    }
+
     /**
     * \brief Store a continuation for the current Job. The continuation will be scheduled once the job finishes.
     * \param[in] f A function to schedule as continuation
@@ -1041,6 +4296,28 @@ namespace vgjs {
         JobSystem().continuation(std::forward<F>(f)); // forward to the job system
     };
 
+    /**
+    * \brief Schedule a function after a delay, e.g. schedule_after(16ms, [](){ spawn_wave(); }).
+    * \param[in] delay The time to wait.
+    * \param[in] f The function to schedule.
+    * \param[in] parent The parent of this Job.
+    */
+    template<typename F>
+    inline void schedule_after(std::chrono::nanoseconds delay, F&& f, Job_base* parent = current_job()) noexcept {
+        JobSystem().schedule_after(delay, std::forward<F>(f), parent);
+    }
+
+    /**
+    * \brief Schedule a function at a point in time.
+    * \param[in] time The point in time, of any clock.
+    * \param[in] f The function to schedule.
+    * \param[in] parent The parent of this Job.
+    */
+    template<typename C, typename D, typename F>
+    inline void schedule_at(std::chrono::time_point<C, D> time, F&& f, Job_base* parent = current_job()) noexcept {
+        JobSystem().schedule_at(time, std::forward<F>(f), parent);
+    }
+
 
     //----------------------------------------------------------------------------------
 
@@ -1058,19 +4335,75 @@ namespace vgjs {
         JobSystem().wait_for_termination();
     }
 
+    /**
+    * \brief Run jobs on this thread until a condition is met, also from threads outside the job system.
+    * \param[in] done The condition, it is called repeatedly.
+    */
+    template<typename P>
+    inline void run_until(P&& done) {
+        JobSystem().run_until(std::forward<P>(done));
+    }
+
+    /**
+    * \brief Run jobs on this thread until a job and all its children have finished.
+    * \param[in] handle The handle of the job.
+    */
+    inline void wait(const JobHandle& handle) {
+        JobSystem().wait(handle);
+    }
+
+    /**
+    * \brief Start a new epoch, e.g. at the beginning of a frame. Jobs, Coros and their children allocate from its arenas.
+    * \returns the number of the new epoch.
+    */
+    inline uint64_t begin_epoch() {
+        return JobSystem().begin_epoch();
+    }
+
+    /**
+    * \brief End the current epoch without starting a new one.
+    */
+    inline void end_epoch() noexcept {
+        JobSystem().end_epoch();
+    }
+
+    /**
+    * \brief Get the memory resource for short-lived data, e.g. std::pmr::vector<int> v(epoch_resource()).
+    * \returns the arena of the caller's epoch, or the default resource outside of epochs.
+    */
+    inline n_pmr::memory_resource* epoch_resource() noexcept {
+        return JobSystem().memory_resource();
+    }
+
+    /**
+    * \brief Get the steal counters summed up over all threads.
+    * \returns the steal counters.
+    */
+    inline StealStats steal_stats() noexcept {
+        return JobSystem().get_steal_stats();
+    }
+
+    /**
+    * \brief Take a snapshot of the counters of all workers without stopping them.
+    * \param[in] pool Only the workers of this pool, or -1 for all workers.
+    * \returns the metrics of each worker and their sum.
+    */
+    inline SchedulerMetrics snapshot_metrics(pool_t pool = pool_t{}) noexcept {
+        return JobSystem().snapshot_metrics(pool);
+    }
+
     /**
     * \brief Enable logging.
-    * If logging is enabled, start/stop times and other data of each thread is saved
-    * in a memory data structure.
+    * If logging is enabled, trace events are streamed by a background thread
+    * into the binary file "log.vgjs".
     */
     inline void enable_logging() {
         JobSystem().enable_logging();
     }
 
     /**
-    * \brief Enable logging.
-    * If logging is enabled, start/stop times and other data of each thread is saved
-    * in a memory data structure.
+    * \brief Disable logging.
+    * The remaining events are written to "log.vgjs", which is then exported to "log.json".
     */
     inline void disable_logging() {
         JobSystem().disable_logging();
@@ -1084,119 +4417,574 @@ namespace vgjs {
     }
 
     /**
-    * \brief Get the logging data so it can be saved to file.
-    * \returns a reference to the logging data.
+    * \brief Enable recording of trace events.
+    */
+    inline void enable_tracing() {
+        JobSystem().enable_tracing();
+    }
+
+    /**
+    * \brief Disable recording of trace events.
     */
-    inline auto& get_logs() {
-        return JobSystem().get_logs();
+    inline void disable_tracing() {
+        JobSystem().disable_tracing();
     }
 
     /**
-    * \brief Clear all logs.
+    * \brief Write all recorded trace events to the logger.
+    * \returns the number of events that were written.
     */
-    inline void clear_logs() {
-        JobSystem().clear_logs();
+    inline uint64_t flush_trace() {
+        return JobSystem().flush_trace();
     }
 
+    //---------------------------------------------------------------------------------------------------
+    //parallel loops
+
+    const std::chrono::microseconds c_parallel_chunk_time{ 50 };   //the grain size of parallel loops adapts to this duration per chunk
+
+    /**
+    * \brief Common base of parallel_for and parallel_reduce, splits an integer range lazily.
+    *
+    * The range starts as a single piece. A piece runs its range chunk by chunk, each chunk having
+    * grain size elements. Whenever the global queue of its thread is empty, i.e. a thief has stolen
+    * everything from there, the piece splits off the upper half of its remaining range as a new piece.
+    * So the range is only halved if other threads actually take work.
+    * The grain size is adapted after every chunk, so that a chunk runs for about c_parallel_chunk_time.
+    *
+    * The loop can be awaited by a Coro with co_await, or a thread can call wait(). A worker thread
+    * keeps running other jobs while waiting.
+    *
+    * D is the derived class, it implements piece_start(), run_chunk() and piece_end().
+    */
+    template<typename I, typename D>
+    class parallel_range_t {
+    protected:
+        I                       m_begin;            //range to work on
+        I                       m_end;
+        I                       m_grain;            //initial grain size
+        std::atomic<int32_t>    m_pending = 0;      //number of pieces that are scheduled or running
+        Job_base*               m_parent = nullptr; //the Coro to resume when all pieces have finished, or nullptr
+        Job_base*               m_owner = nullptr;  //the Job or Coro running the loop, the loop is cancelled with it
+
+        parallel_range_t(I begin, I end, I grain) noexcept : m_begin(begin), m_end(end), m_grain(std::max(grain, (I)1)) {};
+
+        /**
+        * \brief Schedule a new piece as job.
+        * \param[in] begin Start of the range of the piece.
+        * \param[in] end End of the range of the piece.
+        * \param[in] grain Grain size to start with.
+        */
+        void schedule_piece(I begin, I end, I grain) noexcept {
+            m_pending.fetch_add(1, std::memory_order_relaxed);
+            JobSystem().schedule([this, begin, end, grain]() { run_piece(begin, end, grain); }, tag_t{}, nullptr);
+        }
+
+        /**
+        * \brief Run a piece chunk by chunk, split off the upper half if there is nothing left to steal.
+        * \param[in] begin Start of the range of the piece.
+        * \param[in] end End of the range of the piece.
+        * \param[in] grain Grain size to start with.
+        */
+        void run_piece(I begin, I end, I grain) noexcept {
+            D* self = static_cast<D*>(this);
+            auto acc = self->piece_start();
+            while (begin < end && !JobSystem::is_cancelled(m_owner)) {      //a cancelled loop skips the chunks that are left
+                if (end - begin > grain && JobSystem().own_queue_empty()) {     //someone took our work, so offer more
+                    I mid = begin + (end - begin) / 2;
+                    schedule_piece(mid, end, grain);
+                    end = mid;
+                }
+                I chunk_end = (end - begin > grain) ? begin + grain : end;
+                auto t0 = std::chrono::high_resolution_clock::now();
+                self->run_chunk(begin, chunk_end, acc);
+                auto dt = std::chrono::high_resolution_clock::now() - t0;
+                if (dt < c_parallel_chunk_time / 2 && chunk_end - begin == grain) grain = grain * 2;    //chunk was too short
+                else if (dt > c_parallel_chunk_time * 2 && grain > 1) grain = grain / 2;            //chunk was too long
+                begin = chunk_end;
+            }
+            self->piece_end(acc);
+
+            Job_base* parent = m_parent;            //this object may be destroyed right after the last piece finished
+            if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1 && parent != nullptr) {
+                JobSystem().child_finished(parent);    //resume the Coro
+            }
+        }
+
+        parallel_range_t(parallel_range_t&& other) noexcept //only before the loop has started
+            : m_begin(other.m_begin), m_end(other.m_end), m_grain(other.m_grain) {};
+
+    public:
+        parallel_range_t(const parallel_range_t&) = delete;
+
+        /**
+        * \brief Run the loop and wait for it to finish.
+        */
+        void wait() noexcept {
+            if (m_begin >= m_end) return;
+            m_owner = JobSystem::current_job();     //nullptr for a thread outside the pool
+            schedule_piece(m_begin, m_end, m_grain);
+            JobSystem().run_until([this]() { return m_pending.load(std::memory_order_acquire) == 0; });
+        }
+
+        bool await_ready() noexcept { return m_begin >= m_end; }   //nothing to do
+
+        /**
+        * \brief Start the loop, the Coro is resumed when all pieces have finished.
+        * \param[in] h Handle of the awaiting Coro.
+        * \returns true to suspend the Coro.
+        */
+        template<typename H>
+        bool await_suspend(H h) noexcept {
+            m_parent = m_owner = &h.promise();
+            m_parent->m_children.fetch_add(1);      //the loop is a child of the Coro
+            schedule_piece(m_begin, m_end, m_grain);
+            return true;
+        }
+    };
+
+
+    /**
+    * \brief A parallel loop calling a function for every index of a range. Create with parallel_for().
+    */
+    template<typename I, typename F>
+    class parallel_for_t : public parallel_range_t<I, parallel_for_t<I, F>> {
+        friend parallel_range_t<I, parallel_for_t<I, F>>;
+        F m_function;
+
+        struct empty_t {};
+        empty_t piece_start() noexcept { return {}; }
+        void run_chunk(I begin, I end, empty_t&) noexcept { for (I i = begin; i < end; ++i) m_function(i); }
+        void piece_end(empty_t&) noexcept {}
+
+    public:
+        parallel_for_t(I begin, I end, I grain, F&& f) noexcept
+            : parallel_range_t<I, parallel_for_t<I, F>>(begin, end, grain), m_function(std::forward<F>(f)) {};
+
+        parallel_for_t(parallel_for_t&& other) noexcept     //only before the loop has started
+            : parallel_range_t<I, parallel_for_t<I, F>>(std::move(other)), m_function(std::forward<F>(other.m_function)) {};
+
+        void await_resume() noexcept {}
+    };
+
+
+    /**
+    * \brief A parallel loop combining the function values of all indices of a range. Create with parallel_reduce().
+    *
+    * The reduce operation must be associative and commutative, since pieces are combined in any order.
+    */
+    template<typename I, typename T, typename F, typename R>
+    class parallel_reduce_t : public parallel_range_t<I, parallel_reduce_t<I, T, F, R>> {
+        friend parallel_range_t<I, parallel_reduce_t<I, T, F, R>>;
+        T           m_identity;
+        T           m_result;
+        F           m_function;
+        R           m_reduce;
+        std::mutex  m_mutex;     //protects m_result
+
+        T piece_start() noexcept { return m_identity; }
+        void run_chunk(I begin, I end, T& acc) noexcept { for (I i = begin; i < end; ++i) acc = m_reduce(std::move(acc), m_function(i)); }
+        void piece_end(T& acc) noexcept {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_result = m_reduce(std::move(m_result), std::move(acc));
+        }
+
+    public:
+        parallel_reduce_t(I begin, I end, I grain, T identity, F&& f, R&& reduce) noexcept
+            : parallel_range_t<I, parallel_reduce_t<I, T, F, R>>(begin, end, grain), m_identity(identity), m_result(identity)
+            , m_function(std::forward<F>(f)), m_reduce(std::forward<R>(reduce)) {};
+
+        parallel_reduce_t(parallel_reduce_t&& other) noexcept   //only before the loop has started
+            : parallel_range_t<I, parallel_reduce_t<I, T, F, R>>(std::move(other)), m_identity(std::move(other.m_identity))
+            , m_result(std::move(other.m_result)), m_function(std::forward<F>(other.m_function)), m_reduce(std::forward<R>(other.m_reduce)) {};
+
+        T await_resume() noexcept { return std::move(m_result); }
+
+        /**
+        * \brief Run the loop, wait for it to finish and return the result.
+        * \returns the combined result of all indices.
+        */
+        T get() noexcept {
+            this->wait();
+            return std::move(m_result);
+        }
+    };
+
+
     /**
-    * \brief Store a job run in the log data
+    * \brief Run a function for every index in [begin, end) in parallel.
+    *
+    * In a Coro use co_await parallel_for(...), in a function call parallel_for(...).wait().
     *
-    * \param[in] t1 Start time of the job.
-    * \param[in] t2 End time of the job.
-    * \param[in] exec_thread Index of the thread that ran the job.
-    * \param[in] finished If true, then the job finished.
-    * \param[in] type The job type.
-    * \param[in] id A unique ID.
-    */
-    inline void log_data(
-        std::chrono::high_resolution_clock::time_point& t1, std::chrono::high_resolution_clock::time_point& t2,
-        thread_index_t exec_thread, bool finished, thread_type_t type, thread_id_t id) {
-
-        auto& logs = JobSystem().get_logs();
-        logs[JobSystem().get_thread_index().value].emplace_back( t1, t2, JobSystem().get_thread_index(), finished, type, id);
+    * \param[in] begin Start of the range.
+    * \param[in] end End of the range.
+    * \param[in] grain Initial number of indices per chunk, adapts at run time.
+    * \param[in] f Function called as f(i) for every index i.
+    * \returns the loop object, it must live until the loop has finished.
+    */
+    template<typename I, typename F>
+    requires std::is_integral_v<I> && std::is_invocable_v<F&, I>
+    [[nodiscard]] parallel_for_t<I, F> parallel_for(I begin, I end, I grain, F&& f) noexcept {
+        return { begin, end, grain, std::forward<F>(f) };
     }
 
     /**
-    * \brief Store a job run in the log data
+    * \brief Combine the function values of all indices in [begin, end) in parallel.
+    *
+    * In a Coro use co_await parallel_reduce(...), in a function call parallel_reduce(...).get().
     *
-    * \param[in] out The output stream for the log file.
-    * \param[in] cat Undefined.
-    * \param[in] pid Always 0.
-    * \param[in] tid The thread index that ran the job.
-    * \param[in] ts Start time.
-    * \param[in] dur Duration of the job.
-    * \param[in] ph Always X
-    * \param[in] name Type name of the job.
-    * \param[in] args Indicates wehther the job has finshed.
-    */
-    inline void save_job(   std::ofstream& out
-                            , std::string cat
-                            , uint64_t pid
-                            , uint64_t tid
-                            , uint64_t ts
-                            , int64_t dur
-                            , std::string ph
-                            , std::string name
-                            , std::string args) {
-
-        std::stringstream time;
-        time.precision(15);
-        time << ts / 1.0e3;
-
-        std::stringstream duration;
-        duration.precision(15);
-        duration << dur / 1.0e3;
-
-        out << "{";
-        out << "\"cat\": " << cat << ", ";
-        out << "\"pid\": " << pid << ", ";
-        out << "\"tid\": " << tid << ", ";
-        out << "\"ts\": " << time.str() << ", ";
-        out << "\"dur\": " << duration.str() << ", ";
-        out << "\"ph\": " << ph << ", ";
-        out << "\"name\": " << name << ", ";
-        out << "\"args\": {" << args << "}";
-        out << "}";
+    * \param[in] begin Start of the range.
+    * \param[in] end End of the range.
+    * \param[in] grain Initial number of indices per chunk, adapts at run time.
+    * \param[in] identity Identity element of the reduce operation, e.g. 0 for +.
+    * \param[in] f Function called as f(i) for every index i.
+    * \param[in] reduce Associative and commutative operation combining two values.
+    * \returns the loop object, it must live until the loop has finished.
+    */
+    template<typename I, typename T, typename F, typename R>
+    requires std::is_integral_v<I> && std::is_invocable_v<F&, I>
+    [[nodiscard]] parallel_reduce_t<I, T, F, R> parallel_reduce(I begin, I end, I grain, T identity, F&& f, R&& reduce) noexcept {
+        return { begin, end, grain, identity, std::forward<F>(f), std::forward<R>(reduce) };
     }
 
+    //---------------------------------------------------------------------------------------------------
+    //task graphs
+
     /**
-    * \brief Dump all job data into a json log file.
+    * \brief A graph of jobs and their dependencies that is built once and run many times.
+    *
+    * Nodes are added with node(), dependencies with edge(). compile() computes the successors and
+    * the number of predecessors of each node, and a placement hint for each node: roots and all but the
+    * first successor of a node are spread over the threads, the first successor and nodes with several
+    * predecessors run where they are released. The Jobs of the nodes are allocated once, so a run only
+    * resets the counters and pushes the roots, and does not allocate.
+    *
+    * A node finishes like any Job, when its function has returned and all its children have finished.
+    * Then the successors whose predecessors have all finished are scheduled. A node can also be a
+    * function returning a Coro, the Coro is then started as a child of the node in every run.
+    *
+    * A Coro can run the graph with co_await, a function can call run() to make the graph its child,
+    * and any thread can call wait(). Only one run can be active at a time. The graph must live until
+    * the run has finished.
     */
-    inline void save_log_file() {
-        auto& logs = JobSystem().get_logs();
-        std::ofstream outdata;
-        outdata.open("log.json");
-        auto& types = JobSystem().types();
+    class TaskGraph {
+        friend void graph_node_finished(Job* job) noexcept;
+
+        std::vector<Job*>                           m_jobs;         //the Job of each node, allocated once
+        std::vector<std::pair<uint32_t, uint32_t>>  m_edges;        //all dependencies (from, to)
+        std::vector<uint32_t>                       m_first;        //successors of node i are m_successors[m_first[i], m_first[i+1])
+        std::vector<uint32_t>                       m_successors;
+        std::vector<int32_t>                        m_deps;         //number of predecessors of each node
+        std::vector<int32_t>                        m_hints;        //thread for each node, or -1 for the thread that releases it
+        std::vector<uint32_t>                       m_roots;        //nodes without predecessors
+        std::unique_ptr<std::atomic<int32_t>[]>     m_remaining;    //predecessors of each node that have not finished in this run
+        std::atomic<int32_t>                        m_pending = 0;  //nodes of this run that have not finished
+        Job_base*                                   m_parent = nullptr; //notified when the run has finished, or nullptr
+        bool                                        m_compiled = false;
 
-        if (outdata) {
-            outdata << "{" << std::endl;
-            outdata << "\"traceEvents\": [" << std::endl;
-            bool comma = false;
-            for (uint32_t i = 0; i < logs.size(); ++i) {
-                for (auto& ev : logs[i]) {
-                    if (ev.m_t1 >= JobSystem().start_time() && ev.m_t2 >= ev.m_t1) {
+        /**
+        * \brief All predecessors of a node have finished, schedule it.
+        * \param[in] node The node.
+        */
+        void release(uint32_t node) noexcept {
+            Job* job = m_jobs[node];
+            job->m_next = nullptr;              //wipe out what the last run left behind
+            job->m_parent = nullptr;
+            job->m_continuation = nullptr;
+            job->m_completion = nullptr;
+            job->m_unique_id = 0;
+            if (job->m_thread_index.value >= 0 || m_hints[node] < 0) {
+                JobSystem().schedule_job(job);
+            }
+            else {
+                JobSystem().schedule_hint(job, (uint32_t)m_hints[node]);
+            }
+        }
+
+        /**
+        * \brief A node has finished, release its successors.
+        * \param[in] node The node.
+        */
+        void finished(uint32_t node) noexcept {
+            for (uint32_t k = m_first[node]; k < m_first[node + 1]; ++k) {
+                uint32_t successor = m_successors[k];
+                if (m_remaining[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    release(successor);
+                }
+            }
+            Job_base* parent = m_parent;            //the graph may be run again right after the last node finished
+            if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1 && parent != nullptr) {
+                JobSystem().child_finished(parent);
+            }
+        }
+
+    public:
+        TaskGraph() noexcept {};
+        TaskGraph(const TaskGraph&) = delete;               //the Jobs point to the graph
+        TaskGraph& operator=(const TaskGraph&) = delete;
+
+        ~TaskGraph() {
+            assert(m_pending == 0);
+            for (Job* job : m_jobs) {
+                JobSystem().recycle(job);
+            }
+        }
 
-                        if (comma) outdata << "," << std::endl;
+        /**
+        * \brief Add a node. Must not be called while the graph is running.
+        * \param[in] f A function, a Function with thread, type and id, or a function returning a Coro.
+        * \returns the number of the node.
+        */
+        template<typename F>
+        requires FUNCTOR<F> || requires(std::decay_t<F>& f) { typename decltype(f())::promise_type; }
+        uint32_t node(F&& f) {
+            assert(m_pending == 0);
+            Job* job;
+            if constexpr (requires(std::decay_t<F>& f) { typename decltype(f())::promise_type; }) {  //before FUNCTOR, which accepts any return type
+                job = JobSystem().allocate_job([f = std::forward<F>(f)]() mutable { schedule(f()); }, false);  //the Coro is a child of the node
+            }
+            else {
+                job = JobSystem().allocate_job(std::forward<F>(f), false);
+            }
+            job->m_graph = this;
+            job->m_node = (uint32_t)m_jobs.size();
+            m_jobs.push_back(job);
+            m_compiled = false;
+            return job->m_node;
+        }
 
-                        auto it = types.find(ev.m_type.value);
-                        std::string name = "-";
-                        if (it != types.end()) name = it->second;
+        /**
+        * \brief Add a dependency. Must not be called while the graph is running.
+        * \param[in] from The node that must finish first.
+        * \param[in] to The node that runs after from has finished.
+        */
+        void edge(uint32_t from, uint32_t to) {
+            assert(m_pending == 0 && from < m_jobs.size() && to < m_jobs.size());
+            m_edges.emplace_back(from, to);
+            m_compiled = false;
+        }
 
-                        save_job(outdata, "\"cat\"", 0, (uint32_t)ev.m_exec_thread.value,
-                            std::chrono::duration_cast<std::chrono::nanoseconds>(ev.m_t1 - JobSystem().start_time()).count(),
-                            std::chrono::duration_cast<std::chrono::nanoseconds>(ev.m_t2 - ev.m_t1).count(),
-                            "\"X\"", "\"" + name + "\"", "\"id\": " + std::to_string(ev.m_id.value));
+        /**
+        * \returns the number of nodes.
+        */
+        uint32_t size() const noexcept { return (uint32_t)m_jobs.size(); }
 
-                        comma = true;
-                    }
+        /**
+        * \brief Compute successors, dependency counts and placement hints. Is called by the first run after a change.
+        *
+        * Throws a JobException if the graph has a cycle.
+        */
+        void compile() {
+            uint32_t n = (uint32_t)m_jobs.size();
+            m_first.assign(n + 1, 0);
+            m_deps.assign(n, 0);
+            for (auto& [from, to] : m_edges) {
+                ++m_first[from + 1];
+                ++m_deps[to];
+            }
+            for (uint32_t i = 0; i < n; ++i) m_first[i + 1] += m_first[i];
+            m_successors.resize(m_edges.size());
+            std::vector<uint32_t> pos(m_first.begin(), m_first.end() - 1);
+            for (auto& [from, to] : m_edges) m_successors[pos[from]++] = to;
+
+            std::vector<int32_t> deps = m_deps;     //sort topologically to find cycles
+            std::vector<uint32_t> order;
+            order.reserve(n);
+            m_roots.clear();
+            for (uint32_t i = 0; i < n; ++i) {
+                if (deps[i] == 0) {
+                    m_roots.push_back(i);
+                    order.push_back(i);
+                }
+            }
+            for (uint32_t k = 0; k < order.size(); ++k) {
+                for (uint32_t e = m_first[order[k]]; e < m_first[order[k] + 1]; ++e) {
+                    if (--deps[m_successors[e]] == 0) order.push_back(m_successors[e]);
+                }
+            }
+            if (order.size() != n) {
+                throw RTE::JobException("TaskGraph has a cycle");
+            }
+
+            uint32_t threads = std::max(JobSystem().get_thread_count().value, 1);
+            uint32_t next = 0;
+            m_hints.assign(n, -1);
+            for (uint32_t root : m_roots) m_hints[root] = next++ % threads;
+            for (uint32_t v : order) {
+                for (uint32_t e = m_first[v] + 1; e < m_first[v + 1]; ++e) {    //the first successor stays on the thread of v
+                    if (m_deps[m_successors[e]] == 1) m_hints[m_successors[e]] = next++ % threads;
                 }
             }
-            outdata << "]," << std::endl;
-            outdata << "\"displayTimeUnit\": \"ms\"" << std::endl;
-            outdata << "}" << std::endl;
+
+            m_remaining = std::make_unique<std::atomic<int32_t>[]>(n);
+            m_compiled = true;
+        }
+
+        /**
+        * \brief Start a run of the graph.
+        * \param[in] parent This job finishes only after the run has finished, or nullptr.
+        */
+        void run(Job_base* parent = current_job()) {
+            if (!m_compiled) compile();
+            if (m_jobs.empty()) return;
+            assert(m_pending == 0);
+            pool_t pool = JobSystem().schedule_pool();     //the whole run stays in the pool of the caller
+            for (uint32_t i = 0; i < m_jobs.size(); ++i) {
+                m_remaining[i].store(m_deps[i], std::memory_order_relaxed);
+                m_jobs[i]->m_pool = pool;
+            }
+            m_parent = parent;
+            if (parent != nullptr) {
+                parent->m_children.fetch_add(1);    //the run is a child of the parent
+            }
+            m_pending.store((int32_t)m_jobs.size(), std::memory_order_release);
+            for (uint32_t root : m_roots) {
+                release(root);
+            }
+        }
+
+        /**
+        * \brief Run the graph and wait for it to finish. A worker thread keeps running other jobs while waiting.
+        */
+        void wait() {
+            run(nullptr);
+            JobSystem().run_until([this]() { return m_pending.load(std::memory_order_acquire) == 0; });
+        }
+
+        /**
+        * \returns true if no run is active.
+        */
+        bool is_done() const noexcept { return m_pending.load(std::memory_order_acquire) == 0; }
+
+        /**
+        * \brief Awaiter for co_await graph. The graph itself cannot be moved or copied.
+        */
+        struct awaiter {
+            TaskGraph* m_graph;
+
+            bool await_ready() noexcept { return m_graph->size() == 0; }   //nothing to do
+
+            /**
+            * \brief Run the graph, the Coro is resumed when all nodes have finished.
+            * \param[in] h Handle of the awaiting Coro.
+            * \returns true to suspend the Coro.
+            */
+            template<typename H>
+            bool await_suspend(H h) {
+                m_graph->run(&h.promise());
+                return true;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        awaiter operator co_await() & noexcept { return { this }; }
+    };
+
+    /**
+    * \brief Called by JobSystem::on_finished() when a node of a task graph has finished.
+    * \param[in] job The Job of the node.
+    */
+    inline void graph_node_finished(Job* job) noexcept {
+        job->m_graph->finished(job->m_node);
+    }
+
+    /**
+    * \brief Read and check the header of a binary log file.
+    * \param[in] in The stream of the file.
+    * \returns true if the file has the expected magic, version and event size.
+    */
+    inline bool read_trace_header(std::istream& in) {
+        TraceFileHeader header, expected;
+        return in.read((char*)&header, sizeof(header))
+            && std::equal(std::begin(header.m_magic), std::end(header.m_magic), std::begin(expected.m_magic))
+            && header.m_version == expected.m_version && header.m_event_size == expected.m_event_size;
+    }
+
+    /**
+    * \brief Read all events of a binary log file into memory, e.g. to analyze them.
+    * \param[in] in_name Name of the binary log file.
+    * \param[out] events The events are appended here, in the order they were drained.
+    * \returns true if the file could be read, else false.
+    */
+    inline bool read_trace(const std::string& in_name, std::vector<TraceEvent>& events) {
+        std::ifstream in(in_name, std::ios::binary);
+        if (!read_trace_header(in)) return false;
+        TraceEvent ev;
+        while (in.read((char*)&ev, sizeof(ev))) events.push_back(ev);
+        return true;
+    }
+
+    /**
+    * \brief Convert a binary log file into a json file for chrome://tracing or Perfetto.
+    *
+    * The events are converted one by one as they are read, so files of any size can be exported.
+    * Job runs become slices of their thread, named after their type, see JobSystem::types().
+    * Scheduling a job draws a flow arrow from the scheduling job to the start of the job,
+    * and steals are shown as instant events.
+    *
+    * \param[in] in_name Name of the binary log file.
+    * \param[in] out_name Name of the json file.
+    * \returns true if the file was exported, else false.
+    */
+    inline bool export_trace(const std::string& in_name, const std::string& out_name) {
+        std::ifstream in(in_name, std::ios::binary);
+        if (!read_trace_header(in)) return false;
+
+        std::ofstream out(out_name);
+        if (!out) return false;
+
+        auto& types = JobSystem().types();
+        auto us = [](uint64_t ns) { return std::format("{}.{:03}", ns / 1000, ns % 1000); };   //chrome wants microseconds
+        const char* separator = "";
+        auto emit = [&](const std::string& event) {
+            out << separator << event;
+            separator = ",\n";
+        };
+
+        out << "{\n\"traceEvents\": [\n";
+        TraceEvent ev;
+        while (in.read((char*)&ev, sizeof(ev))) {
+            switch (ev.m_type) {
+            case TraceEventType::job_scheduled:
+                emit(std::format(R"({{"cat": "job", "name": "schedule", "ph": "s", "pid": 0, "tid": {}, "ts": {}, "id": {}, "args": {{"parent": {}, "target": {}}}}})",
+                    ev.m_thread, us(ev.m_time), ev.m_job_id, ev.m_data, ev.m_value));
+                break;
+            case TraceEventType::job_started: {
+                auto it = types.find((int32_t)ev.m_value);
+                std::string name = it != types.end() ? it->second : "-";
+                emit(std::format(R"({{"cat": "job", "name": "{}", "ph": "B", "pid": 0, "tid": {}, "ts": {}, "args": {{"id": {}, "job": {}, "wait_us": {}}}}})",
+                    name, ev.m_thread, us(ev.m_time), ev.m_id, ev.m_job_id, us(ev.m_data)));
+                emit(std::format(R"({{"cat": "job", "name": "schedule", "ph": "f", "bp": "e", "pid": 0, "tid": {}, "ts": {}, "id": {}}})",
+                    ev.m_thread, us(ev.m_time), ev.m_job_id));
+                break;
+            }
+            case TraceEventType::job_finished:
+                emit(std::format(R"({{"cat": "job", "ph": "E", "pid": 0, "tid": {}, "ts": {}}})", ev.m_thread, us(ev.m_time)));
+                break;
+            case TraceEventType::job_stolen:
+                emit(std::format(R"({{"cat": "steal", "name": "steal", "ph": "i", "s": "t", "pid": 0, "tid": {}, "ts": {}, "args": {{"victim": {}, "jobs": {}, "job": {}}}}})",
+                    ev.m_thread, us(ev.m_time), ev.m_value, ev.m_data, ev.m_job_id));
+                break;
+            case TraceEventType::events_dropped:
+                emit(std::format(R"({{"cat": "log", "name": "events dropped", "ph": "i", "s": "g", "pid": 0, "tid": 0, "ts": {}, "args": {{"thread": {}, "events": {}}}}})",
+                    us(ev.m_time), (int32_t)ev.m_value, ev.m_data));
+                break;
+            case TraceEventType::job_continued:
+                emit(std::format(R"({{"cat": "job", "name": "continue", "ph": "i", "s": "t", "pid": 0, "tid": {}, "ts": {}, "args": {{"job": {}, "after": {}}}}})",
+                    ev.m_thread, us(ev.m_time), ev.m_job_id, ev.m_data));
+                break;
+            }
         }
-        outdata.close();
-        JobSystem().clear_logs();
+        out << "\n],\n\"displayTimeUnit\": \"ms\"\n}\n";
+        return true;
+    }
+
+    /**
+    * \brief Export the binary log file "log.vgjs" to the json file "log.json".
+    */
+    inline void save_log_file() {
+        export_trace("log.vgjs", "log.json");
     }
 
 }
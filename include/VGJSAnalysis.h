@@ -0,0 +1,330 @@
+#ifndef VGJSANALYSIS_H
+#define VGJSANALYSIS_H
+
+
+/**
+*
+* \file
+* \brief Critical path and scalability analysis of a recorded trace.
+*
+* The trace of a run, recorded with enable_logging() or enable_tracing(), is turned back into the
+* graph of the jobs that ran. Each run of a job on a thread is a segment: a function job has one, a coro
+* one for each time it was resumed. A segment depends on
+* - the previous segment of the same job,
+* - the segment that released it: the job that was running on the thread that scheduled it, up to
+*   the moment it was scheduled, or the job that had just finished there, e.g. the last child of a
+*   coro or the stage before in a chain,
+* - all finished children, grandchildren, ... of its job, if it is a coro going on after waiting,
+* - all of the job that it continues, if it is a continuation.
+*
+* From this graph follow the total work T1 (the sum of all segments), the critical path Tinf (the
+* longest chain of dependent segments), the parallelism T1/Tinf and the parallel slack at P threads.
+* Since no schedule can be faster than max(T1/P, Tinf) and a greedy scheduler is not slower than
+* (T1 - Tinf)/P + Tinf, these bound the speedup at other thread counts. The time a run took beyond the greedy
+* bound goes to scheduling overhead and load imbalance, the idle gaps of the workers show where.
+*
+*/
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+#include "VGJS.h"
+
+
+namespace vgjs {
+
+    /**
+    * \brief One run of a job on a thread, from job_started to job_finished.
+    */
+    struct TraceSegment {
+        uint64_t    m_job = 0;          ///<unique id of the job, or 0 if it was not known
+        uint64_t    m_start = 0;        ///<ns since the job system was started
+        uint64_t    m_end = 0;          ///<ns since the job system was started
+        uint64_t    m_wait = 0;         ///<ns the job waited in a queue before
+        uint64_t    m_finish = 0;       ///<earliest time the segment can finish with unlimited threads, counted from 0
+        int64_t     m_pred = -1;        ///<the segment that its earliest start depends on, -1 if none
+        int32_t     m_thread = -1;      ///<thread that ran the segment
+        int32_t     m_type = -1;        ///<type of the job, see JobSystem::types()
+
+        uint64_t duration() const noexcept { return m_end - m_start; }
+    };
+
+    /**
+    * \brief How one thread spent the time of the trace.
+    */
+    struct WorkerProfile {
+        int32_t     m_thread = -1;      ///<thread index, -1 for threads outside the pools
+        uint64_t    m_segments = 0;     ///<number of segments it ran
+        uint64_t    m_busy = 0;         ///<ns running segments
+        uint64_t    m_idle = 0;         ///<ns between its segments, and before the first and after the last one
+        uint64_t    m_gaps = 0;         ///<number of idle gaps
+        uint64_t    m_max_gap = 0;      ///<the longest idle gap in ns
+        uint64_t    m_wait = 0;         ///<ns its segments waited in queues
+    };
+
+    /**
+    * \brief Time that segments of one job type spend on the critical path.
+    */
+    struct CriticalType {
+        int32_t     m_type = -1;        ///<type of the jobs, see JobSystem::types()
+        uint64_t    m_time = 0;         ///<ns on the critical path, a job spawning the next one counts up to the spawn
+        uint64_t    m_segments = 0;     ///<number of segments on the critical path
+    };
+
+    /**
+    * \brief The result of analyze_trace().
+    */
+    struct TraceAnalysis {
+        uint64_t    m_events = 0;           ///<number of trace events
+        uint64_t    m_dropped = 0;          ///<events lost because a ring was full, the graph misses them
+        uint64_t    m_jobs = 0;             ///<jobs with a unique id
+        uint64_t    m_span = 0;             ///<ns from the first start to the last finish
+        uint64_t    m_work = 0;             ///<T1, ns of all segments
+        uint64_t    m_critical_path = 0;    ///<Tinf, ns of the longest chain of dependent segments
+        uint32_t    m_threads = 0;          ///<threads that ran segments
+        std::vector<TraceSegment>   m_segments;         ///<all segments, ordered by start
+        std::vector<std::size_t>    m_critical;         ///<indices of the segments on the critical path, first to last
+        std::vector<CriticalType>   m_critical_types;   ///<job types on the critical path, longest first
+        std::vector<WorkerProfile>  m_workers;          ///<one profile per thread, ordered by thread index
+
+        /**
+        * \returns the parallelism T1/Tinf, the largest useful number of threads.
+        */
+        double parallelism() const noexcept { return m_critical_path > 0 ? (double)m_work / m_critical_path : 0.0; }
+
+        /**
+        * \returns the parallel slack at a number of threads, values well above 1 mean that the threads can be kept busy.
+        */
+        double slack(uint32_t threads) const noexcept { return threads > 0 ? parallelism() / threads : 0.0; }
+
+        /**
+        * \returns the ns no schedule on this number of threads can beat, max(T1/P, Tinf).
+        */
+        double time_bound(uint32_t threads) const noexcept { return std::max((double)m_work / std::max(threads, 1u), (double)m_critical_path); }
+
+        /**
+        * \returns the ns a greedy scheduler on this number of threads needs at most, (T1 - Tinf)/P + Tinf.
+        */
+        double time_greedy(uint32_t threads) const noexcept {
+            return (double)(m_work > m_critical_path ? m_work - m_critical_path : 0) / std::max(threads, 1u) + m_critical_path;
+        }
+
+        /**
+        * \returns the highest possible speedup at this number of threads.
+        */
+        double max_speedup(uint32_t threads) const noexcept { return time_bound(threads) > 0.0 ? m_work / time_bound(threads) : 0.0; }
+
+        /**
+        * \returns the speedup at this number of threads that a greedy scheduler reaches at least.
+        */
+        double min_speedup(uint32_t threads) const noexcept { return time_greedy(threads) > 0.0 ? m_work / time_greedy(threads) : 0.0; }
+
+        /**
+        * \returns the speedup the traced run achieved, T1 divided by the span.
+        */
+        double measured_speedup() const noexcept { return m_span > 0 ? (double)m_work / m_span : 0.0; }
+
+        /**
+        * \returns the ns the traced run took beyond the greedy bound, lost to scheduling overhead and load imbalance.
+        */
+        uint64_t overhead() const noexcept {
+            double greedy = time_greedy(m_threads);
+            return m_span > greedy ? m_span - (uint64_t)greedy : 0;
+        }
+    };
+
+    /**
+    * \brief Reconstruct the job graph of a trace and compute its critical path and scalability.
+    *
+    * The events can come from read_trace() or JobSystem::drain_trace(), in any order between threads.
+    * Segments that were running when recording started are left out, segments that were still running
+    * when it stopped end with the last event. A job that runs other jobs on its thread, e.g. in run_until(),
+    * is split into the segment before and the segment after each nested one, so no time is counted twice.
+    *
+    * \param[in] events The trace events.
+    * \returns the analysis.
+    */
+    inline TraceAnalysis analyze_trace(std::vector<TraceEvent> events) {
+        TraceAnalysis result;
+        result.m_events = events.size();
+        std::stable_sort(events.begin(), events.end(), [](const TraceEvent& a, const TraceEvent& b) { return a.m_time < b.m_time; });  //keeps the order of each thread
+
+        struct JobNode {
+            uint64_t    m_parent = 0;       //unique id of the parent, or 0
+            uint64_t    m_after = 0;        //unique id of the job this one continues, or 0
+            int64_t     m_last = -1;        //last segment of the job
+            int64_t     m_release = -1;     //segment that released the next segment of the job
+            uint64_t    m_release_at = 0;   //earliest time of the release
+            uint64_t    m_done = 0;         //earliest finish of all finished segments of the job and its descendants
+            int64_t     m_done_seg = -1;    //the segment of m_done
+        };
+        struct ThreadState {
+            std::vector<int64_t> m_open;    //segments started on the thread and not finished, the running one last
+            int64_t     m_last = -1;        //segment that finished last on the thread
+            bool        m_after_finish = false;     //no segment has started since m_last finished
+        };
+        std::unordered_map<uint64_t, JobNode> jobs;
+        std::unordered_map<int32_t, ThreadState> threads;
+        auto& segs = result.m_segments;
+
+        auto release = [&](JobNode& job, ThreadState& thread, uint64_t time) {
+            job.m_release = -1;
+            if (!thread.m_open.empty()) {       //released while the segment runs, e.g. a child that was scheduled
+                auto& seg = segs[thread.m_open.back()];
+                job.m_release = thread.m_open.back();
+                job.m_release_at = seg.m_finish + (time - seg.m_start);  //m_finish is the earliest start while it runs
+            }
+            else if (thread.m_after_finish) {   //released by its finish
+                job.m_release = thread.m_last;
+                job.m_release_at = segs[thread.m_last].m_finish;
+            }
+        };
+
+        auto close = [&](int64_t index, uint64_t time) {
+            auto& seg = segs[index];
+            seg.m_end = time;
+            seg.m_finish += seg.duration();
+            if (seg.m_job != 0) jobs[seg.m_job].m_last = index;
+            uint64_t id = seg.m_job;
+            for (std::size_t steps = 0; id != 0 && steps <= jobs.size(); ++steps) {     //the job and its ancestors, ids can repeat in broken traces
+                auto it = jobs.find(id);
+                if (it == jobs.end() || (it->second.m_done_seg >= 0 && it->second.m_done >= seg.m_finish)) break;
+                it->second.m_done = seg.m_finish;
+                it->second.m_done_seg = index;
+                id = it->second.m_parent;
+            }
+        };
+
+        for (auto& ev : events) {
+            switch (ev.m_type) {
+            case TraceEventType::job_scheduled: {
+                if (ev.m_job_id == 0) break;
+                auto& job = jobs[ev.m_job_id];
+                if (job.m_parent == 0) job.m_parent = ev.m_data;
+                release(job, threads[ev.m_thread], ev.m_time);
+                break;
+            }
+            case TraceEventType::job_continued:
+                if (ev.m_job_id != 0) jobs[ev.m_job_id].m_after = ev.m_data;
+                break;
+            case TraceEventType::job_started: {
+                auto& thread = threads[ev.m_thread];
+                if (!thread.m_open.empty()) close(thread.m_open.back(), ev.m_time);    //nested, e.g. run_until() in a job, the outer segment pauses
+                TraceSegment seg{ ev.m_job_id, ev.m_time, ev.m_time, ev.m_data, 0, -1, ev.m_thread, (int32_t)ev.m_value };
+                auto after = [&](int64_t pred, uint64_t finish) {
+                    if (pred >= 0 && (seg.m_pred < 0 || finish > seg.m_finish)) {
+                        seg.m_finish = finish;
+                        seg.m_pred = pred;
+                    }
+                };
+                bool released = false;
+                if (ev.m_job_id != 0) {
+                    auto& job = jobs[ev.m_job_id];
+                    if (job.m_last >= 0) after(job.m_last, segs[job.m_last].m_finish);     //the previous segment
+                    after(job.m_done_seg, job.m_done);      //all children that have finished
+                    if (job.m_after != 0 && job.m_last < 0) {
+                        auto it = jobs.find(job.m_after);
+                        if (it != jobs.end()) after(it->second.m_done_seg, it->second.m_done);     //all of the continued job
+                    }
+                    if (job.m_release >= 0) {
+                        after(job.m_release, job.m_release_at);
+                        released = true;
+                    }
+                    job.m_release = -1;
+                }
+                if (!released && thread.m_after_finish) after(thread.m_last, segs[thread.m_last].m_finish);    //symmetric transfer, nothing was scheduled
+                thread.m_open.push_back((int64_t)segs.size());
+                thread.m_after_finish = false;
+                segs.push_back(seg);
+                break;
+            }
+            case TraceEventType::job_finished: {
+                auto& thread = threads[ev.m_thread];
+                if (thread.m_open.empty()) break;       //started before recording
+                auto index = thread.m_open.back();
+                thread.m_open.pop_back();
+                close(index, ev.m_time);
+                thread.m_last = index;
+                thread.m_after_finish = true;
+                if (thread.m_open.empty()) break;
+                auto& outer = segs[thread.m_open.back()];       //the paused segment continues in a new one, after both parts
+                TraceSegment seg{ outer.m_job, ev.m_time, ev.m_time, 0, std::max(outer.m_finish, segs[index].m_finish), -1, ev.m_thread, outer.m_type };
+                seg.m_pred = outer.m_finish >= segs[index].m_finish ? thread.m_open.back() : index;
+                thread.m_open.back() = (int64_t)segs.size();
+                thread.m_after_finish = false;
+                segs.push_back(seg);
+                break;
+            }
+            case TraceEventType::events_dropped:
+                result.m_dropped += ev.m_data;
+                break;
+            default:
+                break;
+            }
+        }
+        result.m_jobs = jobs.size();
+        if (segs.empty()) return result;
+        for (auto& [id, thread] : threads) {
+            if (!thread.m_open.empty()) close(thread.m_open.back(), events.back().m_time);    //the paused ones are closed already
+        }
+
+        uint64_t first = segs.front().m_start, last = 0;
+        std::size_t end = 0;
+        std::unordered_map<int32_t, WorkerProfile> workers;
+        for (std::size_t i = 0; i < segs.size(); ++i) {
+            auto& seg = segs[i];
+            last = std::max(last, seg.m_end);
+            result.m_work += seg.duration();
+            if (seg.m_finish > segs[end].m_finish) end = i;
+            auto& worker = workers[seg.m_thread];
+            worker.m_thread = seg.m_thread;
+            ++worker.m_segments;
+            worker.m_busy += seg.duration();
+            worker.m_wait += seg.m_wait;
+        }
+        result.m_span = last - first;
+        result.m_critical_path = segs[end].m_finish;
+
+        for (int64_t i = (int64_t)end; i >= 0; i = segs[i].m_pred) result.m_critical.push_back((std::size_t)i);
+        std::reverse(result.m_critical.begin(), result.m_critical.end());
+        std::unordered_map<int32_t, CriticalType> types;
+        for (std::size_t k = 0; k < result.m_critical.size(); ++k) {
+            auto& seg = segs[result.m_critical[k]];
+            uint64_t start = seg.m_finish - seg.duration();         //earliest start
+            uint64_t until = k + 1 < result.m_critical.size() ? segs[result.m_critical[k + 1]].m_finish - segs[result.m_critical[k + 1]].duration() : seg.m_finish;
+            auto& type = types[seg.m_type];
+            type.m_type = seg.m_type;
+            type.m_time += until - start;
+            ++type.m_segments;
+        }
+        for (auto& [type, critical] : types) result.m_critical_types.push_back(critical);
+        std::sort(result.m_critical_types.begin(), result.m_critical_types.end(), [](auto& a, auto& b) { return a.m_time > b.m_time; });
+
+        std::unordered_map<int32_t, uint64_t> free_at;      //end of the last segment of each thread
+        auto gap = [&](WorkerProfile& worker, uint64_t from, uint64_t to) {
+            if (to <= from) return;
+            worker.m_idle += to - from;
+            ++worker.m_gaps;
+            worker.m_max_gap = std::max(worker.m_max_gap, to - from);
+        };
+        for (auto& seg : segs) {                //segments of a thread do not overlap and are ordered by start
+            auto [it, inserted] = free_at.try_emplace(seg.m_thread, first);
+            gap(workers[seg.m_thread], it->second, seg.m_start);
+            it->second = std::max(it->second, seg.m_end);
+        }
+        for (auto& [thread, worker] : workers) {
+            gap(worker, free_at[thread], last);
+            result.m_workers.push_back(worker);
+        }
+        std::sort(result.m_workers.begin(), result.m_workers.end(), [](auto& a, auto& b) { return a.m_thread < b.m_thread; });
+        result.m_threads = (uint32_t)result.m_workers.size();
+        return result;
+    }
+
+}
+
+#endif
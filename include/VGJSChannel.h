@@ -0,0 +1,521 @@
+#ifndef VGJSCHANNEL_H
+#define VGJSCHANNEL_H
+
+
+/**
+*
+* \file
+* \brief Bounded channels between coroutines, and pipelines built from them.
+*
+* A Channel is a bounded ring buffer that many coroutines can push into and pop from at the same time.
+* Pushing and popping do not take a lock and do not suspend, unless the channel is full or empty.
+* Only then the coroutine is put into a waiting list, and it is scheduled again when another coroutine
+* has made room or has pushed a value. This way a producer and a consumer run without a context switch
+* per element, and a fast producer is slowed down by a full channel.
+*
+* A Pipeline links stages through channels. Each stage runs as one or more worker coroutines.
+*
+*/
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "VGJS.h"
+#include "VGJSCoro.h"
+
+
+namespace vgjs {
+
+    /**
+    * \brief A bounded multi-producer multi-consumer channel for coroutines.
+    *
+    * The ring buffer uses a sequence number per cell, so producers and consumers only compete for
+    * their ends of the ring. A mutex protects the lists of suspended coroutines. It is only
+    * taken when a coroutine has to wait, or when someone is waiting.
+    *
+    * A closed channel does not accept new values, but the values in it can still be popped.
+    * The channel must stay alive until all coroutines using it have finished.
+    *
+    * \tparam T The value type, it must be default constructible and movable.
+    * \tparam N The capacity, a power of 2.
+    */
+    template<typename T, std::size_t N = 64>
+    class Channel {
+        static_assert(N >= 2 && (N & (N - 1)) == 0, "The capacity of a Channel must be a power of 2");
+
+        /**
+        * \brief A suspended coroutine. It lives in the awaiter, i.e. in the frame of the coroutine.
+        */
+        struct Waiter {
+            Waiter*     m_next = nullptr;       //next waiter in the list
+            Job_base*   m_job = nullptr;        //the suspended coroutine
+            T*          m_value = nullptr;      //the value to push, or where to put the popped value
+            bool        m_ok = false;           //true if the value has been pushed or popped
+        };
+
+        /**
+        * \brief A FIFO list of waiters.
+        */
+        struct WaiterList {
+            Waiter* m_first = nullptr;
+            Waiter* m_last = nullptr;
+
+            void push(Waiter* w) noexcept {
+                w->m_next = nullptr;
+                if (m_first == nullptr) m_first = w;
+                else m_last->m_next = w;
+                m_last = w;
+            }
+
+            Waiter* pop() noexcept {
+                Waiter* w = m_first;
+                m_first = w->m_next;
+                if (m_first == nullptr) m_last = nullptr;
+                return w;
+            }
+        };
+
+        struct Cell {
+            std::atomic<std::size_t>    m_sequence;     //position this cell can be pushed to, plus 1 if it holds a value
+            T                           m_value{};
+        };
+
+        alignas(64) std::atomic<std::size_t>    m_tail = 0;         //next position to push to
+        alignas(64) std::atomic<std::size_t>    m_head = 0;         //next position to pop from
+        alignas(64) std::array<Cell, N>         m_cells;
+        alignas(64) std::atomic<uint32_t>       m_waiting = 0;      //number of suspended coroutines
+        std::atomic<bool>                       m_closed = false;
+        std::atomic<int32_t>                    m_writers = 0;      //the channel is closed when the last writer is done
+        std::mutex                              m_mutex;            //protects the waiter lists and closing
+        WaiterList                              m_pushers;          //coroutines waiting for room
+        WaiterList                              m_poppers;          //coroutines waiting for a value
+
+        /**
+        * \brief Put a value into the ring.
+        * \param[in] value The value, it is moved only if there is room.
+        * \returns false if the channel is full.
+        */
+        bool enqueue(T& value) noexcept {
+            std::size_t pos = m_tail.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = m_cells[pos & (N - 1)];
+                std::size_t seq = cell.m_sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if (diff == 0) {
+                    if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.m_value = std::move(value);
+                        cell.m_sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;       //the consumers have not freed this cell yet
+                }
+                else {
+                    pos = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+        * \brief Take a value from the ring.
+        * \param[out] value The value.
+        * \returns false if the channel is empty.
+        */
+        bool dequeue(T& value) noexcept {
+            std::size_t pos = m_head.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = m_cells[pos & (N - 1)];
+                std::size_t seq = cell.m_sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (diff == 0) {
+                    if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        value = std::move(cell.m_value);
+                        cell.m_sequence.store(pos + N, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;       //no producer has filled this cell yet
+                }
+                else {
+                    pos = m_head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /**
+        * \brief Let waiters go on as far as possible. Call only while holding the mutex.
+        * \returns a list of the waiters that are done, they must be resumed.
+        */
+        Waiter* serve() noexcept {
+            WaiterList done;
+            uint32_t num = 0;
+            bool progress = true;
+            while (progress) {      //a served pusher may serve a popper and vice versa
+                progress = false;
+                while (m_poppers.m_first != nullptr && dequeue(*m_poppers.m_first->m_value)) {
+                    Waiter* w = m_poppers.pop();
+                    w->m_ok = true;
+                    done.push(w);
+                    ++num;
+                    progress = true;
+                }
+                while (m_pushers.m_first != nullptr && !m_closed.load(std::memory_order_relaxed) && enqueue(*m_pushers.m_first->m_value)) {
+                    Waiter* w = m_pushers.pop();
+                    w->m_ok = true;
+                    done.push(w);
+                    ++num;
+                    progress = true;
+                }
+            }
+            if (m_closed.load(std::memory_order_relaxed)) {     //nothing more will come
+                while (m_poppers.m_first != nullptr) { done.push(m_poppers.pop()); ++num; }
+                while (m_pushers.m_first != nullptr) { done.push(m_pushers.pop()); ++num; }
+            }
+            if (num > 0) m_waiting.fetch_sub(num, std::memory_order_relaxed);
+            return done.m_first;
+        }
+
+        /**
+        * \brief Schedule the coroutines of a list of waiters.
+        * \param[in] list The waiters.
+        * \param[in] self A waiter that is not scheduled, because its coroutine is running.
+        * \returns true if self was in the list.
+        */
+        static bool resume(Waiter* list, Waiter* self = nullptr) noexcept {
+            bool found = false;
+            while (list != nullptr) {
+                Waiter* w = list;
+                list = w->m_next;               //the waiter is gone once its coroutine runs
+                if (w == self) found = true;
+                else JobSystem().schedule_job(w->m_job);
+            }
+            return found;
+        }
+
+        /**
+        * \brief Serve the waiters, if there are any.
+        */
+        void notify() noexcept {
+            std::atomic_thread_fence(std::memory_order_seq_cst);    //the ring must be visible before looking at the waiters
+            if (m_waiting.load(std::memory_order_relaxed) == 0) [[likely]] return;
+            Waiter* done;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                done = serve();
+            }
+            resume(done);
+        }
+
+        /**
+        * \brief Put a coroutine into a waiting list, unless it can go on right away.
+        * \param[in] w The waiter.
+        * \param[in] list The list.
+        * \returns true if the coroutine must suspend.
+        */
+        bool suspend(Waiter* w, WaiterList& list) noexcept {
+            Waiter* done;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                list.push(w);
+                m_waiting.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);    //see notify()
+                done = serve();     //the ring may have changed since the try
+            }
+            return !resume(done, w);
+        }
+
+    public:
+        Channel() noexcept {
+            for (std::size_t i = 0; i < N; ++i) m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+        }
+
+        Channel(const Channel&) = delete;
+        Channel& operator=(const Channel&) = delete;
+
+        /**
+        * \returns the capacity of the channel.
+        */
+        static constexpr std::size_t capacity() noexcept { return N; }
+
+        /**
+        * \brief Push a value without waiting. Can be called by any thread.
+        * \param[in] value The value, it is moved only if there is room.
+        * \returns true if the value has been pushed, false if the channel is full or closed.
+        */
+        bool try_push(T& value) noexcept {
+            if (m_closed.load(std::memory_order_acquire) || !enqueue(value)) return false;
+            notify();
+            return true;
+        }
+
+        bool try_push(T&& value) noexcept { return try_push(value); }
+
+        /**
+        * \brief Pop a value without waiting. Can be called by any thread.
+        * \returns the value, or nothing if the channel is empty.
+        */
+        std::optional<T> try_pop() noexcept {
+            T value{};
+            if (!dequeue(value)) return std::nullopt;
+            notify();
+            return std::optional<T>(std::move(value));
+        }
+
+        /**
+        * \brief Close the channel. Waiting poppers get nothing once the channel is empty, waiting pushers fail.
+        */
+        void close() noexcept {
+            Waiter* done;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_closed.store(true, std::memory_order_release);
+                done = serve();
+            }
+            resume(done);
+        }
+
+        /**
+        * \returns true if the channel has been closed.
+        */
+        bool is_closed() const noexcept { return m_closed.load(std::memory_order_acquire); }
+
+        /**
+        * \brief Announce writers. The channel is closed when all writers have called writer_done().
+        * \param[in] num The number of new writers.
+        */
+        void add_writers(int32_t num) noexcept { m_writers.fetch_add(num, std::memory_order_relaxed); }
+
+        /**
+        * \brief A writer will not push any more values. The last one closes the channel.
+        */
+        void writer_done() noexcept {
+            if (m_writers.fetch_sub(1, std::memory_order_acq_rel) == 1) close();
+        }
+
+        /**
+        * \brief Awaiter for co_await channel.push(value).
+        */
+        struct push_awaiter {
+            Channel*    m_channel;
+            T           m_value;
+            Waiter      m_waiter;
+
+            bool await_ready() noexcept {
+                m_waiter.m_ok = m_channel->try_push(m_value);
+                return m_waiter.m_ok || m_channel->is_closed();
+            }
+
+            /**
+            * \brief Wait for room. The coroutine may be resumed by another thread before this returns.
+            * \param[in] h The coro handle, can be used to get the promise.
+            * \returns true if the coroutine suspends.
+            */
+            template<typename P>
+            bool await_suspend(n_exp::coroutine_handle<P> h) noexcept {
+                m_waiter.m_job = &h.promise();
+                m_waiter.m_value = &m_value;
+                return m_channel->suspend(&m_waiter, m_channel->m_pushers);
+            }
+
+            /**
+            * \returns true if the value has been pushed, false if the channel was closed.
+            */
+            bool await_resume() noexcept { return m_waiter.m_ok; }
+        };
+
+        /**
+        * \brief Awaiter for co_await channel.pop().
+        */
+        struct pop_awaiter {
+            Channel*    m_channel;
+            T           m_value{};
+            Waiter      m_waiter;
+
+            bool await_ready() noexcept {
+                m_waiter.m_ok = m_channel->dequeue(m_value);
+                if (m_waiter.m_ok) m_channel->notify();
+                return m_waiter.m_ok || m_channel->is_closed();    //closed and empty
+            }
+
+            /**
+            * \brief Wait for a value. The coroutine may be resumed by another thread before this returns.
+            * \param[in] h The coro handle, can be used to get the promise.
+            * \returns true if the coroutine suspends.
+            */
+            template<typename P>
+            bool await_suspend(n_exp::coroutine_handle<P> h) noexcept {
+                m_waiter.m_job = &h.promise();
+                m_waiter.m_value = &m_value;
+                return m_channel->suspend(&m_waiter, m_channel->m_poppers);
+            }
+
+            /**
+            * \returns the value, or nothing if the channel was closed and empty.
+            */
+            std::optional<T> await_resume() noexcept {
+                if (!m_waiter.m_ok) return std::nullopt;
+                return std::optional<T>(std::move(m_value));
+            }
+        };
+
+        /**
+        * \brief Push a value, e.g. bool ok = co_await channel.push(value). Suspends only while the channel is full.
+        * \param[in] value The value.
+        * \returns the awaitable, co_await returns false if the channel was closed.
+        */
+        push_awaiter push(T value) noexcept { return { this, std::move(value), {} }; }
+
+        /**
+        * \brief Pop a value, e.g. while (auto value = co_await channel.pop()) { ... }. Suspends only while the channel is empty.
+        * \returns the awaitable, co_await returns the value, or nothing if the channel was closed and is empty.
+        */
+        pop_awaiter pop() noexcept { return { this, T{}, {} }; }
+    };
+
+
+    //---------------------------------------------------------------------------------------------------
+    //pipelines
+
+    /**
+    * \brief Worker of a source stage, it pushes the values of f() until f() returns nothing.
+    */
+    template<typename T, std::size_t N, typename F>
+    Coro<> pipeline_source(Channel<T, N>& out, F f) {
+        while (auto value = f()) {
+            if (!co_await out.push(std::move(*value))) break;  //nobody wants more
+        }
+        out.writer_done();
+        co_return;
+    }
+
+    /**
+    * \brief Worker of a stage, it pushes f(value) for all values it pops.
+    */
+    template<typename T, std::size_t N, typename U, std::size_t M, typename F>
+    Coro<> pipeline_stage(Channel<T, N>& in, Channel<U, M>& out, F f) {
+        while (auto value = co_await in.pop()) {
+            if (!co_await out.push(f(std::move(*value)))) break;
+        }
+        out.writer_done();
+        co_return;
+    }
+
+    /**
+    * \brief Worker of a sink stage, it calls f(value) for all values it pops.
+    */
+    template<typename T, std::size_t N, typename F>
+    Coro<> pipeline_sink(Channel<T, N>& in, F f) {
+        while (auto value = co_await in.pop()) {
+            f(std::move(*value));
+        }
+        co_return;
+    }
+
+
+    /**
+    * \brief Stages that are linked by channels, e.g.
+    *
+    *     Channel<Packet> packets;
+    *     Channel<Frame, 16> frames;
+    *     Pipeline pipeline;
+    *     pipeline.source(packets, [&]() { return reader.next(); })     //returns a std::optional<Packet>
+    *             .stage(packets, frames, [](Packet&& p) { return decode(p); }, 4)
+    *             .sink(frames, [&](Frame&& f) { upload(f); });
+    *     co_await pipeline;
+    *
+    * Each stage runs as the given number of worker coros, each worker calls its own copy of the function.
+    * When all workers of a stage are done, the output channel of the stage is closed, so the next stage
+    * finishes too. A full channel suspends the stage before it, which gives backpressure.
+    * The channels must be given to only one stage as output and must outlive the pipeline.
+    * A pipeline runs once.
+    */
+    class Pipeline {
+        n_pmr::vector<Coro<>> m_workers;    //the workers of all stages
+
+    public:
+        Pipeline() noexcept {};
+        Pipeline(const Pipeline&) = delete;
+        Pipeline& operator=(const Pipeline&) = delete;
+
+        /**
+        * \brief Add a source stage.
+        * \param[in] out The channel the stage pushes into.
+        * \param[in] f A function returning a std::optional<T>, the stage ends when it returns nothing.
+        * \param[in] parallelism Number of workers.
+        * \returns the pipeline.
+        */
+        template<typename T, std::size_t N, typename F>
+        Pipeline& source(Channel<T, N>& out, F f, uint32_t parallelism = 1) {
+            out.add_writers((int32_t)parallelism);
+            for (uint32_t i = 0; i < parallelism; ++i) m_workers.emplace_back(pipeline_source(out, f));
+            return *this;
+        }
+
+        /**
+        * \brief Add a stage that turns values of one channel into values of another channel.
+        * \param[in] in The channel the stage pops from.
+        * \param[in] out The channel the stage pushes into.
+        * \param[in] f A function computing a U from a T.
+        * \param[in] parallelism Number of workers.
+        * \returns the pipeline.
+        */
+        template<typename T, std::size_t N, typename U, std::size_t M, typename F>
+        Pipeline& stage(Channel<T, N>& in, Channel<U, M>& out, F f, uint32_t parallelism = 1) {
+            out.add_writers((int32_t)parallelism);
+            for (uint32_t i = 0; i < parallelism; ++i) m_workers.emplace_back(pipeline_stage(in, out, f));
+            return *this;
+        }
+
+        /**
+        * \brief Add the last stage.
+        * \param[in] in The channel the stage pops from.
+        * \param[in] f A function that is called with each value.
+        * \param[in] parallelism Number of workers.
+        * \returns the pipeline.
+        */
+        template<typename T, std::size_t N, typename F>
+        Pipeline& sink(Channel<T, N>& in, F f, uint32_t parallelism = 1) {
+            for (uint32_t i = 0; i < parallelism; ++i) m_workers.emplace_back(pipeline_sink(in, f));
+            return *this;
+        }
+
+        /**
+        * \returns the number of worker coros.
+        */
+        std::size_t size() const noexcept { return m_workers.size(); }
+
+        /**
+        * \brief Awaiter for co_await pipeline.
+        */
+        struct awaiter {
+            Pipeline* m_pipeline;
+
+            bool await_ready() noexcept { return m_pipeline->m_workers.empty(); }
+
+            /**
+            * \brief Start all workers, the Coro is resumed when all of them have finished.
+            * \param[in] h Handle of the awaiting Coro.
+            * \returns true to suspend the Coro.
+            */
+            template<typename H>
+            bool await_suspend(H h) noexcept {
+                schedule(m_pipeline->m_workers, tag_t{}, &h.promise());
+                return true;
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        awaiter operator co_await() & noexcept { return { this }; }
+    };
+
+}
+
+#endif
@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <assert.h>
 #include <utility>
+#include <exception>
 
 
 
@@ -55,6 +56,10 @@ namespace vgjs {
     template<typename T>
     concept CORO = std::is_base_of_v<Coro_base, std::decay_t<T> >; //resolve only for coroutines
 
+    template<typename T>
+    concept AWAITER = requires(T& t) { t.await_ready(); t.await_resume(); }   //e.g. parallel_for(), used as is
+        || requires(T& t) { t.operator co_await(); };                           //e.g. a TaskGraph
+
     /**
     * \brief Schedule a Coro into the job system.
     * Basic function for scheduling a coroutine Coro into the job system.
@@ -76,9 +81,9 @@ namespace vgjs {
             }
         }
         else {                                  //schedule for future tag - the promise will not be available then
-            promise->set_self_destruct(true);
             promise->m_parent = nullptr;
         }
+        promise->start();                       //the frame is now owned by the job system until it suspends
         js.schedule_job( promise, tg );      //schedule the promise as job
         return 1;
     };
@@ -91,7 +96,22 @@ namespace vgjs {
         if (current == nullptr || !current->is_function()) {
             return;
         }
-        ((Job*)current)->m_continuation = coro.promise();
+        bool added = ((Job*)current)->add_continuation(coro.promise());
+        assert(added);                          //a function can have only one Coro continuation
+        if (!added) return;                     //the Coro is not started, its future destroys it
+        coro.promise()->start();                //the continuation runs only after the current job has returned
+    };
+
+
+    /**
+    * \brief Run jobs on this thread until a scheduled Coro has produced its result.
+    * Can also be called by threads outside the job system, e.g. the main thread.
+    * \param[in] coro The Coro to wait for.
+    */
+    template<typename T>
+    requires CORO<T>
+    void wait(T& coro) noexcept {
+        JobSystem().run_until([&]() { return coro.ready(); });
     };
 
 
@@ -137,27 +157,32 @@ namespace vgjs {
 
 
     /**
-    * \brief Awaitable for changing the thread that the coro is run on.
-    * After suspending the thread number is set to the target thread, then the job
-    * is immediately rescheduled into the system
+    * \brief Awaitable for changing the thread or the pool that the coro is run on.
+    * After suspending the thread number is set to the target thread, or the coro is moved
+    * into the target pool, then the job is immediately rescheduled into the system
     */
     template<typename PT>
     struct awaitable_resume_on : suspend_always {
-        thread_index_t m_thread_index; //the thread index to use
+        thread_index_t m_thread_index;  //the thread index to use
+        pool_t         m_pool;          //the pool to use if no thread is given
 
         /**
-        * \brief Test whether the job is already on the right thread.
+        * \brief Test whether the job is already on the right thread, or on an unpinned thread of the right pool.
         */
         bool await_ready() noexcept {   //do not go on with suspension if the job is already on the right thread
+            if (m_pool.value >= 0) {
+                return m_pool == JobSystem().get_pool() && JobSystem::current_job()->m_thread_index.value < 0;
+            }
             return (m_thread_index == JobSystem().get_thread_index());
         }
 
         /**
-        * \brief Set the thread index and reschedule the coro
+        * \brief Set the thread index or the pool and reschedule the coro
         * \param[in] h The coro handle, can be used to get the promise.
         */
         void await_suspend(n_exp::coroutine_handle<Coro_promise<PT>> h) noexcept {
             h.promise().m_thread_index = m_thread_index;
+            if (m_pool.value >= 0) h.promise().m_pool = m_pool;     //the coro and its future children stay in the new pool
             JobSystem().schedule_job(&h.promise());
         }
 
@@ -165,9 +190,33 @@ namespace vgjs {
         * \brief Awaiter constructor
         * \parameter[in] thread_index Number of the thread to migrate to
         */
-        awaitable_resume_on(thread_index_t index) noexcept : m_thread_index(index) {};
+        awaitable_resume_on(thread_index_t index) noexcept : m_thread_index(index), m_pool{} {};
+
+        /**
+        * \brief Awaiter constructor
+        * \parameter[in] pool The pool to migrate to, any of its workers can resume the coro
+        */
+        awaitable_resume_on(pool_t pool) noexcept : m_thread_index{}, m_pool(pool) {};
     };
 
+    /**
+    * \brief Move a coro to another thread, e.g. co_await resume_on(thread_index_t{ 0 }).
+    * \param[in] index The thread.
+    * \returns the thread index, which can be awaited.
+    */
+    inline thread_index_t resume_on(thread_index_t index) noexcept {
+        return index;
+    }
+
+    /**
+    * \brief Move a coro to another worker pool, e.g. co_await resume_on(pool_t{ 1 }).
+    * \param[in] pool The pool.
+    * \returns the pool, which can be awaited.
+    */
+    inline pool_t resume_on(pool_t pool) noexcept {
+        return pool;
+    }
+
 
     /**
     * \brief Awaitable for scheduling a tag
@@ -211,6 +260,93 @@ namespace vgjs {
     };
 
 
+    /**
+    * \brief Awaitable for running a single child coro eagerly, create it with eager().
+    *
+    * Instead of putting the child into a queue, the awaiting thread suspends the parent and
+    * continues with the child right away by symmetric transfer (work-first). Once the child
+    * finishes, it resumes the parent the same way. Other jobs in the queues stay stealable.
+    * If the child is pinned to another thread, it is scheduled as usual.
+    */
+    template<typename C>
+    struct awaitable_eager : suspend_always {
+        C* m_coro;      ///<the child coro
+
+        /**
+        * \brief Start the child as the next job of this thread.
+        * \param[in] h The coro handle of the parent.
+        * \returns the handle of the child, or a noop handle if the child has been scheduled.
+        */
+        template<typename P>
+        n_exp::coroutine_handle<> await_suspend(n_exp::coroutine_handle<P> h) noexcept {
+            auto promise = m_coro->promise();
+            promise->m_parent = &h.promise();
+            h.promise().m_children.fetch_add(1);    //await the child
+            promise->start();                       //the frame is now owned by the job system until it suspends
+            return JobSystem().transfer(promise) ? promise->transfer() : n_exp::noop_coroutine();
+        }
+
+        /**
+        * \brief Return the result of the child, or rethrow its exception.
+        * \returns the result of the child.
+        */
+        auto await_resume() { return m_coro->get(); }
+
+        /**
+        * \brief Awaiter constructor
+        * \parameter[in] coro The child coro
+        */
+        awaitable_eager(C* coro) noexcept : m_coro(coro) {};
+    };
+
+
+    /**
+    * \brief Await a single child coro eagerly, e.g. co_await eager(child(n)).
+    * \param[in] coro The child coro.
+    * \returns the awaitable.
+    */
+    template<typename T>
+    requires CORO<T>
+    inline awaitable_eager<std::remove_reference_t<T>> eager(T&& coro) noexcept {
+        return { &coro };
+    }
+
+
+    /**
+    * \brief Awaitable for sleeping. The coro is suspended and put into the timer wheel,
+    * so no thread is busy with it until the time has passed.
+    */
+    struct awaitable_after : suspend_always {
+        std::chrono::nanoseconds m_delay;   //time to sleep
+
+        /**
+        * \brief Do not suspend if there is nothing to wait for.
+        */
+        bool await_ready() noexcept { return m_delay.count() <= 0; }
+
+        /**
+        * \brief Add a timer that schedules the coro again.
+        * \param[in] h The coro handle, can be used to get the promise.
+        */
+        template<typename P>
+        void await_suspend(n_exp::coroutine_handle<P> h) noexcept {
+            JobSystem js;
+            js.add_timer(&h.promise(), js.trace_time() + m_delay.count());
+        }
+
+        awaitable_after(std::chrono::nanoseconds delay) noexcept : m_delay(delay) {};
+    };
+
+    /**
+    * \brief Sleep without occupying a thread, e.g. co_await after(5ms).
+    * \param[in] delay The time to sleep.
+    * \returns the awaitable.
+    */
+    inline awaitable_after after(std::chrono::nanoseconds delay) noexcept {
+        return { delay };
+    }
+
+
     /**
     * \brief Awaitable for scheduling jobs.
     * All jobs are put into std::tuples.
@@ -264,6 +400,8 @@ namespace vgjs {
         *
         */
         bool await_suspend(n_exp::coroutine_handle<Coro_promise<PT>> h) noexcept {
+            tag_t tag = m_tag;          //after the last schedule() the parent may run and destroy this awaitable
+            std::size_t number = m_number;
             auto g = [&, this]<std::size_t Idx>() {
 
                 using tt = decltype(m_tuple);
@@ -286,8 +424,8 @@ namespace vgjs {
                         int i = 3;
                     }*/
 
-                    schedule(std::forward<T>(children), m_tag, &h.promise(), (int)m_number);   //in first call the number of children is the total number of all jobs
-                    m_number = 0;                                               //after this always 0
+                    schedule(std::forward<T>(children), tag, &h.promise(), (int)number);   //in first call the number of children is the total number of all jobs
+                    number = 0;                                                 //after this always 0
                 }
             };
 
@@ -297,7 +435,7 @@ namespace vgjs {
 
             f(std::make_index_sequence<sizeof...(Ts)>{}); //call f and create an integer list going from 0 to sizeof(Ts)-1
 
-            return m_tag.value < 0; //if tag value < 0 then schedule now, so return true to suspend
+            return tag.value < 0; //if tag value < 0 then schedule now, so return true to suspend
         }
 
         /**
@@ -313,6 +451,20 @@ namespace vgjs {
             return std::make_tuple(); //ignored by std::tuple_cat
         }
 
+        /**
+        * \brief Collect the results and put them into a tuple
+        *
+        * \param[in] t The current coro promise
+        * \returns a tuple holding the return value.
+        *
+        */
+        template<typename T>
+        requires std::is_void_v<T>
+        decltype(auto) get_val(Coro<T>& t) {
+            t.get();                  //rethrow an exception of the child
+            return std::make_tuple();
+        }
+
         /**
         * \brief Collect the results and put them into a tuple
         *
@@ -375,30 +527,17 @@ namespace vgjs {
     * \brief When a coroutine calls co_yield this awaiter calls its parent.
     *
     * A coroutine calling co_yield suspends with this awaiter. The awaiter is similar
-    * to the final awaiter, but always suspends.
+    * to the final awaiter, but always suspends. If it was the last child of a parent coro,
+    * the parent is resumed right away on the same thread by symmetric transfer.
     */
     template<typename U>
     struct yield_awaiter : public suspend_always {
         /**
         * \brief After suspension, call parent to run it as continuation
         * \param[in] h Handle of the coro, is used to get the promise (=Job)
+        * \returns the handle of the parent if it continues on this thread, else a noop handle.
         */
-        void await_suspend(n_exp::coroutine_handle<Coro_promise<U>> h) noexcept { //called after suspending
-            auto& promise = h.promise();
-
-            if (promise.m_parent != nullptr) {          //if there is a parent
-                if (promise.m_is_parent_function) {       //if it is a Job
-                    JobSystem().child_finished((Job*)promise.m_parent); //indicate that this child has finished
-                }
-                else {  //parent is a coro
-                    uint32_t num = promise.m_parent->m_children.fetch_sub(1);   //one less child
-                    if (num == 1) {                                             //was it the last child?
-                        JobSystem().schedule_job(promise.m_parent);      //if last reschedule the parent coro
-                    }
-                }
-            }
-            return;
-        }
+        n_exp::coroutine_handle<> await_suspend(n_exp::coroutine_handle<Coro_promise<U>> h) noexcept; //called after suspending
     };
 
 
@@ -408,34 +547,20 @@ namespace vgjs {
     * Suspending as last act prevents the promise to be destroyed. This way the caller
     * can retrieve the stored value by calling get(). Also we want to resume the parent
     * if all children have finished their Coros.
-    * If the parent was a Job, then if the Coro<T> is still alive, the coro will suspend,
-    * and the Coro<T> must destroy the promise in its destructor. If the Coro<T> has destructed,
-    * then the coro must destroy the promise itself by resuming the final awaiter.
+    * If the Coro<T> is still alive, the coro will suspend, and the Coro<T> must destroy
+    * the promise in its destructor. If the Coro<T> has destructed, then the coro must destroy
+    * the promise itself. The state word of the promise decides.
+    * If this was the last child of a parent coro, the parent is resumed right away on
+    * the same thread by symmetric transfer.
     */
     template<typename U>
     struct final_awaiter : public suspend_always {
         /**
         * \brief After suspension, call parent to run it as continuation
         * \param[in] h Handle of the coro, is used to get the promise (=Job)
+        * \returns the handle of the parent if it continues on this thread, else a noop handle.
         */
-        bool await_suspend(n_exp::coroutine_handle<Coro_promise<U>> h) noexcept { //called after suspending
-            auto& promise = h.promise();
-            bool is_parent_function = promise.m_is_parent_function;
-            auto parent = promise.m_parent;
-
-            if (parent != nullptr) {          //if there is a parent
-                if (is_parent_function) {       //if it is a Job
-                    JobSystem().child_finished((Job*)parent);//indicate that this child has finished
-                }
-                else {
-                    uint32_t num = parent->m_children.fetch_sub(1);        //one less child
-                    if (num == 1) {                                             //was it the last child?
-                        JobSystem().schedule_job(parent);      //if last reschedule the parent coro
-                    }
-                }
-            }
-            return !is_parent_function; //if parent is coro, then you are in sync -> the future will destroy the promise
-        }
+        n_exp::coroutine_handle<> await_suspend(n_exp::coroutine_handle<Coro_promise<U>> h) noexcept; //called after suspending
     };
 
 
@@ -453,23 +578,80 @@ namespace vgjs {
     class Coro_promise_base : public Job_base {
         template<typename T> friend struct coro_deallocator;
 
+        friend class Coro_base;
+
     protected:
+        static inline const uint32_t c_value     = 1 << 0;  ///<a result is stored in the frame
+        static inline const uint32_t c_exception = 1 << 1;  ///<an exception is stored in the frame
+        static inline const uint32_t c_running   = 1 << 2;  ///<scheduled or running, someone will resume the coro
+        static inline const uint32_t c_finished  = 1 << 3;  ///<the coro suspended at its final suspend point
+        static inline const uint32_t c_detached  = 1 << 4;  ///<the Coro future has been destroyed
+        static inline const uint32_t c_cancelled = 1 << 5;  ///<cancel() has been called
+        static inline const uint32_t c_stopped   = 1 << 6;  ///<the coro was cancelled and stopped before the end of its body
+        static inline thread_local uint64_t t_frame_epoch = 0;  ///<epoch of the frame that operator new has just allocated
+
         n_exp::coroutine_handle<> m_coro;   ///<handle of the coroutine
         bool m_is_parent_function = current_job() == nullptr ? true : current_job()->is_function(); ///<is the parent a Function or nullptr?
-        bool* m_ready_ptr = nullptr;        ///<points to flag which is true if value is ready, else false
-        bool m_self_destruct = false;
+        std::atomic<uint32_t> m_state = 0;  ///<result state and ownership of the frame
+        std::exception_ptr m_exception;     ///<exception that escaped the coro body
+
+        /**
+        * \brief The coro has stored a value, publish it to the future.
+        */
+        void set_value() noexcept { m_state.fetch_or(c_value, std::memory_order_release); };
+
+        /**
+        * \brief The coro suspends at co_yield and nobody will resume it until it is scheduled again.
+        * \returns true if the future is gone and the coro must destroy itself.
+        */
+        bool suspend() noexcept { return (m_state.fetch_and(~c_running, std::memory_order_acq_rel) & c_detached) != 0; };
+
+        /**
+        * \brief The coro reached its final suspend point.
+        * \returns true if the future is still alive and will destroy the frame, false if the coro must destroy itself.
+        */
+        bool finish() noexcept {
+            uint32_t state = m_state.fetch_or(c_finished, std::memory_order_acq_rel);
+            if ((state & c_cancelled) != 0) JobSystem::count_cancellation(-1);  //a cancelled coro has finished
+            return (state & c_detached) == 0;
+        };
+
+        /**
+        * \brief The future is destroyed.
+        * \returns true if the future must destroy the frame, i.e. the coro is done or nobody will resume it.
+        */
+        bool detach() noexcept {
+            uint32_t state = m_state.fetch_or(c_detached, std::memory_order_acq_rel);
+            bool destroy = (state & c_finished) != 0 || (state & c_running) == 0;
+            if (destroy && (state & (c_cancelled | c_finished)) == c_cancelled) {
+                JobSystem::count_cancellation(-1);      //a cancelled coro is destroyed before it finished
+            }
+            return destroy;
+        };
+
+        /**
+        * \brief Stop a cancelled coro instead of resuming it. The rest of the body is skipped and the frame is
+        * destroyed at its suspension point, the parent is informed like by the final awaiter.
+        * \returns the handle of the parent if it continues on this thread, else a noop handle.
+        */
+        n_exp::coroutine_handle<> stop() noexcept;
 
     public:
         /**
         * \brief Constructor
         * \param[in] coro The handle of the coroutine (typeless because the base class does not depend on types)
         */
-        explicit Coro_promise_base(n_exp::coroutine_handle<> coro) noexcept : Job_base(), m_coro(coro) {};
+        explicit Coro_promise_base(n_exp::coroutine_handle<> coro) noexcept : Job_base(), m_coro(coro) {
+            m_epoch = std::exchange(t_frame_epoch, 0);      //set by operator new right before
+        };
 
         /**
         * \brief React to unhandled exceptions
         */
-        void unhandled_exception() noexcept { std::terminate(); };
+        void unhandled_exception() noexcept {
+            m_exception = std::current_exception();
+            m_state.fetch_or(c_exception, std::memory_order_release);
+        };
 
         /**
         * \brief Initially always suspend
@@ -480,8 +662,13 @@ namespace vgjs {
         * \brief Resume the Coro at its suspension point.
         */
         bool resume() noexcept {
-            if (m_is_parent_function && m_ready_ptr != nullptr) {
-                *m_ready_ptr = false;   //invalidate return value
+            if (JobSystem::is_cancelled(this)) [[unlikely]] {
+                stop().resume();        //a parent coro that continues on this thread is resumed right here
+                return true;
+            }
+
+            if (m_is_parent_function) {
+                m_state.fetch_and(~c_value, std::memory_order_relaxed);   //invalidate return value
             }
 
             if (m_coro && !m_coro.done()) {
@@ -490,8 +677,62 @@ namespace vgjs {
             return true;
         };
 
-        void set_self_destruct(bool b = true) { m_self_destruct = b; }
-        bool get_self_destruct() { return m_self_destruct; }
+        /**
+        * \brief Continue the coro by symmetric transfer, like resume() but without calling it.
+        * \returns the handle to resume.
+        */
+        n_exp::coroutine_handle<> transfer() noexcept {
+            if (JobSystem::is_cancelled(this)) [[unlikely]] {
+                return stop();
+            }
+
+            if (m_is_parent_function) {
+                m_state.fetch_and(~c_value, std::memory_order_relaxed);   //invalidate return value
+            }
+            return m_coro;
+        };
+
+        /**
+        * \brief The coro is handed to the job system, which will resume it.
+        */
+        void start() noexcept { m_state.fetch_or(c_running, std::memory_order_relaxed); };
+
+        /**
+        * \brief Test whether the coro has stored a value or an exception.
+        * \returns true if a result is available, else false.
+        */
+        bool ready() noexcept { return (m_state.load(std::memory_order_acquire) & (c_value | c_exception | c_stopped)) != 0; };
+
+        /**
+        * \brief Test whether the coro was cancelled and stopped before it could finish its body.
+        * \returns true if the coro has been stopped.
+        */
+        bool stopped() noexcept { return (m_state.load(std::memory_order_acquire) & c_stopped) != 0; };
+
+        /**
+        * \brief Cancel the coro and all its descendants. The coro is stopped the next time it would be resumed,
+        * descendants that have not started yet are skipped. If the coro or a descendant sleeps in after(), then
+        * its timer is removed and it is stopped right away. Coros waiting for I/O are stopped when the I/O completes.
+        */
+        void cancel() noexcept {
+            JobSystem::count_cancellation(1);           //count first, so that is_cancelled() looks at the jobs
+            uint32_t state = m_state.fetch_or(c_cancelled, std::memory_order_acq_rel);
+            if ((state & (c_cancelled | c_finished)) != 0) {
+                JobSystem::count_cancellation(-1);      //the coro has finished or was cancelled before
+                return;
+            }
+            m_cancelled.store(true, std::memory_order_release);
+            JobSystem().release_cancelled_timers();     //do not wait for the timer of a sleeping coro
+        };
+
+        /**
+        * \brief If the coro body threw an exception, then rethrow it.
+        */
+        void rethrow() {
+            if ((m_state.load(std::memory_order_acquire) & c_exception) != 0) {
+                std::rethrow_exception(m_exception);
+            }
+        };
 
         //operators for allocating and deallocating memory, implementations follow later in this file
         template<typename... Args>
@@ -523,8 +764,7 @@ namespace vgjs {
         template<typename F> friend class Coro;
 
     protected:
-        std::shared_ptr<std::pair<bool, T>> m_value_ptr;    ///<a shared view of the return value, use if parent is a function
-        std::pair<bool, T>                  m_value;        ///<a local storage of the value, use if parent is a coroutine
+        T m_value{};        ///<the result slot, lives in the coro frame
 
     public:
 
@@ -548,11 +788,8 @@ namespace vgjs {
         * \param[in] t The value that was returned.
         */
         void return_value(T t) noexcept {   //is called by co_return <VAL>, saves <VAL> in m_value
-            if (m_is_parent_function) {
-                *m_value_ptr = std::make_pair(true, t);
-                return;
-            }
-            m_value = std::make_pair(true, t);
+            m_value = std::move(t);
+            set_value();
         }
 
         /**
@@ -561,12 +798,8 @@ namespace vgjs {
         * \returns a yield_awaiter
         */
         yield_awaiter<T> yield_value(T t) noexcept {
-            if (m_is_parent_function) {
-                *m_value_ptr = std::make_pair(true, t);
-            }
-            else {
-                m_value = std::make_pair(true, t);
-            }
+            m_value = std::move(t);
+            set_value();
             return {};  //return a yield_awaiter
         }
 
@@ -578,6 +811,15 @@ namespace vgjs {
         template<typename U>
         awaitable_tuple<T, U> await_transform(U&& func) noexcept { return { std::tuple<U&&>(std::forward<U>(func)) }; };
 
+        /**
+        * \brief Called by co_await for objects that are awaiters themselves, e.g. parallel_for().
+        * \param[in] awaiter The awaiter.
+        * \returns the awaiter.
+        */
+        template<typename U>
+        requires AWAITER<U>
+        U&& await_transform(U&& awaiter) noexcept { return std::forward<U>(awaiter); };
+
         template<typename... Ts>
         awaitable_tuple<T, Ts...> await_transform(std::tuple<Ts...>&& tuple) noexcept { return { std::forward<std::tuple<Ts...>>(tuple) }; };
 
@@ -591,6 +833,13 @@ namespace vgjs {
         */
         awaitable_resume_on<T> await_transform(thread_index_t index) noexcept { return { index }; };
 
+        /**.
+        * \brief Called by co_await to create an awaitable for migrating to another worker pool.
+        * \param[in] pool The pool to migrate to.
+        * \returns the awaitable for this parameter type of the co_await operator.
+        */
+        awaitable_resume_on<T> await_transform(pool_t pool) noexcept { return { pool }; };
+
         /**.
         * \brief Called by co_await to create an awaitable for scheduling a tag
         * \param[in] tg The tag to schedule
@@ -628,11 +877,36 @@ namespace vgjs {
         * \param[in] promise The promise corresponding to this future.
         */
         explicit Coro_base(Coro_promise_base* promise ) noexcept : Queuable(), m_promise(promise) {};   //constructor
-        
+
+        /**
+        * \brief Destructor. Destroys the promise if the coro is done or will never be resumed.
+        */
+        ~Coro_base() noexcept { release(); };
+
+        /**
+        * \brief Give up the promise. Whoever comes last, the future or the coro, destroys the frame.
+        */
+        void release() noexcept {
+            if (m_promise != nullptr && m_promise->detach()) {
+                m_promise->m_coro.destroy();
+            }
+            m_promise = nullptr;
+        };
+
         /**
         * \brief Resume the coroutine.
         */
-        bool resume() noexcept { return m_promise->resume(); };         //resume the Coro
+        bool resume() noexcept { m_promise->start(); return m_promise->resume(); };         //resume the Coro
+
+        /**
+        * \brief Cancel the coro and all its descendants, see Coro_promise_base::cancel().
+        */
+        void cancel() noexcept { m_promise->cancel(); };
+
+        /**
+        * \returns true if the coro was cancelled and stopped before it could finish its body.
+        */
+        bool cancelled() noexcept { return m_promise->stopped(); };
         
         /**
         * \returns a pointer to the promise of this coroutine.
@@ -652,8 +926,6 @@ namespace vgjs {
     class Coro : public Coro_base {
     public:
         using promise_type = Coro_promise<T>;
-        bool m_is_parent_function;                          ///<if true then the parent is a function or nullptr
-        std::shared_ptr<std::pair<bool, T>> m_value_ptr;    ///<pointer to the value, use only if parent is a function or nullptr
 
     private:
         n_exp::coroutine_handle<promise_type> m_coro;       ///<handle to Coro promise
@@ -667,68 +939,39 @@ namespace vgjs {
         /**
         * \brief Coro future constructor
         * \param[in] h Coroutine handle
-        * \param[in] value_ptr Shared pointer to the value to return, used only if parent is a function or nullptr
-        * \param[in] is_parent_function Flag for using shared value pointer
         */
-        Coro(   n_exp::coroutine_handle<promise_type> h
-                , std::shared_ptr<std::pair<bool, T>>& value_ptr
-                , bool is_parent_function) noexcept
-            : Coro_base(&h.promise()), m_coro(h), m_is_parent_function(is_parent_function) {
-            if (m_is_parent_function) {
-                m_value_ptr = value_ptr;
-            }
-        };
+        explicit Coro(n_exp::coroutine_handle<promise_type> h) noexcept : Coro_base(&h.promise()), m_coro(h) {};
 
         /**
         * \brief Coro future constructor
         * \param[in] t Source coroutine that is moved into this coroutine
         */
-        Coro(Coro<T>&& t)  noexcept : Coro_base(t.m_promise)
-                                        , m_coro(std::exchange(t.m_coro, {}))
-                                        , m_value_ptr(std::exchange(t.m_value_ptr, {}))
-                                        , m_is_parent_function(std::exchange(t.m_is_parent_function, {})) {};
+        Coro(Coro<T>&& t)  noexcept : Coro_base(std::exchange(t.m_promise, nullptr))
+                                        , m_coro(std::exchange(t.m_coro, {})) {};
 
         /**
         * \brief Move operator
         * \param[in] t Source coroutine that is moved into this coroutine
         */
         void operator= (Coro<T>&& t) noexcept {
-            m_is_parent_function    = t.m_is_parent_function;
+            release();
             m_coro                  = std::exchange(t.m_coro, {});
-            m_value_ptr             = std::exchange( t.m_value_ptr, nullptr );
             m_promise               = std::exchange( t.m_promise, {});
         }
 
-        /**
-        * \brief Destructor of the Coro promise.
-        */
-        ~Coro() noexcept {
-            if (!m_is_parent_function && m_coro) { //destroy the promise only if the parent is a coroutine (else it would destroy itself)
-                if (m_coro.promise().get_self_destruct()) return;
-                m_coro.destroy();
-            }
-        }
-
         /**
         * \brief Test whether promised value is available
         * \returns true if promised value is available, else false
         */
-        bool ready() noexcept {
-            if (m_is_parent_function) {
-                return m_value_ptr->first;
-            }
-            return m_coro.promise().m_value.first;
-        }
+        bool ready() noexcept { return m_promise->ready(); }
 
         /**
-        * \brief Retrieve the promised value - nonblocking
+        * \brief Retrieve the promised value - nonblocking. Rethrows an exception that escaped the coro.
         * \returns the promised value
         */
-        T get() noexcept {
-            if (m_is_parent_function) {
-                return m_value_ptr->second;
-            }
-            return m_coro.promise().m_value.second;
+        T get() {
+            m_promise->rethrow();
+            return m_coro.promise().m_value;
         }
 
         /**
@@ -737,12 +980,15 @@ namespace vgjs {
         * \param[in] thread_index The thread that should execute this coro
         * \param[in] type The type of the coro.
         * \param[in] id A unique ID of the call.
+        * \param[in] deadline The coro should finish within this time, 0 for no deadline.
         * \returns a reference to this Coro so that it can be used with co_await.
         */
-        decltype(auto) operator() (thread_index_t index = thread_index_t{}, thread_type_t type = thread_type_t{}, thread_id_t id = thread_id_t{}) {
+        decltype(auto) operator() (thread_index_t index = thread_index_t{}, thread_type_t type = thread_type_t{}, thread_id_t id = thread_id_t{}
+            , std::chrono::nanoseconds deadline = std::chrono::nanoseconds{ 0 }) {
             m_promise->m_thread_index = index;
             m_promise->m_type = type;
             m_promise->m_id = id;
+            m_promise->m_deadline = JobSystem().deadline_after(deadline);
             return std::move(*this);
         }
     };
@@ -755,7 +1001,7 @@ namespace vgjs {
     */
     template<>
     struct yield_awaiter<void> : public suspend_always {
-        void await_suspend(n_exp::coroutine_handle<Coro_promise<void>> h) noexcept;
+        n_exp::coroutine_handle<> await_suspend(n_exp::coroutine_handle<Coro_promise<void>> h) noexcept;
     };
 
     /**
@@ -763,7 +1009,7 @@ namespace vgjs {
     */
     template<>
     struct final_awaiter<void> : public n_exp::suspend_always {
-        bool await_suspend(n_exp::coroutine_handle<Coro_promise<void>> h) noexcept;
+        n_exp::coroutine_handle<> await_suspend(n_exp::coroutine_handle<Coro_promise<void>> h) noexcept;
     };
 
     /**
@@ -794,7 +1040,7 @@ namespace vgjs {
         /**
         * \brief Return from aco_return.
         */
-        void return_void() noexcept {};
+        void return_void() noexcept { set_value(); };
 
         /**
         * \brief Await a co_yield.
@@ -810,6 +1056,15 @@ namespace vgjs {
         template<typename U>
         awaitable_tuple<void, U> await_transform(U&& func) noexcept { return { std::tuple<U&&>(std::forward<U>(func)) }; };
 
+        /**
+        * \brief Called by co_await for objects that are awaiters themselves, e.g. parallel_for().
+        * \param[in] awaiter The awaiter.
+        * \returns the awaiter.
+        */
+        template<typename U>
+        requires AWAITER<U>
+        U&& await_transform(U&& awaiter) noexcept { return std::forward<U>(awaiter); };
+
         template<typename... Ts>
         awaitable_tuple<void, Ts...> await_transform(std::tuple<Ts...>&& tuple) noexcept { return { std::forward<std::tuple<Ts...>>(tuple) }; };
 
@@ -823,6 +1078,13 @@ namespace vgjs {
         */
         awaitable_resume_on<void> await_transform(thread_index_t index ) noexcept { return { index }; };
 
+        /**.
+        * \brief Called by co_await to create an awaitable for migrating to another worker pool.
+        * \param[in] pool The pool to migrate to.
+        * \returns the awaitable for this parameter type of the co_await operator.
+        */
+        awaitable_resume_on<void> await_transform(pool_t pool) noexcept { return { pool }; };
+
         /**.
         * \brief Called by co_await to create an awaitable for scheduling a tag
         * \param[in] tg The tag to schedule
@@ -843,9 +1105,6 @@ namespace vgjs {
     */
     template<>
     class Coro<void> : public Coro_base {
-    protected:
-        bool m_is_parent_function;      ///<If true then the parent is a function or nullptr, if false the parent is a coroutine
-
     public:
         using promise_type = Coro_promise<void>;
 
@@ -861,38 +1120,36 @@ namespace vgjs {
         /**
         * \brief Coro future constructor
         * \param[in] h Coroutine handle
-        * \param[in] is_parent_function Flag for using shared value pointer
         */
-        Coro(n_exp::coroutine_handle<promise_type> coro, bool is_parent_function) noexcept
-            : Coro_base(&coro.promise()), m_is_parent_function(is_parent_function), m_coro(coro) {};
+        explicit Coro(n_exp::coroutine_handle<promise_type> coro) noexcept : Coro_base(&coro.promise()), m_coro(coro) {};
 
         /**
         * \brief Coro future constructor
         * \param[in] t Source coroutine that is moved into this coroutine
         */
-        Coro(Coro<void>&& t) noexcept : Coro_base(t.m_promise)
-                                        , m_coro(std::exchange(t.m_coro, {}))
-                                        , m_is_parent_function(t.m_is_parent_function) {};
+        Coro(Coro<void>&& t) noexcept : Coro_base(std::exchange(t.m_promise, nullptr))
+                                        , m_coro(std::exchange(t.m_coro, {})) {};
 
         /**
         * \brief Move operator
         * \param[in] t Source coroutine that is moved into this coroutine
         */
         void operator= (Coro<void>&& t) noexcept { 
-            m_is_parent_function    = t.m_is_parent_function;
+            release();
             m_coro                  = std::exchange(t.m_coro, {});
             m_promise               = std::exchange(t.m_promise, {});
         };
 
         /**
-        * \brief Destructor of the Coro promise.
+        * \brief Test whether the coro has finished or thrown an exception.
+        * \returns true if the coro is done, else false
         */
-        ~Coro() noexcept {
-            if (!m_is_parent_function && m_coro) { //destroy the promise only if the parent is a coroutine (else it would destroy itself)
-                if (m_coro.promise().get_self_destruct()) return;
-                m_coro.destroy();
-            }
-        }
+        bool ready() noexcept { return m_promise->ready(); }
+
+        /**
+        * \brief Rethrows an exception that escaped the coro, if any.
+        */
+        void get() { m_promise->rethrow(); }
 
         /**
         * \brief Function operator so you can pass on parameters to the Coro.
@@ -900,12 +1157,15 @@ namespace vgjs {
         * \param[in] thread_index The thread that should execute this coro
         * \param[in] type The type of the coro.
         * \param[in] id A unique ID of the call.
+        * \param[in] deadline The coro should finish within this time, 0 for no deadline.
         * \returns a reference to this Coro so that it can be used with co_await.
         */
-        decltype(auto) operator() (thread_index_t index = thread_index_t{}, thread_type_t type = thread_type_t{}, thread_id_t id = thread_id_t{}) {
+        decltype(auto) operator() (thread_index_t index = thread_index_t{}, thread_type_t type = thread_type_t{}, thread_id_t id = thread_id_t{}
+            , std::chrono::nanoseconds deadline = std::chrono::nanoseconds{ 0 }) {
             m_promise->m_thread_index = index;
             m_promise->m_type = type;
             m_promise->m_id = id;
+            m_promise->m_deadline = JobSystem().deadline_after(deadline);
             return std::move(*this);
         }
     };
@@ -952,11 +1212,71 @@ namespace vgjs {
     /**
     * \brief After suspension, call parent to run it as continuation
     * \param[in] h Handle of the coro, is used to get the promise (=Job)
+    * \returns the handle of the parent if it continues on this thread, else a noop handle.
     */
-    inline void yield_awaiter<void>::await_suspend(n_exp::coroutine_handle<Coro_promise<void>> h) noexcept { //called after suspending
+    template<typename U>
+    inline n_exp::coroutine_handle<> yield_awaiter<U>::await_suspend(n_exp::coroutine_handle<Coro_promise<U>> h) noexcept { //called after suspending
+        auto& promise = h.promise();
+        bool is_parent_function = promise.m_is_parent_function;
+        auto parent = promise.m_parent;
+        bool orphan = promise.suspend();        //after this the future may destroy the frame
+        bool resume_parent = false;
+
+        if (parent != nullptr) {          //if there is a parent
+            if (is_parent_function) {       //if it is a Job
+                JobSystem().child_finished((Job*)parent); //indicate that this child has finished
+            }
+            else {  //parent is a coro
+                uint32_t num = parent->m_children.fetch_sub(1);   //one less child
+                if (num == 1) {                                             //was it the last child?
+                    resume_parent = JobSystem().transfer(parent);  //if last continue with the parent coro
+                }
+            }
+        }
+        if (orphan) h.destroy();            //the future is gone, nobody will resume this coro
+        return resume_parent ? static_cast<Coro_promise_base*>(parent)->transfer() : n_exp::noop_coroutine();
+    }
+
+
+    /**
+    * \brief After suspension, call parent to run it as continuation
+    * \param[in] h Handle of the coro, is used to get the promise (=Job)
+    * \returns the handle of the parent if it continues on this thread, else a noop handle.
+    */
+    template<typename U>
+    inline n_exp::coroutine_handle<> final_awaiter<U>::await_suspend(n_exp::coroutine_handle<Coro_promise<U>> h) noexcept { //called after suspending
+        auto& promise = h.promise();
+        bool is_parent_function = promise.m_is_parent_function;
+        auto parent = promise.m_parent;
+        bool resume_parent = false;
+        if (promise.m_deadline > 0) JobSystem().deadline_finished(&promise);
+
+        if (parent != nullptr) {          //if there is a parent
+            if (is_parent_function) {       //if it is a Job
+                JobSystem().child_finished((Job*)parent);//indicate that this child has finished
+            }
+            else {
+                uint32_t num = parent->m_children.fetch_sub(1);        //one less child
+                if (num == 1) {                                             //was it the last child?
+                    resume_parent = JobSystem().transfer(parent);  //if last continue with the parent coro
+                }
+            }
+        }
+        if (!promise.finish()) h.destroy();  //the future is gone, so the coro destroys itself
+        return resume_parent ? static_cast<Coro_promise_base*>(parent)->transfer() : n_exp::noop_coroutine();
+    }
+
+
+    /**
+    * \brief After suspension, call parent to run it as continuation
+    * \param[in] h Handle of the coro, is used to get the promise (=Job)
+    */
+    inline n_exp::coroutine_handle<> yield_awaiter<void>::await_suspend(n_exp::coroutine_handle<Coro_promise<void>> h) noexcept { //called after suspending
         Coro_promise<void>& promise = h.promise();                 ///<tmp pointer to promise
         bool is_parent_function = promise.m_is_parent_function;    ///<tmp copy of flag
         auto parent = promise.m_parent;                            ///<tmp pointer to parent
+        bool orphan = promise.suspend();                           ///<after this the future may destroy the frame
+        bool resume_parent = false;                                ///<continue with the parent on this thread
 
         if (parent != nullptr) {          //if there is a parent
             if (is_parent_function) {       //if it is a Job
@@ -965,11 +1285,12 @@ namespace vgjs {
             else {  //parent is a coro
                 uint32_t num = parent->m_children.fetch_sub(1);   //one less child
                 if (num == 1) {                                   //was it the last child?
-                    JobSystem().schedule_job(parent);       //if last reschedule the parent coro
+                    resume_parent = JobSystem().transfer(parent);  //if last continue with the parent coro
                 }
             }
         }
-        return;
+        if (orphan) h.destroy();      //the future is gone, nobody will resume this coro
+        return resume_parent ? static_cast<Coro_promise_base*>(parent)->transfer() : n_exp::noop_coroutine();
     }
 
 
@@ -977,10 +1298,12 @@ namespace vgjs {
     * \brief After suspension, call parent to run it as continuation
     * \param[in] h Handle of the coro, is used to get the promise (=Job)
     */
-    inline bool final_awaiter<void>::await_suspend(n_exp::coroutine_handle<Coro_promise<void>> h) noexcept { //called after suspending
+    inline n_exp::coroutine_handle<> final_awaiter<void>::await_suspend(n_exp::coroutine_handle<Coro_promise<void>> h) noexcept { //called after suspending
         Coro_promise<void>& promise = h.promise();                 ///<tmp pointer to promise
         bool is_parent_function = promise.m_is_parent_function;    ///<tmp copy of flag
         auto parent = promise.m_parent;                            ///<tmp pointer to parent
+        bool resume_parent = false;                                ///<continue with the parent on this thread
+        if (promise.m_deadline > 0) JobSystem().deadline_finished(&promise);
 
         if (parent != nullptr) {            //if there is a parent
             if (is_parent_function) {       //if it is a Job
@@ -989,11 +1312,12 @@ namespace vgjs {
             else {
                 uint32_t num = parent->m_children.fetch_sub(1);   //one less child
                 if (num == 1) {                                   //was it the last child?
-                    JobSystem().schedule_job(parent);       //if last reschedule the parent coro
+                    resume_parent = JobSystem().transfer(parent);  //if last continue with the parent coro
                 }
             }
         }
-        return !is_parent_function; //if parent is coro, then you are in sync -> the future will destroy the promise
+        if (!promise.finish()) h.destroy();  //the future is gone, so the coro destroys itself
+        return resume_parent ? static_cast<Coro_promise_base*>(parent)->transfer() : n_exp::noop_coroutine();
     }
 
 
@@ -1022,6 +1346,9 @@ namespace vgjs {
             std::terminate();
         }
         *reinterpret_cast<n_pmr::memory_resource**>(ptr + allocatorOffset) = mr;
+        EpochResource* epoch = EpochResource::find(mr);
+        t_frame_epoch = epoch != nullptr ? epoch->epoch() : 0;  //for the promise constructor
+        if (epoch != nullptr) epoch->job_allocated();
         return ptr;
     }
 
@@ -1079,7 +1406,36 @@ namespace vgjs {
         //std::cout << "Coro delete " << sz << "\n";
         auto allocatorOffset = (sz + alignof(n_pmr::memory_resource*) - 1) & ~(alignof(n_pmr::memory_resource*) - 1);
         auto allocator = (n_pmr::memory_resource**)((char*)(ptr)+allocatorOffset);
-        (*allocator)->deallocate(ptr, allocatorOffset + sizeof(n_pmr::memory_resource*));
+        n_pmr::memory_resource* mr = *allocator;
+        mr->deallocate(ptr, allocatorOffset + sizeof(n_pmr::memory_resource*));
+        if (EpochResource* epoch = EpochResource::find(mr); epoch != nullptr) epoch->job_freed();  //after the memory was freed
+    }
+
+    /**
+    * \brief Stop a cancelled coro and inform its parent, like final_awaiter does.
+    * \returns the handle of the parent if it continues on this thread, else a noop handle.
+    */
+    inline n_exp::coroutine_handle<> Coro_promise_base::stop() noexcept {
+        JobSystem().count_skipped();
+        bool is_parent_function = m_is_parent_function;
+        auto parent = m_parent;
+        bool resume_parent = false;
+        if (m_deadline > 0) JobSystem().deadline_finished(this);
+        m_state.fetch_or(c_stopped, std::memory_order_release);    //the parent sees this when it resumes
+
+        if (parent != nullptr) {
+            if (is_parent_function) {
+                JobSystem().child_finished((Job*)parent);
+            }
+            else {
+                uint32_t num = parent->m_children.fetch_sub(1);
+                if (num == 1) {
+                    resume_parent = JobSystem().transfer(parent);
+                }
+            }
+        }
+        if (!finish()) m_coro.destroy();    //the future is gone, so the coro destroys itself
+        return resume_parent ? static_cast<Coro_promise_base*>(parent)->transfer() : n_exp::noop_coroutine();
     }
 
     //---------------------------------------------------------------------------------------------------
@@ -1095,19 +1451,12 @@ namespace vgjs {
     }
 
     /**
-    * \brief Get Coro<T> from the Coro_promise<T>. Creates a shared value to trade the result.
+    * \brief Get Coro<T> from the Coro_promise<T>. The result is stored in the promise.
     * \returns the Coro<T> from the promise.
     */
     template<typename T>
     inline Coro<T> Coro_promise<T>::get_return_object() noexcept {
-        m_ready_ptr = &m_value.first;
-        if (m_is_parent_function) {
-            m_value_ptr = std::make_shared<std::pair<bool, T>>(std::make_pair(false, T{}));
-            m_ready_ptr = &(m_value_ptr->first);
-        }
-
-        return Coro<T>{
-            n_exp::coroutine_handle<Coro_promise<T>>::from_promise(*this), m_value_ptr, m_is_parent_function };
+        return Coro<T>{ n_exp::coroutine_handle<Coro_promise<T>>::from_promise(*this) };
     }
 
     //---------------------------------------------------------------------------------------------------
@@ -1122,11 +1471,11 @@ namespace vgjs {
     }
 
     /**
-    * \brief Get Coro<void> from the Coro_promise<T>. Creates a shared value to trade the result.
+    * \brief Get Coro<void> from the Coro_promise<T>.
     * \returns the Coro<void> from the promise.
     */
     inline Coro<void> Coro_promise<void>::get_return_object() noexcept {
-        return Coro<void>{n_exp::coroutine_handle<Coro_promise<void>>::from_promise(*this), m_is_parent_function };
+        return Coro<void>{ n_exp::coroutine_handle<Coro_promise<void>>::from_promise(*this) };
     }
 
 }
@@ -0,0 +1,491 @@
+#ifndef VGJSIO_H
+#define VGJSIO_H
+
+
+/**
+*
+* \file
+* \brief Asynchronous file and socket I/O for coroutines.
+*
+* A coroutine calling co_await async_read() or co_await async_write() is suspended while the
+* operation runs, so it does not hold a worker thread. One poller thread waits for the completions
+* and schedules the coroutine again, into the global queue of the thread that issued the request.
+* The data goes directly into or out of the buffer given by the caller.
+*
+* On Windows the poller uses an I/O completion port, so files must be opened with FILE_FLAG_OVERLAPPED.
+* On Linux it uses io_uring. If io_uring is not available, e.g. because of a seccomp filter or a kernel
+* older than 5.6 that lacks IORING_OP_READ and IORING_OP_WRITE, then the poller thread runs blocking
+* pread() and pwrite() calls instead.
+*
+*/
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <span>
+#include <string>
+
+#if defined(_WIN32)
+    #include <Windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #if defined(__linux__) && __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #include <sys/mman.h>
+        #include <sys/syscall.h>
+        #define VGJS_IO_URING
+    #endif
+#endif
+
+#include "VGJS.h"
+#include "VGJSCoro.h"
+
+
+namespace vgjs {
+
+#if defined(_WIN32)
+    using io_handle_t = HANDLE;                     ///<a file or socket
+    inline const io_handle_t c_invalid_io_handle = INVALID_HANDLE_VALUE;
+#else
+    using io_handle_t = int;                        ///<a file descriptor
+    inline const io_handle_t c_invalid_io_handle = -1;
+#endif
+
+    const int64_t c_io_stream = -1;     ///<offset for sockets and pipes, read or write at the current position
+
+
+    /**
+    * \brief One read or write. It lives in the awaiter, i.e. in the frame of the waiting coroutine.
+    */
+    struct IoRequest {
+#if defined(_WIN32)
+        OVERLAPPED      m_overlapped{};                 //must be first, the completion port returns a pointer to it
+#endif
+        Job_base*       m_job = nullptr;                //the suspended coroutine
+        int32_t         m_thread = -1;                  //thread that issued the request
+        io_handle_t     m_handle = c_invalid_io_handle;
+        int64_t         m_offset = 0;
+        void*           m_data = nullptr;
+        uint32_t        m_size = 0;
+        bool            m_write = false;
+        int64_t         m_result = 0;                   //bytes read or written, or a negative error code
+    };
+
+
+    /**
+    * \brief The poller thread and the backend of the asynchronous I/O.
+    */
+    class IoService {
+        std::thread                 m_poller;           //waits for completions
+        std::atomic<bool>           m_stop = false;
+        std::atomic<uint32_t>       m_in_flight = 0;    //requests handed to the kernel that have not completed yet
+
+#if defined(_WIN32)
+        HANDLE                      m_port = nullptr;   //the completion port
+#else
+        std::mutex                  m_mutex;            //protects the submission ring or the fallback queue
+        std::condition_variable     m_cv;               //wakes up the fallback poller
+        std::deque<IoRequest*>      m_pending;          //requests for the fallback poller
+        bool                        m_uring = false;    //true if io_uring is used
+#endif
+
+#if defined(VGJS_IO_URING)
+        int                         m_ring_fd = -1;
+        io_uring_params             m_params{};
+        uint8_t*                    m_sq_ring = nullptr;
+        uint8_t*                    m_cq_ring = nullptr;
+        std::size_t                 m_sq_ring_size = 0;
+        std::size_t                 m_cq_ring_size = 0;
+        io_uring_sqe*               m_sqes = nullptr;
+
+        /**
+        * \brief Access a field of a ring that is shared with the kernel.
+        */
+        static std::atomic_ref<uint32_t> ring(uint8_t* base, uint32_t offset) noexcept {
+            return std::atomic_ref<uint32_t>(*(uint32_t*)(base + offset));
+        }
+
+        /**
+        * \brief Ask the kernel whether it supports the operations that are used.
+        * \returns true if IORING_OP_READ and IORING_OP_WRITE are supported.
+        */
+        bool probe_uring() noexcept {
+            const uint32_t c_probe_ops = 64;
+            std::array<uint64_t, (sizeof(io_uring_probe) + c_probe_ops * sizeof(io_uring_probe_op)) / sizeof(uint64_t)> memory{};
+            io_uring_probe* probe = (io_uring_probe*)memory.data();
+            if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PROBE, probe, c_probe_ops) < 0) return false;  //older than 5.6
+            auto supported = [&](uint32_t op) {
+                return op <= probe->last_op && op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+            };
+            return supported(IORING_OP_READ) && supported(IORING_OP_WRITE);
+        }
+
+        /**
+        * \brief Set up the io_uring instance and map its rings.
+        * \returns true if io_uring can be used.
+        */
+        bool setup_uring() noexcept {
+            m_ring_fd = (int)syscall(__NR_io_uring_setup, 256, &m_params);
+            if (m_ring_fd < 0) return false;
+            if (!probe_uring()) {           //io_uring exists, but reads and writes would fail with EINVAL
+                close(m_ring_fd);
+                m_ring_fd = -1;
+                return false;
+            }
+
+            m_sq_ring_size = m_params.sq_off.array + m_params.sq_entries * sizeof(uint32_t);
+            m_cq_ring_size = m_params.cq_off.cqes + m_params.cq_entries * sizeof(io_uring_cqe);
+            bool single = (m_params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single) m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+
+            void* sq = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+            void* cq = single ? sq : mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+            void* sqes = mmap(nullptr, m_params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+            if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+                close(m_ring_fd);
+                m_ring_fd = -1;
+                return false;
+            }
+            m_sq_ring = (uint8_t*)sq;
+            m_cq_ring = (uint8_t*)cq;
+            m_sqes = (io_uring_sqe*)sqes;
+            return true;
+        }
+
+        /**
+        * \brief Put a request into the submission ring and hand it to the kernel.
+        * \param[in] request The request, or nullptr for a no-op that wakes up the poller.
+        * \returns true if the request was submitted. If not, the entry is removed from the ring again, so the
+        * caller can run the request in another way.
+        */
+        bool submit_uring(IoRequest* request) noexcept {
+            std::lock_guard lock(m_mutex);
+            uint32_t tail = ring(m_sq_ring, m_params.sq_off.tail).load(std::memory_order_relaxed);
+            uint32_t head = ring(m_sq_ring, m_params.sq_off.head).load(std::memory_order_acquire);
+            if (tail - head >= m_params.sq_entries) return false;
+
+            uint32_t index = tail & ring(m_sq_ring, m_params.sq_off.ring_mask).load(std::memory_order_relaxed);
+            io_uring_sqe& sqe = m_sqes[index];
+            sqe = io_uring_sqe{};
+            if (request == nullptr) {
+                sqe.opcode = IORING_OP_NOP;
+            }
+            else {
+                sqe.opcode = request->m_write ? IORING_OP_WRITE : IORING_OP_READ;
+                sqe.fd = request->m_handle;
+                sqe.off = (uint64_t)request->m_offset;      //-1 means the current position
+                sqe.addr = (uint64_t)request->m_data;
+                sqe.len = request->m_size;
+                sqe.user_data = (uint64_t)request;
+            }
+            ((uint32_t*)(m_sq_ring + m_params.sq_off.array))[index] = index;
+            ring(m_sq_ring, m_params.sq_off.tail).store(tail + 1, std::memory_order_release);
+
+            int res;
+            do {
+                res = (int)syscall(__NR_io_uring_enter, m_ring_fd, 1, 0, 0, nullptr, 0);
+            } while (res < 0 && errno == EINTR);
+            if (res < 1) {          //e.g. EAGAIN or EBUSY, the kernel has not taken the entry
+                if (ring(m_sq_ring, m_params.sq_off.head).load(std::memory_order_acquire) != tail + 1) {
+                    ring(m_sq_ring, m_params.sq_off.tail).store(tail, std::memory_order_release);  //take it back, a later enter must not submit it
+                }
+                return false;
+            }
+            if (request != nullptr) m_in_flight.fetch_add(1);  //before the poller can take the lock for its completion
+            return true;
+        }
+
+        /**
+        * \brief Wait for completions and reschedule the coroutines.
+        */
+        void poll_uring() noexcept {
+            while (true) {
+                syscall(__NR_io_uring_enter, m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                uint32_t head = ring(m_cq_ring, m_params.cq_off.head).load(std::memory_order_relaxed);
+                uint32_t tail = ring(m_cq_ring, m_params.cq_off.tail).load(std::memory_order_acquire);
+                uint32_t mask = ring(m_cq_ring, m_params.cq_off.ring_mask).load(std::memory_order_relaxed);
+                { std::lock_guard lock(m_mutex); }  //synchronize with the submitting threads, the kernel is not part of the memory model
+                for (; head != tail; ++head) {
+                    io_uring_cqe& cqe = ((io_uring_cqe*)(m_cq_ring + m_params.cq_off.cqes))[head & mask];
+                    if (cqe.user_data != 0) {
+                        complete((IoRequest*)cqe.user_data, cqe.res);
+                        m_in_flight.fetch_sub(1);
+                    }
+                }
+                ring(m_cq_ring, m_params.cq_off.head).store(head, std::memory_order_release);
+                if (m_stop.load() && m_in_flight.load() == 0) return;  //all submitted requests have completed
+            }
+        }
+#endif
+
+        /**
+        * \brief Store the result and schedule the coroutine again, preferably on the thread that issued the request.
+        * \param[in] request The finished request.
+        * \param[in] result Bytes read or written, or a negative error code.
+        */
+        static void complete(IoRequest* request, int64_t result) noexcept {
+            Job_base* job = request->m_job;         //the coroutine may run and destroy the request right after scheduling
+            int32_t thread = request->m_thread;
+            request->m_result = result;
+
+            JobSystem js;
+            if (thread >= 0 && thread < (int32_t)js.get_thread_count().value && job->m_thread_index.value < 0 && job->m_deadline == 0) {
+                js.schedule_hint(job, thread);      //can still be stolen if the thread is busy
+            }
+            else {
+                js.schedule_job(job);
+            }
+        }
+
+#if !defined(_WIN32)
+        /**
+        * \brief Run one request with a blocking call.
+        * \param[in] request The request.
+        */
+        static void run_blocking(IoRequest* request) noexcept {
+            ssize_t res;
+            do {
+                if (request->m_write) {
+                    res = request->m_offset < 0 ? ::write(request->m_handle, request->m_data, request->m_size)
+                        : ::pwrite(request->m_handle, request->m_data, request->m_size, (off_t)request->m_offset);
+                }
+                else {
+                    res = request->m_offset < 0 ? ::read(request->m_handle, request->m_data, request->m_size)
+                        : ::pread(request->m_handle, request->m_data, request->m_size, (off_t)request->m_offset);
+                }
+            } while (res < 0 && errno == EINTR);
+            complete(request, res < 0 ? -(int64_t)errno : (int64_t)res);
+        }
+
+        /**
+        * \brief The fallback poller, runs the requests one after the other.
+        */
+        void poll_blocking() noexcept {
+            std::unique_lock lock(m_mutex);
+            while (true) {
+                m_cv.wait(lock, [&]() { return m_stop.load() || !m_pending.empty(); });
+                if (m_pending.empty()) return;      //only stop when everything is done
+                IoRequest* request = m_pending.front();
+                m_pending.pop_front();
+                lock.unlock();
+                run_blocking(request);
+                lock.lock();
+            }
+        }
+#endif
+
+    public:
+        /**
+        * \brief Start the poller thread with the best backend of this platform.
+        */
+        IoService() {
+#if defined(_WIN32)
+            m_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+            m_poller = std::thread([this]() {
+                while (true) {
+                    DWORD bytes = 0;
+                    ULONG_PTR key = 0;
+                    OVERLAPPED* overlapped = nullptr;
+                    BOOL ok = GetQueuedCompletionStatus(m_port, &bytes, &key, &overlapped, INFINITE);
+                    if (overlapped == nullptr) {
+                        if (!ok || (m_stop.load() && m_in_flight.load() == 0)) return;   //the port was closed or stop() was called
+                        continue;
+                    }
+                    DWORD error = ok ? 0 : GetLastError();
+                    complete((IoRequest*)overlapped, ok || error == ERROR_HANDLE_EOF ? (int64_t)bytes : -(int64_t)error);
+                    if (m_in_flight.fetch_sub(1) == 1 && m_stop.load()) return;     //the last request after stop()
+                }
+            });
+#else
+    #if defined(VGJS_IO_URING)
+            m_uring = setup_uring();
+            if (m_uring) {
+                m_poller = std::thread([this]() { poll_uring(); });
+                return;
+            }
+    #endif
+            m_poller = std::thread([this]() { poll_blocking(); });
+#endif
+        }
+
+        IoService(const IoService&) = delete;
+        IoService& operator=(const IoService&) = delete;
+
+        /**
+        * \brief Stop the poller thread after all submitted requests have completed.
+        */
+        ~IoService() {
+            m_stop = true;
+#if defined(_WIN32)
+            PostQueuedCompletionStatus(m_port, 0, 0, nullptr);
+            m_poller.join();
+            CloseHandle(m_port);
+#else
+    #if defined(VGJS_IO_URING)
+            if (m_uring) {
+                submit_uring(nullptr);          //wake up the poller
+                m_poller.join();
+                munmap(m_sqes, m_params.sq_entries * sizeof(io_uring_sqe));
+                if (m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+                munmap(m_sq_ring, m_sq_ring_size);
+                close(m_ring_fd);
+                return;
+            }
+    #endif
+            m_cv.notify_all();
+            m_poller.join();
+#endif
+        }
+
+        /**
+        * \brief Start a request. Its coroutine is scheduled once the request has completed, also if it fails right away.
+        * \param[in] request The request.
+        */
+        void submit(IoRequest* request) noexcept {
+#if defined(_WIN32)
+            CreateIoCompletionPort(request->m_handle, m_port, 0, 0);    //fails harmlessly if the handle is associated already
+            uint64_t offset = request->m_offset < 0 ? 0 : (uint64_t)request->m_offset;
+            request->m_overlapped.Offset = (DWORD)offset;
+            request->m_overlapped.OffsetHigh = (DWORD)(offset >> 32);
+            m_in_flight.fetch_add(1);       //a completion packet is queued unless the call fails right away
+            BOOL ok = request->m_write ? WriteFile(request->m_handle, request->m_data, request->m_size, nullptr, &request->m_overlapped)
+                                       : ReadFile(request->m_handle, request->m_data, request->m_size, nullptr, &request->m_overlapped);
+            if (!ok) {
+                DWORD error = GetLastError();
+                if (error != ERROR_IO_PENDING) {
+                    m_in_flight.fetch_sub(1);
+                    complete(request, error == ERROR_HANDLE_EOF ? 0 : -(int64_t)error);
+                }
+            }
+#else
+    #if defined(VGJS_IO_URING)
+            if (m_uring) {
+                if (!submit_uring(request)) run_blocking(request);     //the ring is full or the kernel refused it, do it right here
+                return;
+            }
+    #endif
+            {
+                std::lock_guard lock(m_mutex);
+                m_pending.push_back(request);
+            }
+            m_cv.notify_one();
+#endif
+        }
+
+        /**
+        * \returns true if io_uring or a completion port is used, false for the blocking fallback.
+        */
+        bool is_async() const noexcept {
+#if defined(_WIN32)
+            return true;
+#else
+            return m_uring;
+#endif
+        }
+    };
+
+
+    /**
+    * \brief Get the I/O service. The poller thread is started on first use.
+    * \returns the I/O service.
+    */
+    inline IoService& io_service() {
+        static IoService service;
+        return service;
+    }
+
+
+    /**
+    * \brief Awaitable for a read or a write. The coroutine is suspended until the request has completed.
+    */
+    struct awaitable_io : suspend_always {
+        IoRequest m_request;
+
+        /**
+        * \brief Submit the request. The coroutine may be resumed by another thread before this returns.
+        * \param[in] h The coro handle, can be used to get the promise.
+        */
+        template<typename P>
+        void await_suspend(n_exp::coroutine_handle<P> h) noexcept {
+            m_request.m_job = &h.promise();
+            m_request.m_thread = JobSystem().get_thread_index().value;
+            io_service().submit(&m_request);
+        }
+
+        /**
+        * \returns the number of bytes read or written, or a negative error code (-errno, or -GetLastError() on Windows).
+        */
+        int64_t await_resume() noexcept { return m_request.m_result; }
+
+        awaitable_io(io_handle_t handle, int64_t offset, void* data, std::size_t size, bool write) noexcept {
+            m_request.m_handle = handle;
+            m_request.m_offset = offset;
+            m_request.m_data = data;
+            m_request.m_size = (uint32_t)std::min<std::size_t>(size, UINT32_MAX);
+            m_request.m_write = write;
+        }
+    };
+
+
+    /**
+    * \brief Read into a buffer, e.g. auto bytes = co_await async_read(file, offset, std::as_writable_bytes(std::span(buffer))).
+    * \param[in] handle The file or socket.
+    * \param[in] offset Position in the file, or c_io_stream for sockets and pipes.
+    * \param[in] buffer The buffer, it must stay alive until the co_await returns.
+    * \returns the awaitable, co_await returns the number of bytes read, or a negative error code.
+    */
+    inline awaitable_io async_read(io_handle_t handle, int64_t offset, std::span<std::byte> buffer) noexcept {
+        return { handle, offset, buffer.data(), buffer.size(), false };
+    }
+
+    /**
+    * \brief Write a buffer.
+    * \param[in] handle The file or socket.
+    * \param[in] offset Position in the file, or c_io_stream for sockets and pipes.
+    * \param[in] buffer The data, it must stay alive until the co_await returns.
+    * \returns the awaitable, co_await returns the number of bytes written, or a negative error code.
+    */
+    inline awaitable_io async_write(io_handle_t handle, int64_t offset, std::span<const std::byte> buffer) noexcept {
+        return { handle, offset, (void*)buffer.data(), buffer.size(), true };
+    }
+
+
+    /**
+    * \brief Open a file so that it can be used with async_read() and async_write().
+    * \param[in] path The path of the file.
+    * \param[in] write If true, the file is opened for reading and writing, and created if it does not exist.
+    * \returns the handle, or c_invalid_io_handle.
+    */
+    inline io_handle_t open_file(const std::string& path, bool write = false) noexcept {
+#if defined(_WIN32)
+        return CreateFileA(path.c_str(), write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ, nullptr
+            , write ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+#else
+        return ::open(path.c_str(), write ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+#endif
+    }
+
+    /**
+    * \brief Close a file opened with open_file().
+    * \param[in] handle The handle.
+    */
+    inline void close_file(io_handle_t handle) noexcept {
+#if defined(_WIN32)
+        CloseHandle(handle);
+#else
+        ::close(handle);
+#endif
+    }
+
+}
+
+
+#endif
+
@@ -0,0 +1,344 @@
+#ifndef VGJSTOPOLOGY_H
+#define VGJSTOPOLOGY_H
+
+
+/**
+*
+* \file
+* \brief Discovery of the CPU topology and placement of worker threads.
+*
+* On Windows the topology is read with GetLogicalProcessorInformationEx() and threads are
+* pinned with SetThreadGroupAffinity(), so processor groups with more than 64 CPUs work.
+* On Linux the topology is read from sysfs and threads are pinned with pthread_setaffinity_np().
+* Memory is placed on a NUMA node with VirtualAllocExNuma() on Windows and mbind() on Linux.
+* Otherwise all CPUs are treated as separate cores sharing one cache and one NUMA node.
+*
+*/
+
+#include <cstdint>
+#include <vector>
+#include <map>
+#include <set>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <tuple>
+#include <cctype>
+#include <new>
+
+#if defined(_WIN32)
+    #include <Windows.h>
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <filesystem>
+#endif
+
+
+namespace vgjs {
+
+    /**
+    * \brief Policies for mapping worker threads to CPUs.
+    */
+    enum class placement_t {
+        none,               ///<do not pin the workers, let the OS decide
+        compact,            ///<fill one L3 domain after the other, SMT siblings next to each other
+        scatter,            ///<spread consecutive workers over L3 domains and NUMA nodes
+        physical_cores      ///<one worker per physical core first, SMT siblings only if there are more workers than cores
+    };
+
+
+    /**
+    * \brief Describes one logical CPU and the domains it belongs to.
+    */
+    struct CpuInfo {
+        uint32_t m_index = 0;   ///<flat index of the CPU in discovery order
+        uint16_t m_group = 0;   ///<Windows processor group, 0 elsewhere
+        uint32_t m_id    = 0;   ///<number of the CPU within its group, as used by the OS
+        uint32_t m_core  = 0;   ///<physical core, counted from 0
+        uint32_t m_smt   = 0;   ///<number of this SMT sibling within its core
+        uint32_t m_l3    = 0;   ///<L3 cache domain, counted from 0
+        uint32_t m_numa  = 0;   ///<NUMA node, counted from 0
+        uint32_t m_node  = 0;   ///<NUMA node as numbered by the OS
+    };
+
+
+    /**
+    * \brief The logical CPUs this process may run on, with their cores, L3 domains and NUMA nodes.
+    */
+    class Topology {
+    public:
+        std::vector<CpuInfo> m_cpus;        ///<all CPUs the process may run on
+        uint32_t m_num_cores = 0;           ///<number of physical cores
+        uint32_t m_num_l3 = 0;              ///<number of L3 cache domains
+        uint32_t m_num_numa = 0;            ///<number of NUMA nodes
+
+        /**
+        * \brief Discover the topology of this machine.
+        */
+        Topology() {
+            discover();
+            if (m_cpus.empty()) {               //nothing found, assume a flat machine
+                uint32_t n = std::max(std::thread::hardware_concurrency(), 1u);
+                for (uint32_t i = 0; i < n; ++i) {
+                    m_cpus.push_back(CpuInfo{ i, 0, i, i, 0, 0, 0 });
+                }
+            }
+            densify();
+        }
+
+        /**
+        * \brief Compute the CPUs for a number of workers.
+        * \param[in] policy The placement policy.
+        * \param[in] count Number of workers.
+        * \param[in] skip Do not use the first skip CPUs, e.g. because the main thread runs there.
+        * \returns one CPU per worker. If there are more workers than CPUs, the CPUs are reused.
+        */
+        std::vector<CpuInfo> place(placement_t policy, uint32_t count, uint32_t skip = 0) const {
+            std::vector<CpuInfo> order(m_cpus.begin() + (skip < m_cpus.size() ? skip : 0), m_cpus.end());
+            auto by = [](auto key) { return [=](const CpuInfo& a, const CpuInfo& b) { return key(a) < key(b); }; };
+
+            switch (policy) {
+            case placement_t::physical_cores:
+                std::stable_sort(order.begin(), order.end(), by([](const CpuInfo& c) { return std::make_tuple(c.m_smt, c.m_numa, c.m_l3, c.m_core); }));
+                break;
+            case placement_t::scatter: {
+                std::stable_sort(order.begin(), order.end(), by([](const CpuInfo& c) { return std::make_tuple(c.m_smt, c.m_core); }));
+                std::map<uint32_t, std::vector<CpuInfo>> domains;      //CPUs of each L3 domain, physical cores first
+                for (auto& cpu : order) domains[cpu.m_l3].push_back(cpu);
+
+                std::vector<std::tuple<uint32_t, uint32_t, std::vector<CpuInfo>*>> ranked;  //(rank within NUMA node, NUMA node, domain)
+                std::map<uint32_t, uint32_t> per_numa;
+                std::size_t longest = 0;
+                for (auto& [l3, cpus] : domains) {
+                    ranked.emplace_back(per_numa[cpus.front().m_numa]++, cpus.front().m_numa, &cpus);
+                    longest = std::max(longest, cpus.size());
+                }
+                std::stable_sort(ranked.begin(), ranked.end());    //interleave the NUMA nodes
+
+                order.clear();
+                for (std::size_t i = 0; i < longest; ++i) {         //round robin over the L3 domains
+                    for (auto& domain : ranked) {
+                        auto& cpus = *std::get<2>(domain);
+                        if (i < cpus.size()) order.push_back(cpus[i]);
+                    }
+                }
+                break;
+            }
+            default:        //compact, and the domains of unpinned workers
+                std::stable_sort(order.begin(), order.end(), by([](const CpuInfo& c) { return std::make_tuple(c.m_numa, c.m_l3, c.m_core, c.m_smt); }));
+                break;
+            }
+
+            std::vector<CpuInfo> result;
+            result.reserve(count);
+            for (uint32_t i = 0; i < count; ++i) result.push_back(order[i % order.size()]);
+            return result;
+        }
+
+        /**
+        * \brief Pin a thread to a CPU.
+        * \param[in] handle The native handle of the thread.
+        * \param[in] cpu The CPU to run on.
+        * \returns true if the thread was pinned, else false.
+        */
+        static bool pin(std::thread::native_handle_type handle, const CpuInfo& cpu) noexcept {
+#if defined(_WIN32)
+            GROUP_AFFINITY affinity{};
+            affinity.Group = cpu.m_group;
+            affinity.Mask = KAFFINITY(1) << cpu.m_id;
+            return SetThreadGroupAffinity((HANDLE)handle, &affinity, nullptr) != 0;
+#elif defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (cpu.m_id >= CPU_SETSIZE) return false;
+            CPU_SET(cpu.m_id, &set);
+            return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+#else
+            return false;
+#endif
+        }
+
+        /**
+        * \brief Allocate memory on the NUMA node of a CPU, e.g. for the data of the worker running there.
+        * The memory is page aligned. If the OS cannot place it, then the first thread touching it decides.
+        * \param[in] size Number of bytes.
+        * \param[in] cpu The CPU.
+        * \returns the memory, or nullptr.
+        */
+        static void* allocate_local(std::size_t size, const CpuInfo& cpu) noexcept {
+#if defined(_WIN32)
+            return VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, cpu.m_node);
+#elif defined(__linux__)
+            void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) return nullptr;
+    #if defined(SYS_mbind)
+            if (cpu.m_node < sizeof(unsigned long) * 8 - 1) {
+                unsigned long mask = 1ul << cpu.m_node;
+                syscall(SYS_mbind, memory, size, 1, &mask, sizeof(mask) * 8, 0);    //1 is MPOL_PREFERRED, the pages are not touched yet
+            }
+    #endif
+            return memory;
+#else
+            return ::operator new(size, std::align_val_t{ 4096 }, std::nothrow);
+#endif
+        }
+
+        /**
+        * \brief Free memory from allocate_local().
+        * \param[in] memory The memory.
+        * \param[in] size Number of bytes, as given to allocate_local().
+        */
+        static void deallocate_local(void* memory, std::size_t size) noexcept {
+#if defined(_WIN32)
+            VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(__linux__)
+            munmap(memory, size);
+#else
+            ::operator delete(memory, std::align_val_t{ 4096 });
+#endif
+        }
+
+    private:
+        /**
+        * \brief Turn the raw core, L3 and NUMA ids into dense numbers and count the domains.
+        */
+        void densify() {
+            std::map<uint32_t, uint32_t> cores, l3s, numas;
+            for (auto& cpu : m_cpus) {
+                cpu.m_node = cpu.m_numa;
+                cpu.m_core = cores.try_emplace(cpu.m_core, (uint32_t)cores.size()).first->second;
+                cpu.m_l3   = l3s.try_emplace(cpu.m_l3, (uint32_t)l3s.size()).first->second;
+                cpu.m_numa = numas.try_emplace(cpu.m_numa, (uint32_t)numas.size()).first->second;
+            }
+            std::map<uint32_t, uint32_t> siblings;
+            for (auto& cpu : m_cpus) cpu.m_smt = siblings[cpu.m_core]++;
+            m_num_cores = (uint32_t)cores.size();
+            m_num_l3    = (uint32_t)l3s.size();
+            m_num_numa  = (uint32_t)numas.size();
+        }
+
+#if defined(_WIN32)
+        /**
+        * \brief Read the topology from GetLogicalProcessorInformationEx(), over all processor groups.
+        */
+        void discover() {
+            DWORD length = 0;
+            GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+            std::vector<char> buffer(length);
+            if (length == 0 || !GetLogicalProcessorInformationEx(RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer.data(), &length)) return;
+
+            auto for_each = [&](auto&& f) {
+                for (DWORD offset = 0; offset < length; ) {
+                    auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer.data() + offset);
+                    f(*info);
+                    offset += info->Size;
+                }
+            };
+            auto find = [&](WORD group, KAFFINITY mask, auto&& f) {   //call f for all CPUs in the mask
+                for (auto& cpu : m_cpus) {
+                    if (cpu.m_group == group && (mask & (KAFFINITY(1) << cpu.m_id)) != 0) f(cpu);
+                }
+            };
+
+            uint32_t core = 0;
+            for_each([&](SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& info) {
+                if (info.Relationship != RelationProcessorCore) return;
+                for (WORD g = 0; g < info.Processor.GroupCount; ++g) {
+                    auto& gm = info.Processor.GroupMask[g];
+                    for (uint32_t bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit) {
+                        if ((gm.Mask & (KAFFINITY(1) << bit)) == 0) continue;
+                        m_cpus.push_back(CpuInfo{ (uint32_t)m_cpus.size(), gm.Group, bit, core, 0, core, 0 });
+                    }
+                }
+                ++core;
+            });
+
+            uint32_t l3 = core;         //L3 ids must not collide with the core ids used as default
+            for_each([&](SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& info) {
+                if (info.Relationship == RelationCache && info.Cache.Level == 3) {
+                    find(info.Cache.GroupMask.Group, info.Cache.GroupMask.Mask, [&](CpuInfo& cpu) { cpu.m_l3 = l3; });
+                    ++l3;
+                }
+                else if (info.Relationship == RelationNumaNode) {
+                    find(info.NumaNode.GroupMask.Group, info.NumaNode.GroupMask.Mask, [&](CpuInfo& cpu) { cpu.m_numa = info.NumaNode.NodeNumber; });
+                }
+            });
+        }
+
+#elif defined(__linux__)
+        /**
+        * \brief Read a number from a sysfs file.
+        * \param[in] path The file.
+        * \param[in] def The value returned if the file cannot be read.
+        * \returns the number.
+        */
+        static uint32_t read_number(const std::string& path, uint32_t def) {
+            std::ifstream file(path);
+            long value = -1;
+            if (!(file >> value) || value < 0) return def;
+            return (uint32_t)value;
+        }
+
+        /**
+        * \brief Read the topology of the CPUs in the affinity mask of this process from sysfs.
+        */
+        void discover() {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) != 0) return;
+
+            const std::string sys = "/sys/devices/system/cpu/cpu";
+            for (uint32_t id = 0; id < CPU_SETSIZE; ++id) {
+                if (!CPU_ISSET(id, &set)) continue;
+                std::string dir = sys + std::to_string(id);
+                uint32_t package = read_number(dir + "/topology/physical_package_id", 0);
+                uint32_t core = (package << 16) | read_number(dir + "/topology/core_id", id);
+
+                uint32_t l3 = package << 16 | 0xffff;   //no L3 information -> one domain per package
+                for (uint32_t index = 0; index < 8; ++index) {
+                    std::string cache = dir + "/cache/index" + std::to_string(index);
+                    if (read_number(cache + "/level", 0) == 3) {
+                        l3 = read_number(cache + "/shared_cpu_list", l3);   //first CPU of a list like "0-3,8-11" names the domain
+                        break;
+                    }
+                }
+
+                uint32_t numa = 0;
+                std::error_code ec;
+                for (auto& entry : std::filesystem::directory_iterator(dir, ec)) {  //cpuN/nodeK links to its NUMA node
+                    std::string name = entry.path().filename().string();
+                    if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::isdigit((unsigned char)name[4])) {
+                        numa = (uint32_t)std::stoul(name.substr(4));
+                        break;
+                    }
+                }
+                m_cpus.push_back(CpuInfo{ (uint32_t)m_cpus.size(), 0, id, core, 0, l3, numa });
+            }
+        }
+
+#else
+        void discover() {}
+#endif
+    };
+
+
+    /**
+    * \brief Get the topology of this machine. It is discovered once.
+    * \returns the topology.
+    */
+    inline const Topology& topology() {
+        static Topology t;
+        return t;
+    }
+
+}
+
+
+#endif
+